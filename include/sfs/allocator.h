@@ -0,0 +1,104 @@
+// allocator.h: Sharded next-fit block allocator over a packed bitmap
+
+#pragma once
+
+#include "sfs/bitmap.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/types.h>
+
+class Allocator {
+private:
+    struct Shard {
+    	std::mutex  Lock;		    // Protects this shard's bits and cursor
+    	size_t	    Start;		    // First allocatable block of shard
+    	size_t	    End;		    // One past last block of shard
+    	size_t	    Cursor;		    // Next-fit cursor within shard
+    };
+
+    Bitmap  Free;		    // 1 means block is free
+    size_t  Low;		    // First allocatable block
+    std::atomic<size_t> Home;	    // Shard where allocations without goal start
+    std::vector<std::unique_ptr<Shard>> Shards; // Word aligned slices of Free
+
+    // Find first extent of at least count free blocks in [from, limit)
+    // @param	from	    First block to consider
+    // @param	limit	    Extents must start before this block
+    // @param	stop	    Extents end at this block at the latest
+    // @param	count	    Wanted extent length
+    // @param	best	    Start of longest shorter extent seen so far
+    // @param	bestLength  Length of longest shorter extent seen so far
+    // Returns start of extent or Bitmap::NONE.
+    size_t find_run(size_t from, size_t limit, size_t stop, size_t count, size_t *best, size_t *bestLength) const;
+
+    // Allocate run within one shard, whose lock must be held
+    // @param	shard	    Shard to allocate from
+    // @param	goal	    Preferred first block, ignored outside shard
+    // @param	count	    Number of blocks wanted
+    // @param	length	    Set to number of blocks actually allocated
+    // Returns first block or -1 if the shard is full.
+    ssize_t allocate_in(Shard &shard, size_t goal, size_t count, size_t *length);
+
+    // Return shard owning block
+    Shard &shard_of(size_t block) { return *Shards[block / SHARD_BLOCKS]; }
+
+public:
+    // Number of blocks per shard, a multiple of the bitmap word size so
+    // that shards never share a word
+    const static size_t SHARD_BLOCKS = 64 * Bitmap::WORD_BITS;
+
+    // Default constructor
+    Allocator() : Low(0), Home(0) {}
+
+    // Reset allocator so that blocks [low, blocks) are free
+    // @param	blocks	    Number of blocks tracked
+    // @param	low	    First allocatable block, everything below is reserved
+    void assign(size_t blocks, size_t low);
+
+    // Mark block as used without going through allocate
+    // @param	block	    Block to reserve
+    void reserve(size_t block);
+
+    // Allocate a free block
+    // @param	goal	    Preferred block, 0 for no preference
+    // Returns goal if free, otherwise the next free block after goal (or
+    // after the cursor without goal), wrapping around; -1 if full.
+    ssize_t allocate(size_t goal = 0);
+
+    // Allocate up to count contiguous free blocks
+    // @param	goal	    Preferred first block, 0 for no preference
+    // @param	count	    Number of blocks wanted
+    // @param	length	    Set to number of blocks actually allocated
+    // Extends from goal if it is free, otherwise takes the first extent of
+    // count blocks after goal (or the cursor), wrapping around, and falls
+    // back to the longest shorter extent; returns first block or -1 if full.
+    // The search stays in goal's shard while it has room.  Without a goal,
+    // shards locked by other threads are skipped so that concurrent
+    // writers spread out.
+    ssize_t allocate_run(size_t goal, size_t count, size_t *length);
+
+    // Return block to allocator, ignoring reserved and out of range blocks
+    // @param	block	    Block to release
+    // Returns whether or not block went from used to free.
+    bool release(size_t block);
+
+    // Return whether or not block is free
+    bool is_free(size_t block) const { return block < Free.size() && Free.test(block); }
+
+    // Return number of free blocks in O(1)
+    size_t free_count() const { return Free.count(); }
+
+    // Return underlying free block bitmap, used to load and store it while
+    // no allocations are running
+    Bitmap &bitmap() { return Free; }
+
+    // Return number of blocks tracked
+    size_t size() const { return Free.size(); }
+
+    // Return number of shards
+    size_t shards() const { return Shards.size(); }
+};
@@ -0,0 +1,131 @@
+// async_disk.h: Disk emulator with asynchronous batched I/O
+
+#pragma once
+
+#include "sfs/disk.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+class AsyncDisk : public Disk {
+private:
+    struct Request {
+    	bool	Write;			    // Whether or not this is a write
+    	int	Block;			    // First block of request
+    	char   *Data;			    // Buffer to transfer
+    	size_t	Count;			    // Number of blocks
+    	Batch  *Owner;			    // Batch waiting for the request
+    };
+
+    size_t  Depth;		    // Maximum number of requests in flight
+    size_t  InFlight;		    // Number of requests submitted but not completed
+    size_t  Peak;		    // Highest number of requests in flight
+    size_t  Submits;		    // Number of requests submitted
+    std::mutex	Lock;		    // Protects queue, counters and batches
+
+#ifdef HAVE_LIBURING
+    struct io_uring Ring;	    // Submission and completion queues
+    bool    RingReady;		    // Whether or not Ring was initialized
+    size_t  Unsubmitted;	    // Queued entries not yet handed to the kernel
+
+    // Hand queued entries to the kernel
+    void flush_ring();
+
+    // Reap one completion, recording any failure in its batch
+    void reap();
+#else
+    std::vector<std::thread> Workers;   // Threads performing requests
+    std::deque<Request> Queue;	    // Requests not yet picked up
+    std::condition_variable Ready;  // Signalled when a request is queued
+    std::condition_variable Done;   // Signalled when a request completes
+    bool    Stopping;		    // Whether or not workers should exit
+
+    // Worker thread main loop
+    void work();
+#endif
+
+    // Wait until requests are no longer in flight, every request if batch
+    // is NULL, with Lock held
+    void drain(std::unique_lock<std::mutex> &guard, Batch *batch);
+
+    // Wait for the requests of a batch, ignoring failures
+    void settle(Batch *batch);
+
+    // Queue request, blocking while the queue is full
+    // @param	request	    Request to queue
+    void submit(const Request &request);
+
+    // Perform request synchronously
+    // @param	request	    Request to perform
+    // Returns empty string on success, otherwise error message.
+    std::string perform(const Request &request);
+
+public:
+    // Default number of requests in flight
+    const static size_t DEFAULT_DEPTH = 32;
+
+    // Most worker threads started by the thread pool fallback
+    const static size_t MAX_WORKERS = 16;
+
+    // Constructor
+    // @param	depth	    Maximum number of requests in flight
+    AsyncDisk(size_t depth = DEFAULT_DEPTH);
+
+    // Destructor, waits for outstanding requests
+    ~AsyncDisk();
+
+    // Open disk image and start the I/O engine
+    // @param	path	    Path to disk image
+    // @param	nblocks	    Number of blocks in disk image
+    // Throws runtime_error exception on error.
+    void open(const char *path, size_t nblocks);
+
+    // Queue read of consecutive blocks, data is only valid after wait
+    // @param	blocknum    First block to read from
+    // @param	data	    Buffer to read into
+    // @param	count	    Number of blocks to read
+    // @param	batch	    Batch the request belongs to
+    void submit_read(int blocknum, char *data, size_t count, Batch *batch);
+
+    // Queue write of consecutive blocks, data must stay intact until wait
+    // @param	blocknum    First block to write to
+    // @param	data	    Buffer to write from
+    // @param	count	    Number of blocks to write
+    // @param	batch	    Batch the request belongs to
+    void submit_write(int blocknum, char *data, size_t count, Batch *batch);
+
+    // Wait for the requests of a batch to complete, requests of other
+    // batches may still be in flight
+    // Throws runtime_error exception if any of them failed.
+    void wait(Batch *batch);
+
+    // Wait for queued requests, then zero consecutive blocks
+    // @param	blocknum    First block to zero
+    // @param	count	    Number of blocks to zero
+    // @param	release	    Punch a hole rather than write zeros if possible
+    void zero(int blocknum, size_t count, bool release = true);
+
+    // Wait for queued requests, then flush disk image to stable storage
+    // Throws runtime_error exception on error.
+    void sync();
+
+    // Return maximum number of requests in flight
+    size_t depth() const { return Depth; }
+
+    // Return highest number of requests that were in flight at once
+    size_t peak() const { return Peak; }
+
+    // Return number of requests submitted
+    size_t submits() const { return Submits; }
+
+    // Return name of the I/O engine in use
+    const char *engine() const;
+};
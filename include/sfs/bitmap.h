@@ -0,0 +1,97 @@
+// bitmap.h: Packed bitmap of free objects
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+class Bitmap {
+private:
+    std::vector<uint64_t> Words;    // Packed bits, bit i of word w is object w*64 + i
+    size_t  Bits;		    // Number of objects tracked
+    std::atomic<size_t> Count;	    // Number of set bits
+
+    // Skip words that have no bits set
+    // @param	w	    First word to consider
+    // @param	end	    Word to stop at
+    // Returns index of first non-zero word or end.
+    size_t skip_empty(size_t w, size_t end) const;
+
+public:
+    // Number of bits per word
+    const static size_t WORD_BITS = 64;
+
+    // Returned by searches that find nothing
+    const static size_t NONE = (size_t)-1;
+
+    // Default constructor
+    Bitmap() : Bits(0), Count(0) {}
+
+    // Copy constructor
+    Bitmap(const Bitmap &other) : Words(other.Words), Bits(other.Bits), Count(other.Count.load()) {}
+
+    // Copy assignment
+    Bitmap &operator=(const Bitmap &other);
+
+    // Resize bitmap and set every bit to value
+    // @param	bits	    Number of objects to track
+    // @param	value	    Initial value of every bit
+    void assign(size_t bits, bool value);
+
+    // Return value of bit
+    bool test(size_t bit) const { return (Words[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1; }
+
+    // Set bit, returning whether or not it changed
+    // Bits in different words may be changed from different threads.
+    bool set(size_t bit);
+
+    // Clear bit, returning whether or not it changed
+    // Bits in different words may be changed from different threads.
+    bool clear(size_t bit);
+
+    // Find first set bit in [start, limit)
+    // @param	start	    First bit to consider
+    // @param	limit	    Bit to stop at, only words up to it are read
+    // Returns bit index or NONE.
+    size_t find_next(size_t start, size_t limit = NONE) const;
+
+    // Find first clear bit in [start, limit)
+    // @param	start	    First bit to consider
+    // @param	limit	    Bit to stop at, only words up to it are read
+    // Returns bit index or NONE.
+    size_t find_next_zero(size_t start, size_t limit = NONE) const;
+
+    // Copy raw bitmap bytes out, zero padding past the end
+    // @param	offset	    Byte offset into bitmap
+    // @param	data	    Buffer to copy into
+    // @param	length	    Number of bytes to copy
+    void copy_out(size_t offset, char *data, size_t length) const;
+
+    // Copy raw bitmap bytes in, bits past the end are ignored
+    // @param	offset	    Byte offset into bitmap
+    // @param	data	    Buffer to copy from
+    // @param	length	    Number of bytes to copy
+    // Call recount once all bytes are in.
+    void copy_in(size_t offset, const char *data, size_t length);
+
+    // Recompute number of set bits with popcount
+    void recount();
+
+    // Set every bit that is set in other, which must be the same size
+    void merge(const Bitmap &other);
+
+    // Clear every bit that is set in other, which must be the same size
+    void subtract(const Bitmap &other);
+
+    // Return whether or not both bitmaps have the same bits
+    bool operator==(const Bitmap &other) const { return Bits == other.Bits && Words == other.Words; }
+
+    // Return number of objects tracked
+    size_t size() const { return Bits; }
+
+    // Return number of set bits
+    size_t count() const { return Count.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,172 @@
+// cache.h: Write-back LRU block cache
+
+#pragma once
+
+#include "sfs/disk.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <stdint.h>
+
+class Cache {
+private:
+    struct Entry {
+    	int	Block;			// Block number on disk
+    	bool	Dirty;			// Whether or not block must be written back
+    	bool	Prefetched;		// Read ahead and not yet asked for
+    	char	Data[Disk::BLOCK_SIZE];	// Cached block contents
+    };
+
+    typedef std::list<Entry> List;
+
+    Disk   *disk;			    // Disk being cached
+    size_t  Capacity;			    // Maximum number of resident blocks
+    size_t  Hits;			    // Number of lookups served from cache
+    size_t  Misses;			    // Number of lookups that went to disk
+    size_t  Evictions;			    // Number of blocks evicted
+    size_t  Prefetches;			    // Number of blocks read ahead
+    size_t  PrefetchHits;		    // Read ahead blocks that were later read
+    size_t  PrefetchWasted;		    // Read ahead blocks dropped before being read
+    List    LRU;			    // Resident blocks, most recent first
+    std::unordered_map<int, List::iterator> Map; // Block number to entry
+    mutable std::mutex Lock;		    // Protects everything above
+
+    // Helpers below expect Lock to be held
+
+    // Find resident block and mark it as most recently used
+    // @param	blocknum    Block to look up
+    // Returns entry or NULL if block is not resident.
+    Entry *lookup(int blocknum);
+
+    // Make room for and insert a new entry for block
+    // @param	blocknum    Block to insert
+    // Returns new (clean) entry at the front of the LRU list.
+    Entry *insert(int blocknum);
+
+    // Evict least recently used blocks until at most capacity remain
+    // @param	capacity    Number of blocks allowed to stay resident
+    void shrink(size_t capacity);
+
+    // Return resident entry for block, reading it in on a miss
+    // @param	blocknum    Block to fetch
+    // Returns entry, or NULL if caching is disabled and the block is not resident.
+    Entry *fetch(int blocknum);
+
+    // Count read served by resident entry, crediting read-ahead if it
+    // brought the block in
+    void claim(Entry *entry);
+
+    // Drop resident entry without writing it back
+    void erase(std::unordered_map<int, List::iterator>::iterator it);
+
+    // Write all dirty blocks back to disk in block order
+    void flush_locked();
+
+public:
+    // Default number of blocks kept in memory
+    const static size_t DEFAULT_CAPACITY = 64;
+
+    // Constructor
+    // @param	capacity    Maximum number of resident blocks (0 disables caching)
+    Cache(size_t capacity = DEFAULT_CAPACITY)
+    	: disk(NULL), Capacity(capacity), Hits(0), Misses(0), Evictions(0),
+    	  Prefetches(0), PrefetchHits(0), PrefetchWasted(0) {}
+
+    // Destructor, writes back any dirty blocks
+    ~Cache();
+
+    // Attach cache to disk, resetting statistics
+    // @param	disk	    Disk to cache
+    void attach(Disk *disk);
+
+    // Flush dirty blocks and drop all resident blocks
+    void detach();
+
+    // Read block through cache
+    // @param	blocknum    Block to read from
+    // @param	data	    Buffer to read into
+    void read(int blocknum, char *data);
+
+    // Write block into cache, deferring disk write until eviction or flush
+    // @param	blocknum    Block to write to
+    // @param	data	    Buffer to write from
+    void write(int blocknum, char *data);
+
+    // Insert clean copy of block unless it is already resident
+    // @param	blocknum    Block that was read
+    // @param	data	    Its contents as on disk
+    void fill(int blocknum, const char *data);
+
+    // Read part of a block through cache, copying straight out of a mapped
+    // disk on a miss
+    // @param	blocknum    Block to read from
+    // @param	data	    Buffer to read into
+    // @param	offset	    Byte offset into block
+    // @param	length	    Number of bytes to read
+    void read(int blocknum, char *data, size_t offset, size_t length);
+
+    // Read consecutive blocks, serving resident ones from the cache and
+    // the rest with one disk read per gap, without caching them
+    // @param	blocknum    First block to read from
+    // @param	data	    Buffer to read into
+    // @param	count	    Number of blocks to read
+    // @param	batch	    Batch gap reads are submitted in
+    // Gap reads are submitted, data is complete after the disk's wait.
+    void read_run(int blocknum, char *data, size_t count, Disk::Batch *batch);
+
+    // Read blocks that are about to be needed into the cache, adjacent ones
+    // with a single disk read
+    // @param	blocks	    Blocks to read, zero entries are skipped
+    // @param	count	    Number of blocks
+    // Resident blocks are left alone.
+    void prefetch(const uint32_t *blocks, size_t count);
+
+    // Write consecutive blocks straight to disk, bypassing the cache
+    // @param	blocknum    First block to write to
+    // @param	data	    Buffer to write from
+    // @param	count	    Number of blocks to write
+    // @param	batch	    Batch the write is submitted in
+    // Resident copies are dropped since they are overwritten.  The write is
+    // submitted, data must stay intact until the disk's wait.
+    void write_run(int blocknum, char *data, size_t count, Disk::Batch *batch);
+
+    // Write all dirty blocks back to disk in block order, adjacent blocks
+    // are written together
+    void flush();
+
+    // Flush dirty blocks and force disk image to stable storage
+    void sync();
+
+    // Change number of resident blocks, evicting if necessary
+    // @param	capacity    New maximum number of resident blocks
+    void resize(size_t capacity);
+
+    // Return maximum number of resident blocks
+    size_t capacity() const { std::lock_guard<std::mutex> guard(Lock); return Capacity; }
+
+    // Return number of resident blocks
+    size_t resident() const { std::lock_guard<std::mutex> guard(Lock); return Map.size(); }
+
+    // Return number of dirty resident blocks
+    size_t dirty() const;
+
+    // Return number of lookups served from cache
+    size_t hits() const { std::lock_guard<std::mutex> guard(Lock); return Hits; }
+
+    // Return number of lookups that went to disk
+    size_t misses() const { std::lock_guard<std::mutex> guard(Lock); return Misses; }
+
+    // Return number of blocks evicted
+    size_t evictions() const { std::lock_guard<std::mutex> guard(Lock); return Evictions; }
+
+    // Return number of blocks read ahead
+    size_t prefetches() const { std::lock_guard<std::mutex> guard(Lock); return Prefetches; }
+
+    // Return number of read ahead blocks that were later read
+    size_t prefetch_hits() const { std::lock_guard<std::mutex> guard(Lock); return PrefetchHits; }
+
+    // Return number of read ahead blocks evicted or overwritten before being read
+    size_t prefetch_wasted() const { std::lock_guard<std::mutex> guard(Lock); return PrefetchWasted; }
+};
@@ -0,0 +1,143 @@
+// directory.h: Hashed directories
+
+#pragma once
+
+#include "sfs/fs.h"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Directory stored in an inode as a linear hash table of bucket blocks,
+// so lookups read the header and one bucket block however many entries
+// there are
+class Directory {
+public:
+    // Longest name an entry holds
+    const static size_t NAME_LENGTH = 54;
+
+    enum Type { FILE_ENTRY = 1, DIRECTORY_ENTRY = 2 };
+
+    struct Entry {		// Directory entry
+    	uint32_t Inumber;	// Inode the name refers to
+    	uint32_t Hash;		// Hash of the name
+    	uint8_t	 Type;		// FILE_ENTRY or DIRECTORY_ENTRY
+    	uint8_t	 Length;	// Length of the name
+    	char	 Name[NAME_LENGTH]; // Name, not terminated
+    };
+
+private:
+    const static uint32_t MAGIC = 0x52494453;
+
+    // Entries in one bucket block, after its header
+    const static size_t ENTRIES_PER_BUCKET = Disk::BLOCK_SIZE / sizeof(Entry) - 1;
+
+    // Overflow blocks live past any bucket the table can grow to, where
+    // the file is sparse
+    const static size_t OVERFLOW_START = 1 << 19;
+
+    struct Header {		// First block of a directory
+    	uint32_t Magic;		// Directory magic number
+    	uint32_t Entries;	// Number of entries
+    	uint32_t Level;		// Buckets double each time Split wraps around
+    	uint32_t Split;		// Next bucket to split
+    	uint32_t Overflows;	// Overflow blocks ever used
+    	uint32_t FreeOverflow;	// First free overflow block, 0 if none
+    };
+
+    struct BucketBlock {	// Bucket block, followed by a chain of overflow blocks
+    	uint32_t Count;		// Entries in use
+    	uint32_t Next;		// Next overflow block of the chain, 0 if none
+    	uint32_t Reserved[14];	// Unused, zero
+    	Entry	 Entries[ENTRIES_PER_BUCKET];
+    };
+
+    union Block {
+    	Header	Head;
+    	BucketBlock Bucket;
+    	char	Data[Disk::BLOCK_SIZE];
+    };
+
+    static_assert(sizeof(BucketBlock) == Disk::BLOCK_SIZE, "bucket must fill a block");
+
+    FileSystem *fs;		// File system the directory lives on
+    size_t	Inumber;	// Inode holding the directory
+
+    static uint32_t hash(const std::string &name);
+    static size_t bucket_block(size_t bucket) { return 1 + bucket; }
+    static size_t buckets(const Header &head) { return ((size_t)1 << head.Level) + head.Split; }
+    static size_t bucket_of(const Header &head, uint32_t hash);
+    static bool   matches(const Entry &entry, const std::string &name, uint32_t hash);
+
+    // Block I/O on the directory, blocks past the end read as empty
+    bool    read_block(size_t block, Block *data);
+    bool    write_block(size_t block, Block *data);
+    bool    read_header(Block *data);
+
+    // Overflow blocks, freed ones are chained from the header
+    bool    allocate_overflow(Header *head, uint32_t *block);
+    bool    free_overflow(Header *head, uint32_t block);
+
+    // Read chain of bucket, appending its blocks and entries
+    bool    read_chain(const Header &head, size_t bucket, std::vector<uint32_t> *blocks, std::vector<Entry> *entries);
+
+    // Write entries over chain blocks, adding overflow blocks as needed and
+    // freeing those left empty
+    bool    write_chain(Header *head, std::vector<uint32_t> blocks, const std::vector<Entry> &entries);
+
+    // Split the next bucket, moving about half of its entries to a new one
+    bool    split(Header *head);
+
+public:
+    // Open directory stored in inode
+    // @param	fs	    File system the directory lives on
+    // @param	inumber	    Inode holding the directory
+    Directory(FileSystem *fs, size_t inumber) : fs(fs), Inumber(inumber) {}
+
+    // Make new empty directory
+    // Returns its inode, or -1 on error.
+    static ssize_t create(FileSystem *fs);
+
+    // Return whether or not inode holds a directory
+    bool valid();
+
+    // Look up name
+    // @param	name	    Name to look up
+    // @param	type	    Set to type of entry if not NULL
+    // Returns inode name refers to, or -1 if there is no such entry.
+    ssize_t lookup(const std::string &name, Type *type = NULL);
+
+    // Add entry for inode, which must exist
+    // @param	name	    Name of entry, without slashes
+    // @param	inumber	    Inode to refer to
+    // @param	type	    FILE_ENTRY or DIRECTORY_ENTRY
+    // Returns false if name is taken or invalid.
+    bool link(const std::string &name, size_t inumber, Type type);
+
+    // Remove entry, leaving the inode it refers to alone
+    // Returns false if there is no such entry.
+    bool unlink(const std::string &name);
+
+    // Append every entry, in no particular order
+    bool readdir(std::vector<Entry> *entries);
+
+    // Return number of entries, or -1 if inode holds no directory
+    ssize_t size();
+
+    // Return root directory, making an empty one if there is none yet
+    static ssize_t root(FileSystem *fs);
+
+    // Resolve path from root directory
+    // @param	path	    Names separated by slashes
+    // @param	type	    Set to type of entry if not NULL
+    // Returns inode path refers to, or -1 if there is no such entry.
+    static ssize_t resolve(FileSystem *fs, const std::string &path, Type *type = NULL);
+
+    // Resolve directory path is in
+    // @param	path	    Names separated by slashes
+    // @param	name	    Set to last name of path
+    // Returns inode of directory, or -1 if there is no such directory.
+    static ssize_t parent(FileSystem *fs, const std::string &path, std::string *name);
+};
@@ -2,15 +2,49 @@
 
 #pragma once
 
+#include "sfs/tracer.h"
+
+#include <atomic>
+#include <string>
+
 #include <stdlib.h>
+#include <sys/uio.h>
 
 class Disk {
-private:
+public:
+    // Requests queued by one caller and waited on together, so each caller
+    // only ever sees failures of its own requests
+    class Batch {
+    public:
+    	Disk   *Owner;	    // Disk the requests were queued on, NULL if none
+    	size_t  InFlight;   // Requests not yet completed
+    	std::string Error;  // First failure, empty if none
+
+    	Batch() : Owner(NULL), InFlight(0) {}
+
+    	// Destructor, waits for requests still in flight and drops their errors
+    	~Batch() { if (Owner) Owner->settle(this); }
+
+    	Batch(const Batch &) = delete;
+    	Batch &operator=(const Batch &) = delete;
+    };
+
+protected:
     int	    FileDescriptor; // File descriptor of disk image
     size_t  Blocks;	    // Number of blocks in disk image
-    size_t  Reads;	    // Number of reads performed
-    size_t  Writes;	    // Number of writes performed
+    std::atomic<size_t> Reads;	    // Number of reads performed
+    std::atomic<size_t> Writes;	    // Number of writes performed
+    std::atomic<size_t> Punches;    // Number of blocks released by punching holes
+    std::atomic<size_t> Syscalls;   // Number of system calls issued
     size_t  Mounts;	    // Number of mounts
+    Tracer *Trace;	    // Records every operation, NULL if not tracing
+    bool    Report;	    // Whether or not counters are printed on close
+
+    // Record operation if tracing
+    void trace(Tracer::Op op, int blocknum, size_t count = 1) {
+    	if (Trace)
+    	    Trace->record(op, blocknum, count);
+    }
 
     // Check parameters
     // @param	blocknum    Block to operate on
@@ -18,21 +52,34 @@ private:
     // Throws invalid_argument exception on error.
     void sanity_check(int blocknum, char *data);
 
+    // Check vector and return number of blocks it covers
+    // @param	blocknum    First block to operate on
+    // @param	iov	    Buffers to operate on
+    // @param	iovcnt	    Number of buffers
+    // Throws invalid_argument exception on error.
+    size_t sanity_check(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Wait for the requests of a batch to complete, ignoring failures
+    virtual void settle(Batch *batch) {}
+
 public:
     // Number of bytes per block
     const static size_t BLOCK_SIZE = 4096;
+
+    // Most blocks written per call when writing zeros
+    const static size_t ZERO_BATCH = 256;
     
     // Default constructor
-    Disk() : FileDescriptor(0), Blocks(0), Reads(0), Writes(0), Mounts(0) {}
+    Disk() : FileDescriptor(0), Blocks(0), Reads(0), Writes(0), Punches(0), Syscalls(0), Mounts(0), Trace(NULL), Report(true) {}
     
-    // Destructor
-    ~Disk();
+    // Destructor, prints the read and write counters unless disabled
+    virtual ~Disk();
 
     // Open disk image
     // @param	path	    Path to disk image
     // @param	nblocks	    Number of blocks in disk image
     // Throws runtime_error exception on error.
-    void open(const char *path, size_t nblocks);
+    virtual void open(const char *path, size_t nblocks);
 
     // Return size of disk (in terms of blocks)
     size_t size() const { return Blocks; }
@@ -46,13 +93,102 @@ public:
     // Decrement mounts
     void unmount() { if (Mounts > 0) Mounts--; }
 
+    // Return number of block reads performed
+    size_t reads() const { return Reads; }
+
+    // Return number of block writes performed
+    size_t writes() const { return Writes; }
+
+    // Return number of blocks released by punching holes, which are not writes
+    size_t punches() const { return Punches; }
+
+    // Return number of system calls issued
+    size_t syscalls() const { return Syscalls; }
+
+    // Record every operation, and the file system's block accesses, in a
+    // trace; set while no I/O is running, NULL stops tracing
+    void set_tracer(Tracer *tracer) { Trace = tracer; }
+
+    // Return tracer or NULL if not tracing
+    Tracer *tracer() const { return Trace; }
+
+    // Print the read and write counters when the disk is closed, on by
+    // default; turn off when the caller reports reads() and writes() itself
+    void set_report(bool report) { Report = report; }
+
     // Read block from disk
     // @param	blocknum    Block to read from
     // @param	data	    Buffer to read into
-    void read(int blocknum, char *data);
+    virtual void read(int blocknum, char *data);
     
     // Write block to disk
     // @param	blocknum    Block to write to
     // @param	data	    Buffer to write from
-    void write(int blocknum, char *data);
+    virtual void write(int blocknum, char *data);
+
+    // Read consecutive blocks from disk with a single system call
+    // @param	blocknum    First block to read from
+    // @param	count	    Number of blocks to read
+    // @param	data	    Buffer to read into
+    void readv(int blocknum, size_t count, char *data);
+
+    // Read consecutive blocks from disk into separate buffers
+    // @param	blocknum    First block to read from
+    // @param	iov	    Buffers to read into, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    virtual void readv(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Write consecutive blocks to disk with a single system call
+    // @param	blocknum    First block to write to
+    // @param	data	    Buffer to write from
+    // @param	count	    Number of blocks to write
+    void write(int blocknum, char *data, size_t count);
+
+    // Write consecutive blocks to disk from separate buffers
+    // @param	blocknum    First block to write to
+    // @param	iov	    Buffers to write from, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    virtual void writev(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Zero consecutive blocks, punched blocks count as punches and blocks
+    // filled with zeros as writes
+    // @param	blocknum    First block to zero
+    // @param	count	    Number of blocks to zero
+    // @param	release	    Punch a hole so the image stays sparse, falling back
+    //			    to writing zeros where the file system cannot
+    // Throws runtime_error exception on error.
+    virtual void zero(int blocknum, size_t count, bool release = true);
+
+    // Queue read of consecutive blocks, data is only valid after wait
+    // @param	blocknum    First block to read from
+    // @param	data	    Buffer to read into
+    // @param	count	    Number of blocks to read
+    // @param	batch	    Batch the request belongs to
+    // The synchronous disk completes the read right away.
+    virtual void submit_read(int blocknum, char *data, size_t count, Batch *batch) { readv(blocknum, count, data); }
+
+    // Queue write of consecutive blocks, data must stay intact until wait
+    // @param	blocknum    First block to write to
+    // @param	data	    Buffer to write from
+    // @param	count	    Number of blocks to write
+    // @param	batch	    Batch the request belongs to
+    // The synchronous disk completes the write right away.
+    virtual void submit_write(int blocknum, char *data, size_t count, Batch *batch) { write(blocknum, data, count); }
+
+    // Wait for the requests of a batch to complete
+    // Throws runtime_error exception if any of them failed.
+    virtual void wait(Batch *batch) {}
+
+    // Return maximum number of requests in flight
+    virtual size_t depth() const { return 1; }
+
+    // Return read-only view of block without copying it
+    // @param	blocknum    Block to view
+    // Returns pointer to block contents, or NULL if the disk cannot provide
+    // one; the view stays valid until the disk is closed.
+    virtual const char *view(int blocknum) { return NULL; }
+
+    // Flush disk image to stable storage
+    // Throws runtime_error exception on error.
+    virtual void sync();
 };
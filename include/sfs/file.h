@@ -0,0 +1,71 @@
+// file.h: Open file handle
+
+#pragma once
+
+#include "sfs/fs.h"
+
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+class File {
+private:
+    FileSystem	       *fs;		// File system the inode lives on, NULL while closed
+    size_t		Inumber;	// Inode the handle is pinned to
+    FileSystem::Inode	Node;		// Pinned copy of the inode
+    std::vector<uint32_t> Map;		// Physical block of each logical block, 0 if unmapped
+    bool		NodeDirty;	// Inode changed since last write back
+
+    // Write to file, caller holds the inode lock exclusively
+    ssize_t write_locked(char *data, size_t length, size_t offset);
+
+    // Write back pinned inode, caller holds the inode lock exclusively or
+    // the mount lock exclusively
+    void flush();
+
+    friend class FileSystem;
+
+public:
+    // Default constructor, handle starts out closed
+    File() : fs(NULL), Inumber(0), NodeDirty(false) {}
+
+    // Destructor, closes handle if still open
+    ~File() { close(); }
+
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+
+    // Read from file at offset
+    // @param	data	    Buffer to read into
+    // @param	length	    Number of bytes to read
+    // @param	offset	    Byte offset into file
+    // Returns number of bytes read, or -1 on error.
+    ssize_t pread(char *data, size_t length, size_t offset);
+
+    // Write to file at offset, inode is written back on close or sync
+    // @param	data	    Buffer to write from
+    // @param	length	    Number of bytes to write
+    // @param	offset	    Byte offset into file
+    // Returns number of bytes written, or -1 on error.
+    ssize_t pwrite(char *data, size_t length, size_t offset);
+
+    // Write to end of file
+    // @param	data	    Buffer to write from
+    // @param	length	    Number of bytes to write
+    // Returns number of bytes written, or -1 on error.
+    ssize_t append(char *data, size_t length);
+
+    // Write back inode and release handle
+    // Returns false if handle was not open.
+    bool close();
+
+    // Return whether or not handle is open
+    bool is_open() const { return fs != NULL; }
+
+    // Return inode handle is pinned to
+    size_t inumber() const { return Inumber; }
+
+    // Return size of file, or -1 if handle is not open
+    ssize_t size() const { return fs != NULL ? (ssize_t)FileSystem::inode_size(Node) : -1; }
+};
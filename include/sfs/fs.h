@@ -2,18 +2,45 @@
 
 #pragma once
 
+#include "sfs/allocator.h"
+#include "sfs/bitmap.h"
+#include "sfs/cache.h"
 #include "sfs/disk.h"
+#include "sfs/rwlock.h"
+#include "sfs/stats.h"
 
-#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <stdint.h>
+
+class File;
+
 class FileSystem {
 public:
     const static uint32_t MAGIC_NUMBER	     = 0xf0f03410;
-    const static uint32_t INODES_PER_BLOCK   = 128;
+    const static uint32_t INODES_PER_BLOCK   = 128; // before VERSION_WIDE_INODES
+    const static uint32_t WIDE_INODES_PER_BLOCK = 64;
     const static uint32_t POINTERS_PER_INODE = 5;
     const static uint32_t POINTERS_PER_BLOCK = 1024;
+    const static uint32_t MAX_DEPTH	     = 3;   // pointer blocks between a triple indirect pointer and data
+    const static uint32_t BITS_PER_BLOCK     = Disk::BLOCK_SIZE * 8;
+
+    // On-disk format versions
+    const static uint32_t VERSION_LEGACY     = 0; // no bitmaps, rebuilt by scanning
+    const static uint32_t VERSION_BITMAPS    = 1; // free block and inode bitmaps on disk
+    const static uint32_t VERSION_INODE_MARK = 2; // inode blocks past a high-water mark are all zero
+    const static uint32_t VERSION_WIDE_INODES = 3; // 64 byte inodes with double and triple indirect pointers
+    const static uint32_t VERSION_JOURNAL    = 4; // metadata journal between the bitmaps and the inode table
+    const static uint32_t VERSION_INLINE_DATA = 5; // small files kept in the pointer area of their inode
+    const static uint32_t VERSION_UNWRITTEN  = 6; // preallocated data blocks flagged as unwritten
+    const static uint32_t VERSION	     = VERSION_UNWRITTEN;
+    const static uint32_t JOURNAL_MAGIC	     = 0x4a524e4c;
 
 private:
     struct SuperBlock {		// Superblock structure
@@ -21,50 +48,268 @@ private:
     	uint32_t Blocks;	// Number of blocks in file system
     	uint32_t InodeBlocks;	// Number of blocks reserved for inodes
     	uint32_t Inodes;	// Number of inodes in file system
+    	uint32_t Version;	// On-disk format version (0 for legacy images)
+    	uint32_t BitmapBlocks;	// Number of blocks reserved for free block bitmap
+    	uint32_t InodeBitmapBlocks; // Number of blocks reserved for free inode bitmap
+    	uint32_t InitializedInodeBlocks; // Number of inode blocks ever written
+    	uint32_t JournalBlocks;	// Number of blocks reserved for metadata journal
+    	uint32_t RootDirectory;	// Inode of directory tree root plus one, 0 if there is none
+    };
+
+    struct JournalRecord {	// Start of journal header, descriptor and commit blocks
+    	uint32_t Magic;		// Journal magic number
+    	uint32_t Type;		// JOURNAL_HEADER, JOURNAL_DESCRIPTOR or JOURNAL_COMMIT
+    	uint32_t Id;		// Chosen at format, so records of an older file system never match
+    	uint32_t Sequence;	// Transaction number, the first one to replay in the header
+    	uint32_t Blocks;	// Block images following the descriptor, their homes are listed after it
+    	uint32_t Revokes;	// Blocks whose images in earlier transactions are stale, listed after the homes
+    	uint32_t Checksum;	// Of the descriptor and images, in the commit block
     };
 
+    enum { JOURNAL_HEADER = 1, JOURNAL_DESCRIPTOR = 2, JOURNAL_COMMIT = 3 };
+
+    // Older formats store only the first NARROW_INODE_SIZE bytes of each inode
     struct Inode {
     	uint32_t Valid;		// Whether or not inode is valid
-    	uint32_t Size;		// Size of file
+    	uint32_t Size;		// Size of file, low 32 bits
     	uint32_t Direct[POINTERS_PER_INODE]; // Direct pointers
     	uint32_t Indirect;	// Indirect pointer
+    	uint32_t DoubleIndirect; // Double indirect pointer
+    	uint32_t TripleIndirect; // Triple indirect pointer
+    	uint32_t SizeHigh;	// Size of file, high 32 bits
+    	uint32_t Flags;		// INODE_INLINE, zero before VERSION_INLINE_DATA
+    	uint32_t Reserved[4];	// Unused, zero
     };
 
+    const static size_t NARROW_INODE_SIZE = 32;
+
+    enum { INODE_INLINE = 1 };	// Data lives where the pointers would be
+
+    // Data block pointer flag, the block is reserved but reads as zeros
+    // until it is first written
+    const static uint32_t UNWRITTEN = 0x80000000;
+
+    // Bytes of data an inline inode holds, the direct and indirect pointers
+    const static size_t INLINE_DATA_SIZE = (POINTERS_PER_INODE + MAX_DEPTH) * sizeof(uint32_t);
+
     union Block {
     	SuperBlock  Super;			    // Superblock
-    	Inode	    Inodes[INODES_PER_BLOCK];	    // Inode block
+    	Inode	    Inodes[WIDE_INODES_PER_BLOCK];  // Inode block
     	uint32_t    Pointers[POINTERS_PER_BLOCK];   // Pointer block
+    	JournalRecord Journal;			    // Journal block
     	char	    Data[Disk::BLOCK_SIZE];	    // Data block
     };
 
+    struct Cursor {		// Pointer block a walk last went through at one level
+    	uint32_t Number;	// Block number, 0 if none
+    	bool	 Dirty;		// Pointers changed since it was read
+    	Block	 Pointers;	// Contents
+    };
+
+    struct Reservation {	// Blocks handed out to a write as it walks its block map
+    	bool	Dry;		// Only count missing blocks, handing out placeholders
+    	bool	Unwritten;	// Flag data blocks handed out as unwritten
+    	size_t	Count;		// Blocks handed out so far
+    	size_t	Start;		// Next block of the allocated run
+    	size_t	Length;		// Blocks left in the allocated run
+    	size_t	Goal;		// Where the next run should start
+    	size_t	Wanted;		// Blocks the rest of the write still needs
+    };
+
+    struct Stream {		// Sequential reader of one inode
+    	size_t	Inumber;	// Inode being read
+    	size_t	Next;		// Offset a sequential read continues from
+    	size_t	Window;		// Blocks to keep read ahead, 0 if access is random
+    	size_t	Ahead;		// Block after the last one read ahead
+    };
+
+    // Number of locks inodes are striped over
+    const static size_t INODE_LOCKS = 256;
+
+    // Most threads used to scan metadata, and fewest inode blocks per thread
+    const static size_t SCAN_THREADS = 8;
+    const static size_t SCAN_MIN_BLOCKS = 64;
+
+    // Most blocks read by one call while scanning
+    const static size_t SCAN_BATCH = 64;
+
+    // Journal is one block per JOURNAL_RATIO blocks, left out if it would be
+    // smaller than JOURNAL_MIN_BLOCKS
+    const static size_t JOURNAL_RATIO = 16;
+    const static size_t JOURNAL_MIN_BLOCKS = 8;
+    const static size_t JOURNAL_MAX_BLOCKS = 1024;
+
+    // Homes and revoked blocks listed in one descriptor
+    const static size_t JOURNAL_TAGS = (Disk::BLOCK_SIZE - sizeof(JournalRecord)) / sizeof(uint32_t);
+
+    // Number of read streams tracked, and first read-ahead window in blocks
+    const static size_t READAHEAD_STREAMS = 64;
+    const static size_t READAHEAD_MIN = 4;
+
     // Internal helper functions
-    void initialize_free_blocks();
-    ssize_t allocate_free_block();
+    static size_t inode_start(const SuperBlock &super);
+    static size_t journal_blocks(size_t blocks);
+    void flush_all();
+    void superblock_image(Block *superBlock);
+    void flush_superblock();
+    void flush_files();
+    bool is_open(size_t inumber);
+    void reset_streams();
+    RWLock &inode_lock(size_t inumber) { return inodeLocks[inumber % INODE_LOCKS]; }
+
+    void scan_metadata();
+    void scan_inode_blocks(size_t first, size_t last, Bitmap *used, std::string *error);
+    void load_bitmaps();
+    void flush_bitmaps();
+    ssize_t allocate_free_inode();
+    void    free_inode(size_t inumber);
+    ssize_t allocate_free_run(size_t goal, size_t count, size_t *length);
+    void    free_block(size_t block);
+
+    void load_inode_table();
+    void fetch_inode_block(size_t index);
+    void flush_inodes();
+    static size_t inodes_per_block(uint32_t version) { return version >= VERSION_WIDE_INODES ? WIDE_INODES_PER_BLOCK : INODES_PER_BLOCK; }
+    static void decode_inodes(const char *data, uint32_t version, Inode *inodes);
+    static void encode_inodes(const Inode *inodes, uint32_t version, char *data);
+    static uint64_t inode_size(const Inode &inode) { return (uint64_t)inode.SizeHigh << 32 | inode.Size; }
+    static void set_inode_size(Inode *inode, uint64_t size) { inode->Size = size; inode->SizeHigh = size >> 32; }
 
-    bool load_inode(size_t inumber, Inode *node, Block *block, bool needRead);
-    bool save_inode(size_t inumber, Inode *node, Block *block, bool needRead);
+    bool load_inode(size_t inumber, Inode *node);
+    bool save_inode(size_t inumber, Inode *node);
+
+    // Inline data, a file moves out of its inode once it outgrows it
+    static bool  is_inline(const Inode &inode) { return inode.Flags & INODE_INLINE; }
+    static char *inline_bytes(Inode *inode) { return (char *)inode->Direct; }
+    bool    fits_inline(const Inode &inode, size_t end) const;
+    void    write_inline(Inode *inode, const char *data, size_t length, size_t offset);
+    bool    promote_inline(Inode *inode, uint32_t *block);
 
     static void debugArray(uint32_t array[], size_t arraySize, std::string* string);
+    static void debugTree(Disk *disk, uint32_t block, size_t depth, std::string *string);
+
+    // Block map walker, pointer blocks are read through the cache and kept
+    // in one cursor per level while consecutive blocks share them
+    static size_t block_path(size_t logical, size_t path[MAX_DEPTH + 1]);
+    size_t  max_file_blocks() const;
+    static uint32_t data_block(uint32_t pointer) { return pointer & ~UNWRITTEN; }
+    uint32_t walk(Inode *inode, size_t logical, Cursor cursors[MAX_DEPTH + 1], Reservation *reservation, bool *added);
+    void    write_back(Cursor *cursor);
+    uint32_t take(Reservation *reservation);
+    void    map_blocks(Inode *inode, size_t first, size_t count, uint32_t *map);
+    void    free_tree(uint32_t block, size_t depth);
+    void    punch_tree(uint32_t *slot, size_t depth, size_t base, size_t first, size_t last);
+    void    zero_range(Inode *inode, size_t start, size_t end);
+    void    free_range(Inode *inode, size_t first, size_t last);
+    void    read_pointers(uint32_t block, Block *pointers);
+    void    write_pointers(uint32_t block, const Block *pointers);
+    void    scan_tree(uint32_t block, size_t depth, size_t *blockNum, Bitmap *used);
     
-    ssize_t readArray(uint32_t array[], size_t arraySize, size_t *size, size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data);
-    ssize_t writeArray(uint32_t array[], size_t arraySize, size_t *size, size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data);
+    ssize_t readArray(uint32_t array[], size_t arraySize, size_t *size, size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data, Disk::Batch *pending);
+    void    plan_readahead(size_t inumber, size_t offset, size_t length, size_t fileBlocks, size_t *start, size_t *end);
+    void    read_ahead(Inode *inode, size_t start, size_t end);
+    void    read_ahead(const uint32_t *map, size_t count);
+    void    reserve_blocks(Inode *inode, size_t offset, size_t length, uint32_t *map, const char *data, bool unwritten = false);
+    ssize_t writeArray(uint32_t array[], size_t arraySize, size_t *size, size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data, Disk::Batch *pending);
+
+    // Metadata journal, commits and checkpoints expect the mount lock to be
+    // held exclusively
+    bool replay_journal(bool *replayed);
+    void write_journal_header();
+    void commit();
+    void checkpoint();
+    void end_operation();
+    void mark_dirty(std::vector<bool> &flags, size_t index);
+    Stats::BlockType metadata_type(size_t block) const;
+
+    // Count block accesses in statistics and the disk's trace
+    void note_read(Stats::BlockType type, size_t block, size_t count = 1);
+    void note_write(Stats::BlockType type, size_t block, size_t count = 1);
+
+    // Counts an operation that changes metadata once it has released its
+    // locks, committing the group it belongs to when that is due
+    class Operation {
+    public:
+        Operation(FileSystem *fs) : fs(fs) {}
+        ~Operation() noexcept(false) { if (!std::uncaught_exception()) fs->end_operation(); }
+    private:
+        FileSystem *fs;
+    };
 
     // Internal member variables
     Disk                *disk;
+    Cache               blockCache;
     size_t              blocks;
     size_t              inodeBlocks;
     size_t              inodes;
-    std::vector<int>    bitMap; 
+    size_t              version;
+    size_t              bitmapBlocks;
+    size_t              inodeBitmapBlocks;
+    size_t              inodeStart;         // first inode block
+    size_t              inodesPerBlock;     // inodes stored in one inode block
+    size_t              maxDepth;           // deepest pointer block chain an inode may have
+    size_t              initializedInodeBlocks; // inode blocks past this were never written
+    bool                superBlockDirty;    // high-water mark or root directory changed since last flush
+    size_t              rootDirectory;      // root directory inode plus one, 0 if none
+    std::vector<Inode>  inodeTable;         // resident inode table, indexed by inumber
+    std::vector<bool>   loadedInodeBlocks;  // inode blocks read into table
+    std::vector<bool>   dirtyInodeBlocks;   // inode blocks changed since last flush
+    std::vector<bool>   dirtyBitmapBlocks;  // bitmap blocks changed since last flush
+    Bitmap              freeInodes;         // 1 means inode is free
+    size_t              nextFreeInode;      // no free inode below this hint
+    Allocator           blockAllocator;     // free data blocks
+    Stats               statistics;         // block I/O, latency and allocator activity
+    Stream              streams[READAHEAD_STREAMS]; // sequential readers, by inumber
+    size_t              maxReadAhead;       // largest read-ahead window in blocks
+    bool                inlineData;         // new small files are stored in their inode
+    bool                sparseWrites;       // unmapped blocks written with zeros stay holes
+    std::unordered_map<size_t, File *> openFiles; // open handles, by inumber
+    size_t              journalStart;       // journal header block, records follow it
+    size_t              journalBlocks;      // 0 if there is no journal
+    uint32_t            journalId;          // identity records must carry
+    uint32_t            journalSequence;    // number of next transaction
+    size_t              journalNext;        // journal block next transaction goes to
+    std::unordered_map<uint32_t, Block> pendingPointers; // pointer blocks changed since last commit
+    std::unordered_set<uint32_t> journaledPointers; // pointer blocks with images in the journal
+    std::vector<uint32_t> revokedBlocks;    // journaled pointer blocks freed since last commit
+    std::atomic<size_t> dirtyMetadata;      // metadata blocks changed since last commit, roughly
+    std::atomic<size_t> finishedOperations; // operations that changed metadata
+    std::atomic<size_t> committedOperations; // operations covered by a commit
+    std::atomic<size_t> groupCommit;        // operations per commit, 0 if only when needed
+    std::atomic<size_t> commitCount;        // transactions committed
+    std::atomic<size_t> journalWrites;      // blocks written to the journal
+    std::atomic<size_t> checkpointCount;    // times the journal was emptied
 
-    // 1 means block is free, 0 means block occupied
-    const int FREE     = 1;
-    const int OCCUPIED = 0;
+    // Locking, always taken in this order
+    RWLock              mountLock;          // shared by file operations, exclusive for mount, unmount, sync and check
+    RWLock              inodeLocks[INODE_LOCKS]; // shared to read an inode's data, exclusive to change it
+    std::mutex          metaLock;           // inode table, free inode bitmap, dirty block flags and open handles
+    std::mutex          streamLock;         // read streams
+    std::mutex          commitLock;         // taken before the mount lock by whoever commits a group
 
 public:
+    // Default largest read-ahead window in blocks
+    const static size_t READAHEAD_MAX = 32;
+
+    FileSystem(size_t cacheBlocks = Cache::DEFAULT_CAPACITY)
+        : disk(NULL), blockCache(cacheBlocks), blocks(0), inodeBlocks(0), inodes(0),
+          version(0), bitmapBlocks(0), inodeBitmapBlocks(0), inodeStart(1),
+          inodesPerBlock(INODES_PER_BLOCK), maxDepth(1),
+          initializedInodeBlocks(0), superBlockDirty(false), rootDirectory(0), nextFreeInode(0),
+          maxReadAhead(READAHEAD_MAX), inlineData(true), sparseWrites(false),
+          journalStart(0), journalBlocks(0), journalId(0), journalSequence(0),
+          journalNext(1), dirtyMetadata(0),
+          finishedOperations(0), committedOperations(0), groupCommit(0), commitCount(0),
+          journalWrites(0), checkpointCount(0) { reset_streams(); }
+    ~FileSystem();
+
     static void debug(Disk *disk);
-    static bool format(Disk *disk);
+    static bool format(Disk *disk, bool full = false);
 
     bool mount(Disk *disk);
+    void unmount();
+    bool check();
+    void sync();
 
     ssize_t create();
     bool    remove(size_t inumber);
@@ -72,4 +317,71 @@ public:
 
     ssize_t read(size_t inumber, char *data, size_t length, size_t offset);
     ssize_t write(size_t inumber, char *data, size_t length, size_t offset);
+
+    // Free blocks wholly inside the range and zero the rest of it, leaving
+    // a hole that reads as zeros, the size of the file does not change
+    bool    punch_hole(size_t inumber, size_t offset, size_t length);
+
+    // Reserve blocks for the range, handed out as runs and flagged so they
+    // read as zeros until written, growing the file to cover it
+    bool    fallocate(size_t inumber, size_t offset, size_t length);
+
+    // Change size of file, freeing blocks past a smaller size, including
+    // pointer blocks left mapping nothing
+    bool    truncate(size_t inumber, size_t size);
+
+    // Return number of runs of adjacent blocks the file is stored in, or -1
+    ssize_t extents(size_t inumber);
+
+    // Inode the directory tree starts from, kept in the superblock, -1 if
+    // there is none yet
+    ssize_t root_directory();
+    bool    set_root_directory(size_t inumber);
+
+    // Open handle on inode, pinning it and its block map until closed
+    // Only one handle per inode may be open, and write and remove refuse
+    // the inode while it is.
+    bool    open(size_t inumber, File *file);
+
+    size_t  free_blocks() const { return blockAllocator.free_count(); }
+
+    // Largest read-ahead window in blocks, 0 disables read-ahead
+    void    set_readahead(size_t blocks) { std::lock_guard<std::mutex> guard(streamLock); maxReadAhead = blocks; }
+    size_t  readahead() { std::lock_guard<std::mutex> guard(streamLock); return maxReadAhead; }
+
+    Cache &cache() { return blockCache; }
+
+    // Whether or not files that fit in their inode are stored there, files
+    // already inline stay so either way
+    void    set_inline_data(bool enabled) { inlineData = enabled; }
+    bool    inline_data() const { return inlineData; }
+
+    // Whether or not writing a whole block of zeros where no block is mapped
+    // leaves a hole instead of allocating one
+    void    set_sparse_writes(bool enabled) { sparseWrites = enabled; }
+    bool    sparse_writes() const { return sparseWrites; }
+
+    // Operations batched into one journal commit, 1 makes every operation
+    // durable before it returns and 0 commits only on sync, unmount or when
+    // the group would outgrow the journal
+    void    set_group_commit(size_t operations) { groupCommit = operations; }
+    size_t  group_commit() const { return groupCommit; }
+
+    // Return whether or not metadata changes go through a journal
+    bool    journaled() const { return journalBlocks > 0; }
+
+    // Journal statistics since mount
+    size_t  commits() const { return commitCount; }
+    size_t  journal_writes() const { return journalWrites; }
+    size_t  checkpoints() const { return checkpointCount; }
+
+    // Statistics kept across mounts, disabled until enabled
+    Stats  &stats() { return statistics; }
+
+    // Return statistics of the file system, its disk, cache and journal as
+    // a JSON object
+    std::string stats_json();
+
+    friend class File;
+    friend class Directory;
 };
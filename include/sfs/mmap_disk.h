@@ -0,0 +1,56 @@
+// mmap_disk.h: Disk emulator backed by a memory mapping
+
+#pragma once
+
+#include "sfs/disk.h"
+
+class MmapDisk : public Disk {
+private:
+    char   *Mapping;	    // Whole disk image mapped read/write
+
+public:
+    // Default constructor
+    MmapDisk() : Mapping(NULL) {}
+
+    // Destructor, unmaps the image
+    ~MmapDisk();
+
+    // Open and map disk image
+    // @param	path	    Path to disk image
+    // @param	nblocks	    Number of blocks in disk image
+    // Throws runtime_error exception on error.
+    void open(const char *path, size_t nblocks);
+
+    using Disk::readv;
+    using Disk::write;
+
+    // Copy block out of the mapping
+    // @param	blocknum    Block to read from
+    // @param	data	    Buffer to read into
+    void read(int blocknum, char *data);
+
+    // Copy block into the mapping
+    // @param	blocknum    Block to write to
+    // @param	data	    Buffer to write from
+    void write(int blocknum, char *data);
+
+    // Copy consecutive blocks out of the mapping
+    // @param	blocknum    First block to read from
+    // @param	iov	    Buffers to read into, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    void readv(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Copy consecutive blocks into the mapping
+    // @param	blocknum    First block to write to
+    // @param	iov	    Buffers to write from, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    void writev(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Return pointer to block inside the mapping
+    // @param	blocknum    Block to view
+    const char *view(int blocknum);
+
+    // Write dirty pages of the mapping back with msync
+    // Throws runtime_error exception on error.
+    void sync();
+};
@@ -0,0 +1,49 @@
+// rwlock.h: Reader/writer lock with scoped guards
+
+#pragma once
+
+#include <pthread.h>
+
+class RWLock {
+private:
+    pthread_rwlock_t Lock;	    // Underlying POSIX lock
+
+public:
+    // Default constructor
+    RWLock() { pthread_rwlock_init(&Lock, NULL); }
+
+    // Destructor
+    ~RWLock() { pthread_rwlock_destroy(&Lock); }
+
+    RWLock(const RWLock &) = delete;
+    RWLock &operator=(const RWLock &) = delete;
+
+    // Acquire lock shared with other readers
+    void lock_shared() { pthread_rwlock_rdlock(&Lock); }
+
+    // Acquire lock exclusively
+    void lock() { pthread_rwlock_wrlock(&Lock); }
+
+    // Release lock held either way
+    void unlock() { pthread_rwlock_unlock(&Lock); }
+};
+
+// Holds lock shared for the lifetime of the guard
+class ReadGuard {
+private:
+    RWLock &Lock;
+
+public:
+    ReadGuard(RWLock &lock) : Lock(lock) { Lock.lock_shared(); }
+    ~ReadGuard() { Lock.unlock(); }
+};
+
+// Holds lock exclusively for the lifetime of the guard
+class WriteGuard {
+private:
+    RWLock &Lock;
+
+public:
+    WriteGuard(RWLock &lock) : Lock(lock) { Lock.lock(); }
+    ~WriteGuard() { Lock.unlock(); }
+};
@@ -0,0 +1,166 @@
+// stats.h: File system statistics
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Latency histogram with power of two buckets
+class Histogram {
+public:
+    // Bucket i counts latencies below 2^(i+1) ns, the last one everything else
+    const static size_t BUCKETS = 36;
+
+    // Default constructor
+    Histogram() { reset(); }
+
+    // Record one latency
+    // @param	nanoseconds Time the operation took
+    void record(uint64_t nanoseconds);
+
+    // Forget every recorded latency
+    void reset();
+
+    // Return number of latencies recorded
+    uint64_t count() const { return Count.load(std::memory_order_relaxed); }
+
+    // Return sum of latencies recorded in ns
+    uint64_t total() const { return Total.load(std::memory_order_relaxed); }
+
+    // Return largest latency recorded in ns
+    uint64_t max() const { return Max.load(std::memory_order_relaxed); }
+
+    // Return number of latencies in bucket
+    uint64_t bucket(size_t i) const { return Buckets[i].load(std::memory_order_relaxed); }
+
+    // Return upper bound of bucket in ns
+    static uint64_t bound(size_t i) { return 2ULL << i; }
+
+    // Return latency fraction of recorded latencies stay below, rounded up
+    // to a bucket bound and capped by max
+    // @param	fraction    Between 0 and 1, 0.99 for the 99th percentile
+    uint64_t percentile(double fraction) const;
+
+private:
+    std::atomic<uint64_t> Buckets[BUCKETS]; // Latencies per bucket
+    std::atomic<uint64_t> Count;	    // Latencies recorded
+    std::atomic<uint64_t> Total;	    // Sum of latencies in ns
+    std::atomic<uint64_t> Max;		    // Largest latency in ns
+};
+
+// Counters and latency histograms kept by a file system
+// Every update is a single branch when statistics are disabled, and
+// building with -DSFS_NO_STATS compiles them out altogether.
+class Stats {
+public:
+    // What a block accessed by the file system holds
+    enum BlockType {
+    	SUPER_BLOCK, BITMAP_BLOCK, JOURNAL_BLOCK, INODE_BLOCK, INDIRECT_BLOCK, DATA_BLOCK,
+    	BLOCK_TYPES
+    };
+
+    // Operations whose latency is recorded
+    enum Operation {
+    	CREATE, REMOVE, READ, WRITE, MOUNT,
+    	OPERATIONS
+    };
+
+    // Other activity counted
+    enum Counter {
+    	BYTES_READ, BYTES_WRITTEN, BLOCKS_ALLOCATED, BLOCKS_FREED, ALLOCATION_RUNS,
+    	INODES_ALLOCATED, INODES_FREED,
+    	COUNTERS
+    };
+
+    // Records latency of an operation from construction to destruction
+    class Timer {
+    public:
+    	Timer(Stats &stats, Operation operation)
+    	    : stats(stats.enabled() ? &stats : NULL), operation(operation) {
+    	    if (this->stats)
+    	    	start = std::chrono::steady_clock::now();
+    	}
+
+    	~Timer() {
+    	    if (stats)
+    	    	stats->Latency[operation].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    	    	    std::chrono::steady_clock::now() - start).count());
+    	}
+
+    private:
+    	Stats	   *stats;
+    	Operation   operation;
+    	std::chrono::steady_clock::time_point start;
+    };
+
+    // Default constructor, statistics start out disabled
+    Stats() : Enabled(false) { reset(); }
+
+    // Turn collection on or off, what was collected is kept
+    void enable(bool enabled) { Enabled.store(enabled, std::memory_order_relaxed); }
+
+    // Return whether or not statistics are being collected
+#ifdef SFS_NO_STATS
+    bool enabled() const { return false; }
+#else
+    bool enabled() const { return Enabled.load(std::memory_order_relaxed); }
+#endif
+
+    // Count blocks read by the file system, whether or not they were cached
+    // @param	type	    What the blocks hold
+    // @param	blocks	    Number of blocks
+    void count_read(BlockType type, size_t blocks = 1) {
+    	if (enabled())
+    	    Reads[type].fetch_add(blocks, std::memory_order_relaxed);
+    }
+
+    // Count blocks written by the file system, whether or not they were cached
+    // @param	type	    What the blocks hold
+    // @param	blocks	    Number of blocks
+    void count_write(BlockType type, size_t blocks = 1) {
+    	if (enabled())
+    	    Writes[type].fetch_add(blocks, std::memory_order_relaxed);
+    }
+
+    // Add to counter
+    // @param	counter	    Counter to add to
+    // @param	amount	    Amount to add
+    void add(Counter counter, size_t amount = 1) {
+    	if (enabled())
+    	    Counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Zero every counter and histogram
+    void reset();
+
+    // Return number of blocks of type read
+    uint64_t reads(BlockType type) const { return Reads[type].load(std::memory_order_relaxed); }
+
+    // Return number of blocks of type written
+    uint64_t writes(BlockType type) const { return Writes[type].load(std::memory_order_relaxed); }
+
+    // Return value of counter
+    uint64_t counter(Counter counter) const { return Counters[counter].load(std::memory_order_relaxed); }
+
+    // Return latency histogram of operation
+    const Histogram &latency(Operation operation) const { return Latency[operation]; }
+
+    // Return names used when printing
+    static const char *name(BlockType type);
+    static const char *name(Operation operation);
+    static const char *name(Counter counter);
+
+    // Return everything collected as a JSON object
+    std::string json() const;
+
+private:
+    std::atomic<bool>	  Enabled;		// Whether or not updates are recorded
+    std::atomic<uint64_t> Reads[BLOCK_TYPES];	// Blocks read, by type
+    std::atomic<uint64_t> Writes[BLOCK_TYPES];	// Blocks written, by type
+    std::atomic<uint64_t> Counters[COUNTERS];	// Everything else counted
+    Histogram		  Latency[OPERATIONS];	// Latency, by operation
+};
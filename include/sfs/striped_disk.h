@@ -0,0 +1,125 @@
+// striped_disk.h: Disk emulator striped across several image files
+
+#pragma once
+
+#include "sfs/disk.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class StripedDisk : public Disk {
+private:
+    struct Request {
+    	bool	Write;			    // Whether or not this is a write
+    	off_t	Offset;			    // Byte offset into the member image
+    	std::vector<struct iovec> Iov;	    // Buffers to transfer
+    	std::string Error;		    // Failure, empty on success
+    	bool	Finished;		    // Whether or not the member is done with it
+    };
+
+    struct Member {
+    	int	FileDescriptor;		    // File descriptor of member image
+    	std::thread Worker;		    // Thread performing requests
+    	std::deque<Request *> Queue;	    // Requests not yet picked up
+    };
+
+    size_t  Stripe;		    // Blocks per stripe unit
+    std::vector<std::unique_ptr<Member>> Members; // Member images, in stripe order
+    std::mutex	Lock;		    // Protects queues and Finished flags
+    std::condition_variable Ready;  // Signalled when a request is queued
+    std::condition_variable Done;   // Signalled when a request completes
+    bool    Stopping;		    // Whether or not workers should exit
+
+    // Worker thread main loop
+    // @param	member	    Member whose requests the thread performs
+    void work(Member *member);
+
+    // Map block to its member image
+    // @param	blocknum    Block to map
+    // @param	member	    Set to index of member holding block
+    // Returns block number inside the member image.
+    size_t locate(size_t blocknum, size_t *member) const;
+
+    // Split consecutive blocks into one request per member, each covering
+    // a consecutive range of its member image
+    // @param	write	    Whether or not the requests write
+    // @param	blocknum    First block to transfer
+    // @param	iov	    Buffers to transfer, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    // @param	requests    Set to request of each member, empty if untouched
+    void split(bool write, int blocknum, const struct iovec *iov, int iovcnt, std::vector<Request> *requests) const;
+
+    // Perform request synchronously on member
+    // @param	member	    Member to transfer to or from
+    // @param	request	    Request to perform, Error is set on failure
+    void perform(Member *member, Request *request);
+
+    // Perform requests, handing all but one to member workers so they run
+    // in parallel, and count syscalls, blocks and trace entries
+    // Throws runtime_error exception if any of them failed.
+    void dispatch(std::vector<Request> &requests, int blocknum, size_t count);
+
+public:
+    // Default blocks per stripe unit
+    const static size_t DEFAULT_STRIPE = 16;
+
+    // Constructor
+    // @param	members	    Number of member images
+    // @param	stripe	    Blocks written to one member before moving on to the next
+    StripedDisk(size_t members, size_t stripe = DEFAULT_STRIPE);
+
+    // Destructor, stops workers and closes member images
+    ~StripedDisk();
+
+    // Open member images path.0, path.1, ... and start their workers
+    // @param	path	    Prefix of member image paths
+    // @param	nblocks	    Number of blocks in the striped disk
+    // Throws runtime_error exception on error.
+    void open(const char *path, size_t nblocks);
+
+    using Disk::readv;
+    using Disk::write;
+
+    // Read block from the member holding it
+    // @param	blocknum    Block to read from
+    // @param	data	    Buffer to read into
+    void read(int blocknum, char *data);
+
+    // Write block to the member holding it
+    // @param	blocknum    Block to write to
+    // @param	data	    Buffer to write from
+    void write(int blocknum, char *data);
+
+    // Read consecutive blocks, with one system call per member in parallel
+    // @param	blocknum    First block to read from
+    // @param	iov	    Buffers to read into, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    void readv(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Write consecutive blocks, with one system call per member in parallel
+    // @param	blocknum    First block to write to
+    // @param	iov	    Buffers to write from, each a multiple of BLOCK_SIZE
+    // @param	iovcnt	    Number of buffers
+    void writev(int blocknum, const struct iovec *iov, int iovcnt);
+
+    // Zero consecutive blocks, punching one hole per member
+    // @param	blocknum    First block to zero
+    // @param	count	    Number of blocks to zero
+    // @param	release	    Punch holes rather than write zeros if possible
+    void zero(int blocknum, size_t count, bool release = true);
+
+    // Flush every member image to stable storage
+    // Throws runtime_error exception on error.
+    void sync();
+
+    // Return number of member images
+    size_t members() const { return Members.size(); }
+
+    // Return blocks per stripe unit
+    size_t stripe() const { return Stripe; }
+};
@@ -0,0 +1,95 @@
+// tracer.h: Block access trace recorder
+
+#pragma once
+
+#include "sfs/stats.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+class Tracer {
+public:
+    // What a record describes, reads and writes are issued by the file
+    // system and carry a block type, disk operations reach the image
+    enum Op {
+    	READ, WRITE, DISK_READ, DISK_WRITE, DISK_ZERO, DISK_SYNC,
+    	OPS
+    };
+
+    // Block type of disk operations, which do not know what they move
+    const static uint8_t NO_TYPE = Stats::BLOCK_TYPES;
+
+    struct Record {
+    	uint64_t Time;		// Nanoseconds since tracing started
+    	uint32_t Block;		// First block
+    	uint16_t Count;		// Number of blocks
+    	uint8_t  Op;		// Tracer::Op
+    	uint8_t  Type;		// Stats::BlockType, or NO_TYPE
+    };
+
+    struct Header {
+    	uint32_t Magic;		// Trace magic number
+    	uint32_t Version;	// Trace format version
+    	uint32_t RecordSize;	// Bytes per record
+    	uint32_t BlockSize;	// Bytes per block
+    };
+
+    const static uint32_t MAGIC   = 0x54534653; // "SFST"
+    const static uint32_t VERSION = 1;
+
+    // Records gathered before they are written out
+    const static size_t BUFFER_RECORDS = 4096;
+
+    // Default constructor
+    Tracer() : FileDescriptor(-1), Records(0) {}
+
+    // Destructor, writes out buffered records
+    ~Tracer() { close(); }
+
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+
+    // Start a new trace
+    // @param	path	    Path to trace file, truncated if it exists
+    // Throws runtime_error exception on error.
+    void open(const char *path);
+
+    // Write out buffered records and stop tracing
+    void close();
+
+    // Return whether or not a trace is being written
+    bool is_open() const { return FileDescriptor >= 0; }
+
+    // Append record, writing the buffer out when it is full
+    // @param	op	    What happened
+    // @param	block	    First block
+    // @param	count	    Number of blocks, longer runs are split
+    // @param	type	    Stats::BlockType of file system accesses
+    void record(Op op, size_t block, size_t count = 1, uint8_t type = NO_TYPE);
+
+    // Return number of records written so far
+    size_t records() const { std::lock_guard<std::mutex> guard(Lock); return Records; }
+
+    // Read a whole trace
+    // @param	path	    Path to trace file
+    // @param	records	    Filled with records in the order they were made
+    // Throws runtime_error exception on error.
+    static void load(const char *path, std::vector<Record> *records);
+
+    // Return name of op used when printing
+    static const char *name(Op op);
+
+private:
+    // Write buffered records out, Lock must be held
+    void flush_locked();
+
+    int			FileDescriptor;	// Trace file, -1 if not tracing
+    size_t		Records;	// Records made since open
+    std::vector<Record>	Buffer;		// Records not yet written out
+    std::chrono::steady_clock::time_point Start; // When tracing started
+    mutable std::mutex	Lock;		// Protects everything above
+};
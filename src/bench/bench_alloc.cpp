@@ -0,0 +1,113 @@
+// bench_alloc.cpp: Block allocator benchmark
+
+#include "common/bench.h"
+#include "sfs/allocator.h"
+
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Timing helpers
+
+static void report(const char *name, size_t allocations, double seconds) {
+    printf("%-24s %10lu allocations %10.2f ms %10.1f ns/alloc\n",
+    	name, allocations, seconds * 1e3, allocations ? seconds * 1e9 / allocations : 0.0);
+}
+
+// Original allocator: one int per block, first-fit scan from first data block
+
+static ssize_t legacy_allocate(std::vector<int> &bitMap, size_t low) {
+    for (size_t i = low; i < bitMap.size(); i++) {
+    	if (bitMap[i] == 1) {
+    	    bitMap[i] = 0;
+    	    return i;
+    	}
+    }
+    return -1;
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t blocks = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t low    = 1 + (size_t)(0.1 * blocks + 0.5);
+    size_t data   = blocks - low;
+
+    printf("allocating %lu data blocks of a %lu block image\n", data, blocks);
+
+    // Fill with original linear scan
+    {
+    	std::vector<int> bitMap(blocks, 1);
+    	double start = now();
+    	while (legacy_allocate(bitMap, low) >= 0);
+    	report("fill legacy first-fit", data, now() - start);
+    }
+
+    // Fill with next-fit cursor
+    Allocator allocator;
+    {
+    	allocator.assign(blocks, low);
+    	double start = now();
+    	while (allocator.allocate() >= 0);
+    	report("fill next-fit", data, now() - start);
+    }
+
+    // Fill with goal right after previous block, as writeArray does
+    {
+    	allocator.assign(blocks, low);
+    	double start = now();
+    	ssize_t last = 0;
+    	while ((last = allocator.allocate(last + 1)) >= 0);
+    	report("fill goal", data, now() - start);
+    }
+
+    // Release 1% of a full image at random, then allocate it back: most of
+    // the map is full words that the scan must skip
+    {
+    	srand(42);
+    	std::vector<size_t> holes;
+    	for (size_t i = 0; i < data / 100; i++) {
+    	    size_t block = low + rand() % data;
+    	    if (!allocator.is_free(block)) {
+    	    	allocator.release(block);
+    	    	holes.push_back(block);
+    	    }
+    	}
+
+    	double start = now();
+    	while (allocator.allocate() >= 0);
+    	report("refill 1% fragmented", holes.size(), now() - start);
+    }
+
+    // Same fragmented refill with the original scan
+    {
+    	std::vector<int> bitMap(blocks, 0);
+    	srand(42);
+    	size_t holes = 0;
+    	for (size_t i = 0; i < data / 100; i++) {
+    	    size_t block = low + rand() % data;
+    	    if (bitMap[block] == 0) {
+    	    	bitMap[block] = 1;
+    	    	holes++;
+    	    }
+    	}
+
+    	double start = now();
+    	while (legacy_allocate(bitMap, low) >= 0);
+    	report("refill legacy", holes, now() - start);
+    }
+
+    // Free block count is maintained incrementally
+    {
+    	double start = now();
+    	size_t total = 0;
+    	for (size_t i = 0; i < 1000000; i++)
+    	    total += allocator.free_count();
+    	double seconds = now() - start;
+    	printf("%-24s %10lu calls       %10.2f ms %10.1f ns/call (%lu)\n",
+    	    "free_count", 1000000UL, seconds * 1e3, seconds * 1e9 / 1000000, total);
+    }
+
+    return EXIT_SUCCESS;
+}
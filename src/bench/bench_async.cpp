@@ -0,0 +1,100 @@
+// bench_async.cpp: Read benchmark of synchronous and queued disk I/O
+
+#include "common/bench.h"
+#include "sfs/async_disk.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Largest file a single inode can map
+const size_t FILE_SIZE = (FileSystem::POINTERS_PER_INODE + FileSystem::POINTERS_PER_BLOCK) * Disk::BLOCK_SIZE;
+
+// Create two full sized files: inode 0 contiguous, inodes 1 and 2
+// interleaved block by block so that neither has adjacent blocks
+static void populate(const char *path, size_t blocks) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<char> data(FILE_SIZE, 'x');
+    ssize_t contiguous = fs.create();
+    if (fs.write(contiguous, data.data(), FILE_SIZE, 0) != (ssize_t)FILE_SIZE)
+    	throw std::runtime_error("unable to populate image");
+
+    ssize_t first  = fs.create();
+    ssize_t second = fs.create();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += Disk::BLOCK_SIZE) {
+    	if (fs.write(first, data.data(), Disk::BLOCK_SIZE, offset) != (ssize_t)Disk::BLOCK_SIZE ||
+    	    fs.write(second, data.data(), Disk::BLOCK_SIZE, offset) != (ssize_t)Disk::BLOCK_SIZE)
+    	    throw std::runtime_error("unable to populate image");
+    }
+
+    fs.unmount();
+}
+
+// Read one file in a single call with a cold page cache
+static void run(const char *name, Disk *disk, const char *path, size_t blocks) {
+    std::unique_ptr<Disk> owner(disk);
+    FileSystem fs;
+
+    disk->open(path, blocks);
+    fs.mount(disk);
+
+    std::vector<char> buffer(FILE_SIZE);
+    const char *layouts[] = {"contiguous", "scattered"};
+    for (size_t inumber = 0; inumber < 2; inumber++) {
+    	fs.cache().resize(0);
+    	fs.cache().resize(Cache::DEFAULT_CAPACITY);
+    	evict(path);
+
+    	size_t syscalls = disk->syscalls();
+    	double start    = now();
+    	if (fs.read(inumber, buffer.data(), FILE_SIZE, 0) != (ssize_t)FILE_SIZE)
+    	    throw std::runtime_error("short read");
+    	double seconds  = now() - start;
+
+    	printf("%-10s %-10s %10.2f ms %10.1f MB/s %8lu syscalls\n", name, layouts[inumber],
+    	    seconds * 1e3, FILE_SIZE / seconds / (1 << 20), disk->syscalls() - syscalls);
+    }
+
+    fs.unmount();
+    fflush(stdout);
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t blocks = 4 * FILE_SIZE / Disk::BLOCK_SIZE;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    populate(path, blocks);
+    printf("reading %lu byte files with a cold page cache\n", FILE_SIZE);
+
+    run("pread", new Disk(), path, blocks);
+    size_t depths[] = {1, 8, 32, 128};
+    for (auto depth : depths) {
+    	char name[BUFSIZ];
+    	snprintf(name, BUFSIZ, "queue %lu", depth);
+    	run(name, new AsyncDisk(depth), path, blocks);
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// bench_bigfile.cpp: Throughput of one large file versus many small ones
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Largest file that fits in the direct and indirect pointers, which used to
+// force large data sets to be sharded over many inodes
+const size_t SHARD = 4 << 20;
+
+// Bytes per read or write call
+const size_t CHUNK = 1 << 20;
+
+// Number of random block reads
+const size_t PROBES = 4096;
+
+// Write length bytes as files of fileSize bytes, then read them back cold
+// and probe random blocks
+static void run(const char *name, const char *path, size_t blocks, size_t length, size_t fileSize) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<ssize_t> inumbers;
+    for (size_t offset = 0; offset < length; offset += fileSize)
+    	inumbers.push_back(fs.create());
+
+    std::vector<char> data(CHUNK, 'x');
+    size_t writes   = disk.writes();
+    size_t syscalls = disk.syscalls();
+    double start    = now();
+
+    for (size_t offset = 0; offset < length; offset += CHUNK) {
+    	size_t size = std::min(CHUNK, length - offset);
+    	if (fs.write(inumbers[offset / fileSize], data.data(), size, offset % fileSize) != (ssize_t)size)
+    	    throw std::runtime_error("short write");
+    }
+    fs.sync();
+
+    double seconds = now() - start;
+    printf("%-7s write %10.2f ms %8.1f MB/s %8lu block writes %8lu syscalls\n", name,
+    	seconds * 1e3, length / seconds / (1 << 20), disk.writes() - writes, disk.syscalls() - syscalls);
+
+    // read back cold, pointer blocks have to come in again
+    size_t cacheBlocks = fs.cache().capacity();
+    fs.cache().resize(0);
+    fs.cache().resize(cacheBlocks);
+
+    size_t reads = disk.reads();
+    syscalls     = disk.syscalls();
+    start        = now();
+
+    for (size_t offset = 0; offset < length; offset += CHUNK) {
+    	size_t size = std::min(CHUNK, length - offset);
+    	if (fs.read(inumbers[offset / fileSize], data.data(), size, offset % fileSize) != (ssize_t)size)
+    	    throw std::runtime_error("short read");
+    }
+
+    seconds = now() - start;
+    printf("%-7s read  %10.2f ms %8.1f MB/s %8lu block reads  %8lu syscalls\n", name,
+    	seconds * 1e3, length / seconds / (1 << 20), disk.reads() - reads, disk.syscalls() - syscalls);
+
+    // single blocks all over the data set, each looked up on its own
+    srand(1);
+    reads = disk.reads();
+    start = now();
+
+    for (size_t i = 0; i < PROBES; i++) {
+    	size_t offset = (size_t)rand() % (length / Disk::BLOCK_SIZE) * Disk::BLOCK_SIZE;
+    	if (fs.read(inumbers[offset / fileSize], data.data(), Disk::BLOCK_SIZE, offset % fileSize) != (ssize_t)Disk::BLOCK_SIZE)
+    	    throw std::runtime_error("short read");
+    }
+
+    seconds = now() - start;
+    printf("%-7s probe %10.2f ms %8.2f us/read %8lu block reads\n", name,
+    	seconds * 1e3, seconds / PROBES * 1e6, disk.reads() - reads);
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t length = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1024) << 20;
+
+    // data, its pointer blocks, and the tenth of the image kept for inodes
+    size_t dataBlocks = length / Disk::BLOCK_SIZE;
+    size_t blocks = (dataBlocks + dataBlocks / FileSystem::POINTERS_PER_BLOCK + 64) * 10 / 9 + 64;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("writing %lu bytes to a %lu block image\n", length, blocks);
+
+    run("sharded", path, blocks, length, SHARD);
+    run("single", path, blocks, length, length);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
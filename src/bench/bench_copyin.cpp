@@ -0,0 +1,111 @@
+// bench_copyin.cpp: Sequential file write and read benchmark
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// I/O helpers
+
+// Return number of write system calls issued by this process so far
+static size_t write_syscalls() {
+    FILE *stream = fopen("/proc/self/io", "r");
+    if (stream == NULL)
+    	return 0;
+
+    char   line[BUFSIZ];
+    size_t count = 0;
+    while (fgets(line, BUFSIZ, stream) != NULL) {
+    	if (sscanf(line, "syscw: %lu", &count) == 1)
+    	    break;
+    }
+
+    fclose(stream);
+    return count;
+}
+
+// Copy length bytes into a new file chunk bytes at a time, then sync
+static void run(const char *path, size_t blocks, size_t length, size_t chunk) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    ssize_t inumber = fs.create();
+    std::vector<char> data(length, 'x');
+
+    size_t writes   = disk.writes();
+    size_t syscalls = write_syscalls();
+    double start    = now();
+
+    for (size_t offset = 0; offset < length; offset += chunk) {
+    	size_t size = std::min(chunk, length - offset);
+    	if (fs.write(inumber, data.data() + offset, size, offset) != (ssize_t)size)
+    	    throw std::runtime_error("short write");
+    }
+    fs.sync();
+
+    double seconds = now() - start;
+    writes   = disk.writes() - writes;
+    syscalls = write_syscalls() - syscalls;
+
+    printf("write %-8lu %10.2f ms %10.1f MB/s %8lu block writes %8lu write syscalls\n",
+    	chunk, seconds * 1e3, length / seconds / (1 << 20), writes, syscalls);
+
+    // read back cold, as copyout does
+    size_t cacheBlocks = fs.cache().capacity();
+    fs.cache().resize(0);
+    fs.cache().resize(cacheBlocks);
+
+    size_t reads = disk.reads();
+    syscalls     = disk.syscalls();
+    start        = now();
+
+    for (size_t offset = 0; offset < length; offset += chunk) {
+    	size_t size = std::min(chunk, length - offset);
+    	if (fs.read(inumber, data.data() + offset, size, offset) != (ssize_t)size)
+    	    throw std::runtime_error("short read");
+    }
+
+    seconds  = now() - start;
+    reads    = disk.reads() - reads;
+    syscalls = disk.syscalls() - syscalls;
+
+    printf("read  %-8lu %10.2f ms %10.1f MB/s %8lu block reads  %8lu read syscalls\n",
+    	chunk, seconds * 1e3, length / seconds / (1 << 20), reads, syscalls);
+
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t length = (argc > 1 ? strtoul(argv[1], NULL, 10) : 4) << 20;
+    size_t blocks = 2 * length / Disk::BLOCK_SIZE + 64;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("writing %lu bytes to a %lu block image\n", length, blocks);
+
+    size_t chunks[] = {Disk::BLOCK_SIZE, 4 * BUFSIZ, 1 << 20, length};
+    for (auto chunk : chunks)
+    	run(path, blocks, length, chunk);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+// bench_directory.cpp: Lookups in a directory with a million entries
+
+#include "common/bench.h"
+#include "sfs/directory.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Helpers
+
+static std::string name_of(size_t i) {
+    return "entry-" + std::to_string(i);
+}
+
+// Look up random names, printing time and block reads per lookup
+static void lookups(Disk &disk, Directory &directory, size_t entries, size_t count, const char *label) {
+    size_t reads = disk.reads();
+    double start = now();
+
+    for (size_t i = 0; i < count; i++) {
+    	if (directory.lookup(name_of(rand() % entries)) < 0)
+    	    throw std::runtime_error("lookup failed");
+    }
+
+    double seconds = now() - start;
+    printf("%-12s %8lu lookups %10.2f us/lookup %8.3f block reads/lookup\n",
+    	label, count, seconds * 1e6 / count, (double)(disk.reads() - reads) / count);
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t entries = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t count   = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+    size_t blocks  = entries / 32 + 4096;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+    fs.set_group_commit(0);
+
+    // every name is a hard link to the same file, only the directory grows
+    ssize_t root = Directory::root(&fs);
+    ssize_t file = fs.create();
+    Directory directory(&fs, root);
+
+    printf("linking %lu names in one directory on a %lu block image\n", entries, blocks);
+
+    size_t freeBlocks = fs.free_blocks();
+    double start = now();
+    for (size_t i = 0; i < entries; i++) {
+    	if (!directory.link(name_of(i), file, Directory::FILE_ENTRY))
+    	    throw std::runtime_error("link failed");
+    }
+    fs.sync();
+
+    double seconds = now() - start;
+    printf("%-12s %8lu links   %10.2f us/link    %8lu blocks used\n",
+    	"link", entries, seconds * 1e6 / entries, freeBlocks - fs.free_blocks());
+
+    // cold cache, each lookup reads the header and the bucket its name hashes to
+    fs.unmount();
+    fs.mount(&disk);
+    srand(1);
+    lookups(disk, directory, entries, count, "lookup");
+
+    // a directory kept as a flat list would scan half of it per lookup
+    fs.unmount();
+    fs.mount(&disk);
+
+    size_t reads = disk.reads();
+    start = now();
+    std::vector<Directory::Entry> listed;
+    if (!directory.readdir(&listed) || listed.size() != entries)
+    	throw std::runtime_error("readdir failed");
+
+    seconds = now() - start;
+    reads = disk.reads() - reads;
+    printf("%-12s %8lu entries %10.2f ms         %8lu block reads, %lu per lookup if scanned\n",
+    	"readdir", listed.size(), seconds * 1e3, reads, reads / 2);
+
+    fs.unmount();
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+// bench_format.cpp: Format and mount time versus image size
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdexcept>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Format fresh image, then mount it and create a file
+static void run(const char *name, bool full, const char *path, size_t megabytes) {
+    size_t blocks = (megabytes << 20) / Disk::BLOCK_SIZE;
+    double formatTime, mountTime;
+    size_t formatCalls, mountReads;
+
+    unlink(path);
+    {
+    	Disk disk;
+    	disk.open(path, blocks);
+
+    	double start = now();
+    	if (!FileSystem::format(&disk, full))
+    	    throw std::runtime_error("unable to format image");
+    	formatTime  = now() - start;
+    	formatCalls = disk.syscalls();
+    }
+    {
+    	Disk	    disk;
+    	FileSystem  fs;
+    	disk.open(path, blocks);
+
+    	double start = now();
+    	if (!fs.mount(&disk) || fs.create() < 0)
+    	    throw std::runtime_error("unable to mount image");
+    	mountTime  = now() - start;
+    	mountReads = disk.reads();
+    }
+
+    struct stat st;
+    stat(path, &st);
+    printf("%-4s %6lu MB %10.2f ms format %10lu syscalls %10.2f ms mount %6lu block reads %8.1f MB allocated\n",
+    	name, megabytes, formatTime * 1e3, formatCalls, mountTime * 1e3, mountReads,
+    	st.st_blocks * 512.0 / (1 << 20));
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t largest = argc > 1 ? strtoul(argv[1], NULL, 10) : 1024;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    for (size_t megabytes = 16; megabytes <= largest; megabytes *= 4) {
+    	run("fast", false, path, megabytes);
+    	run("full", true, path, megabytes);
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+// bench_inline.cpp: Small file space and read latency with and without inline data
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Write files of the given sizes, then read each one back after a remount
+static void run(const char *path, size_t blocks, const std::vector<size_t> &sizes, bool inlineData) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+    fs.set_inline_data(inlineData);
+
+    std::vector<char> data(Disk::BLOCK_SIZE, 'x');
+    size_t freeBlocks = fs.free_blocks();
+    double start = now();
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+    	ssize_t inumber = fs.create();
+    	if (inumber < 0 || fs.write(inumber, data.data(), sizes[i], 0) != (ssize_t)sizes[i])
+    	    throw std::runtime_error("short write");
+    }
+    fs.sync();
+
+    double writeSeconds = now() - start;
+    size_t used = freeBlocks - fs.free_blocks();
+
+    // cold cache, inode blocks have to be read again
+    fs.unmount();
+    fs.mount(&disk);
+
+    size_t reads = disk.reads();
+    start = now();
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+    	if (fs.read(i, data.data(), Disk::BLOCK_SIZE, 0) != (ssize_t)sizes[i])
+    	    throw std::runtime_error("short read");
+    }
+
+    double readSeconds = now() - start;
+    reads = disk.reads() - reads;
+
+    printf("inline %-3s %8lu blocks used %10.2f us/write %10.2f us/read %8.3f block reads/file\n",
+    	inlineData ? "on" : "off", used, writeSeconds * 1e6 / sizes.size(),
+    	readSeconds * 1e6 / sizes.size(), (double)reads / sizes.size());
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t files  = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t blocks = 3 * files / 2 + 64;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    // a few dozen bytes each, most small enough to fit in an inode
+    std::vector<size_t> sizes(files);
+    srand(1);
+    for (auto &size : sizes)
+    	size = 1 + rand() % 48;
+
+    printf("writing %lu files of 1 to 48 bytes to a %lu block image\n", files, blocks);
+
+    run(path, blocks, sizes, false);
+    run(path, blocks, sizes, true);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
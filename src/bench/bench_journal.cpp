@@ -0,0 +1,87 @@
+// bench_journal.cpp: Metadata operations with a commit per operation against group commit
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Operations run by each thread, each one creates, writes or removes a file
+const size_t OPERATIONS = 600;
+
+// Bytes written to each file
+const size_t FILE_SIZE  = 2 * Disk::BLOCK_SIZE;
+
+// Create a file, fill it, and remove every other one
+static void worker(FileSystem &fs) {
+    std::vector<char> buffer(FILE_SIZE, 'x');
+
+    for (size_t i = 0; i < OPERATIONS / 3; i++) {
+    	ssize_t inumber = fs.create();
+    	fs.write(inumber, buffer.data(), buffer.size(), 0);
+    	if (i % 2)
+    	    fs.remove(inumber);
+    	else
+    	    fs.write(inumber, buffer.data(), 1, 0);
+    }
+}
+
+// Run threads against a freshly formatted image
+static void run(const char *path, size_t threads, size_t group) {
+    Disk	disk;
+    FileSystem	fs;
+
+    size_t blocks = threads * OPERATIONS * FILE_SIZE / Disk::BLOCK_SIZE + 4096;
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+    fs.set_group_commit(group);
+
+    double start = now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+    	workers.push_back(std::thread(worker, std::ref(fs)));
+    for (auto &w : workers)
+    	w.join();
+    fs.sync();
+    double seconds = now() - start;
+
+    char mode[32];
+    if (group == 0)
+    	snprintf(mode, sizeof(mode), "on sync");
+    else
+    	snprintf(mode, sizeof(mode), "every %lu", group);
+    printf("%-12s %3lu threads %10.2f ms %10.0f ops/s %8lu commits %8lu journal blocks\n", mode,
+    	threads, seconds * 1e3, threads * OPERATIONS / seconds, fs.commits(), fs.journal_writes());
+    fs.unmount();
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t maxThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("each thread runs %lu create, write and remove operations, on %u cpus\n",
+    	OPERATIONS, std::thread::hardware_concurrency());
+    const size_t groups[] = {1, 16, 256, 0};
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+    	for (size_t group : groups)
+    	    run(path, threads, group);
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// bench_mmap.cpp: Read benchmark of the read/write and mmap disk backends
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/mmap_disk.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Largest file a single inode can map
+const size_t FILE_SIZE = (FileSystem::POINTERS_PER_INODE + FileSystem::POINTERS_PER_BLOCK) * Disk::BLOCK_SIZE;
+
+// Chunk size used by sfssh copyout
+const size_t CHUNK_SIZE = 4 * BUFSIZ;
+
+// Format image and fill it with full sized files, returns number of files
+static size_t populate(const char *path, size_t blocks) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<char> data(FILE_SIZE, 'x');
+    size_t files = 0;
+    while (fs.free_blocks() > FILE_SIZE / Disk::BLOCK_SIZE + 1) {
+    	ssize_t inumber = fs.create();
+    	if (inumber < 0 || fs.write(inumber, data.data(), FILE_SIZE, 0) != (ssize_t)FILE_SIZE)
+    	    throw std::runtime_error("unable to populate image");
+    	files++;
+    }
+
+    fs.unmount();
+    return files;
+}
+
+// Read every file back in copyout sized chunks, twice
+static void run(const char *name, Disk &disk, const char *path, size_t blocks, size_t files) {
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    fs.mount(&disk);
+
+    std::vector<char> buffer(CHUNK_SIZE);
+    for (int pass = 0; pass < 2; pass++) {
+    	size_t reads    = disk.reads();
+    	size_t syscalls = disk.syscalls();
+    	double start    = now();
+
+    	for (size_t inumber = 0; inumber < files; inumber++) {
+    	    for (size_t offset = 0; offset < FILE_SIZE; offset += CHUNK_SIZE) {
+    	    	if (fs.read(inumber, buffer.data(), CHUNK_SIZE, offset) <= 0)
+    	    	    throw std::runtime_error("short read");
+    	    }
+    	}
+
+    	double seconds = now() - start;
+    	printf("%-6s pass %d %10.2f ms %10.1f MB/s %10lu block reads %10lu syscalls\n",
+    	    name, pass, seconds * 1e3, files * FILE_SIZE / seconds / (1 << 20),
+    	    disk.reads() - reads, disk.syscalls() - syscalls);
+    }
+
+    fs.unmount();
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    size_t blocks    = (megabytes << 20) / Disk::BLOCK_SIZE;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    size_t files = populate(path, blocks);
+    printf("reading %lu files of %lu bytes from a %lu MB image\n", files, FILE_SIZE, megabytes);
+
+    {
+    	Disk disk;
+    	run("pread", disk, path, blocks, files);
+    }
+    {
+    	MmapDisk disk;
+    	run("mmap", disk, path, blocks, files);
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
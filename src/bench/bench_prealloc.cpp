@@ -0,0 +1,99 @@
+// bench_prealloc.cpp: Fragmentation of interleaved log writers with and without preallocation
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Writers append one record at a time, taking turns
+const size_t WRITERS = 8;
+const size_t RECORD  = Disk::BLOCK_SIZE;
+
+// Grow every log to length bytes, then read each one back cold
+static void run(const char *path, size_t blocks, size_t length, bool preallocate) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<ssize_t> logs(WRITERS);
+    for (auto &inumber : logs) {
+    	inumber = fs.create();
+    	if (preallocate && !fs.fallocate(inumber, 0, length))
+    	    throw std::runtime_error("fallocate failed");
+    }
+
+    std::vector<char> data(RECORD, 'x');
+    double start = now();
+
+    for (size_t offset = 0; offset < length; offset += RECORD) {
+    	for (auto inumber : logs) {
+    	    if (fs.write(inumber, data.data(), RECORD, offset) != (ssize_t)RECORD)
+    	    	throw std::runtime_error("short write");
+    	}
+    }
+    fs.sync();
+
+    double seconds = now() - start;
+    size_t extents = 0;
+    for (auto inumber : logs)
+    	extents += fs.extents(inumber);
+
+    printf("prealloc %-3s write %8.2f ms %8.1f MB/s %8.1f extents/file\n", preallocate ? "on" : "off",
+    	seconds * 1e3, WRITERS * length / seconds / (1 << 20), (double)extents / WRITERS);
+
+    // cold cache, every log is read front to back on its own
+    size_t cacheBlocks = fs.cache().capacity();
+    fs.cache().resize(0);
+    fs.cache().resize(cacheBlocks);
+
+    std::vector<char> buffer(1 << 20);
+    size_t syscalls = disk.syscalls();
+    start = now();
+
+    for (auto inumber : logs) {
+    	for (size_t offset = 0; offset < length; offset += buffer.size()) {
+    	    size_t size = std::min(buffer.size(), length - offset);
+    	    if (fs.read(inumber, buffer.data(), size, offset) != (ssize_t)size)
+    	    	throw std::runtime_error("short read");
+    	}
+    }
+
+    seconds = now() - start;
+    syscalls = disk.syscalls() - syscalls;
+    printf("prealloc %-3s read  %8.2f ms %8.1f MB/s %8lu read syscalls\n", preallocate ? "on" : "off",
+    	seconds * 1e3, WRITERS * length / seconds / (1 << 20), syscalls);
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t length = (argc > 1 ? strtoul(argv[1], NULL, 10) : 4) << 20;
+    size_t blocks = 3 * WRITERS * length / Disk::BLOCK_SIZE / 2 + 64;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("%lu writers appending %lu byte records to %lu byte logs on a %lu block image\n",
+    	WRITERS, RECORD, length, blocks);
+
+    run(path, blocks, length, false);
+    run(path, blocks, length, true);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
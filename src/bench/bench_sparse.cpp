@@ -0,0 +1,113 @@
+// bench_sparse.cpp: Space and time for a mostly empty, VM image like file
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Every extent starts with a few blocks of data, the rest is never touched
+const size_t EXTENT_BLOCKS = 64;
+const size_t DATA_BLOCKS   = 4;
+
+// Image is copied in chunks of this size, as copyin would
+const size_t CHUNK = 1 << 20;
+
+// Copy the image in, read it back cold, then punch out every other extent
+static void run(const char *path, size_t blocks, const std::vector<char> &image, bool sparse) {
+    Disk	disk;
+    FileSystem	fs;
+
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+    fs.set_sparse_writes(sparse);
+
+    ssize_t inumber = fs.create();
+    std::vector<char> data(CHUNK);
+    size_t freeBlocks = fs.free_blocks();
+    size_t writes = disk.writes();
+    double start = now();
+
+    for (size_t offset = 0; offset < image.size(); offset += CHUNK) {
+    	memcpy(data.data(), image.data() + offset, CHUNK);
+    	if (fs.write(inumber, data.data(), CHUNK, offset) != (ssize_t)CHUNK)
+    	    throw std::runtime_error("short write");
+    }
+    fs.sync();
+
+    double seconds = now() - start;
+    writes = disk.writes() - writes;
+    printf("sparse %-3s write %8.2f ms %8.1f MB/s %8lu blocks used %8lu block writes\n",
+    	sparse ? "on" : "off", seconds * 1e3, image.size() / seconds / (1 << 20),
+    	freeBlocks - fs.free_blocks(), writes);
+
+    // cold cache, as after a remount
+    size_t cacheBlocks = fs.cache().capacity();
+    fs.cache().resize(0);
+    fs.cache().resize(cacheBlocks);
+
+    size_t reads = disk.reads();
+    start = now();
+
+    for (size_t offset = 0; offset < image.size(); offset += CHUNK) {
+    	if (fs.read(inumber, data.data(), CHUNK, offset) != (ssize_t)CHUNK
+    	    || memcmp(data.data(), image.data() + offset, CHUNK) != 0)
+    	    throw std::runtime_error("read back differs");
+    }
+
+    seconds = now() - start;
+    reads = disk.reads() - reads;
+    printf("sparse %-3s read  %8.2f ms %8.1f MB/s %8lu block reads\n",
+    	sparse ? "on" : "off", seconds * 1e3, image.size() / seconds / (1 << 20), reads);
+
+    // discard every other extent, as a guest trimming freed space would
+    size_t used = fs.free_blocks();
+    start = now();
+
+    for (size_t offset = 0; offset < image.size(); offset += 2 * EXTENT_BLOCKS * Disk::BLOCK_SIZE) {
+    	if (!fs.punch_hole(inumber, offset, EXTENT_BLOCKS * Disk::BLOCK_SIZE))
+    	    throw std::runtime_error("punch failed");
+    }
+    fs.sync();
+
+    seconds = now() - start;
+    printf("sparse %-3s punch %8.2f ms %8lu blocks freed, bitmaps %s\n", sparse ? "on" : "off",
+    	seconds * 1e3, fs.free_blocks() - used, fs.check() ? "consistent" : "inconsistent");
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t length = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    size_t blocks = 3 * length / Disk::BLOCK_SIZE / 2 + 64;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    std::vector<char> image(length, 0);
+    for (size_t block = 0; block < length / Disk::BLOCK_SIZE; block++) {
+    	if (block % EXTENT_BLOCKS < DATA_BLOCKS)
+    	    memset(image.data() + block * Disk::BLOCK_SIZE, 'a' + block % 26, Disk::BLOCK_SIZE);
+    }
+
+    printf("copying a %lu byte image, %lu of every %lu blocks written, to a %lu block image\n",
+    	length, DATA_BLOCKS, EXTENT_BLOCKS, blocks);
+
+    run(path, blocks, image, false);
+    run(path, blocks, image, true);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+// bench_striped.cpp: Sequential bandwidth of a disk striped across 1, 2 and 4 images
+
+#include "common/bench.h"
+#include "sfs/striped_disk.h"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Blocks moved per request, split across members by the striped disk
+const size_t REQUEST_BLOCKS = 256;
+
+// Write the whole disk then read it back, both in large sequential requests
+static void run(const std::string &path, size_t blocks, size_t members, size_t stripe) {
+    std::vector<char> buffer(REQUEST_BLOCKS * Disk::BLOCK_SIZE, 'x');
+    double megabytes = (double)blocks * Disk::BLOCK_SIZE / (1 << 20);
+    double writeSeconds, readSeconds;
+    size_t syscalls;
+
+    {
+    	StripedDisk disk(members, stripe);
+    	disk.open(path.c_str(), blocks);
+
+    	double start = now();
+    	for (size_t block = 0; block < blocks; block += REQUEST_BLOCKS)
+    	    disk.write(block, buffer.data(), std::min(REQUEST_BLOCKS, blocks - block));
+    	disk.sync();
+    	writeSeconds = now() - start;
+
+    	for (size_t i = 0; i < members; i++)
+    	    evict(path + "." + std::to_string(i));
+
+    	start = now();
+    	for (size_t block = 0; block < blocks; block += REQUEST_BLOCKS)
+    	    disk.readv(block, std::min(REQUEST_BLOCKS, blocks - block), buffer.data());
+    	readSeconds = now() - start;
+    	syscalls = disk.syscalls();
+    }
+
+    printf("%lu member%s %10.1f MB/s write %10.1f MB/s read %8lu syscalls\n",
+    	members, members > 1 ? "s" : " ", megabytes / writeSeconds, megabytes / readSeconds, syscalls);
+
+    for (size_t i = 0; i < members; i++)
+    	unlink((path + "." + std::to_string(i)).c_str());
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    size_t stripe    = argc > 2 ? strtoul(argv[2], NULL, 10) : StripedDisk::DEFAULT_STRIPE;
+    size_t blocks    = megabytes * (1 << 20) / Disk::BLOCK_SIZE;
+
+    // members are named after a unique prefix
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("%lu MB in %lu block requests, %lu block stripe unit\n", megabytes, REQUEST_BLOCKS, stripe);
+
+    size_t members[] = {1, 2, 4};
+    for (auto count : members)
+    	run(path, blocks, count, stripe);
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+// bench_threads.cpp: Scaling of independent readers and writers
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Bytes written and read back by each thread
+const size_t FILE_SIZE  = 4 << 20;
+
+// Chunk size used by sfssh copyin and copyout
+const size_t CHUNK_SIZE = 4 * BUFSIZ;
+
+// Run operation, behind the global mutex if there is one
+template <typename Operation>
+static void call(std::mutex *global, Operation operation) {
+    if (global == NULL) {
+    	operation();
+    	return;
+    }
+
+    std::lock_guard<std::mutex> guard(*global);
+    operation();
+}
+
+// Write a file of its own, then read it back twice
+static void worker(FileSystem &fs, std::mutex *global) {
+    std::vector<char> buffer(CHUNK_SIZE, 'x');
+    ssize_t inumber = -1;
+
+    call(global, [&]() { inumber = fs.create(); });
+
+    for (size_t offset = 0; offset < FILE_SIZE; offset += CHUNK_SIZE)
+    	call(global, [&]() { fs.write(inumber, buffer.data(), CHUNK_SIZE, offset); });
+
+    for (int pass = 0; pass < 2; pass++) {
+    	for (size_t offset = 0; offset < FILE_SIZE; offset += CHUNK_SIZE)
+    	    call(global, [&]() { fs.read(inumber, buffer.data(), CHUNK_SIZE, offset); });
+    }
+}
+
+// Run threads against a freshly formatted image
+static void run(const char *path, size_t threads, bool serialize) {
+    Disk	disk;
+    FileSystem	fs;
+    std::mutex	global;
+
+    // room for every file plus its indirect block
+    size_t blocks = threads * (FILE_SIZE / Disk::BLOCK_SIZE + 2) * 10 / 8 + 64;
+    disk.open(path, blocks);
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    double start = now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+    	workers.push_back(std::thread(worker, std::ref(fs), serialize ? &global : NULL));
+    for (auto &w : workers)
+    	w.join();
+    fs.sync();
+    double seconds = now() - start;
+
+    printf("%-12s %3lu threads %10.2f ms %10.1f MB/s\n", serialize ? "global lock" : "concurrent",
+    	threads, seconds * 1e3, threads * 3 * FILE_SIZE / seconds / (1 << 20));
+    fs.unmount();
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t maxThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+
+    char path[] = "/tmp/sfs.bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("each thread writes %lu bytes, then reads them twice, on %u cpus\n",
+    	FILE_SIZE, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+    	run(path, threads, true);
+    	run(path, threads, false);
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+// check_bigfile.cpp: Files reaching through every level of the block map
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// First logical block of each pointer tree, and of a second pointer block
+// inside the double and triple indirect trees
+const size_t SINGLE = FileSystem::POINTERS_PER_INODE;
+const size_t DOUBLE = SINGLE + FileSystem::POINTERS_PER_BLOCK;
+const size_t TRIPLE = DOUBLE + FileSystem::POINTERS_PER_BLOCK * FileSystem::POINTERS_PER_BLOCK;
+const size_t LARGEST = TRIPLE + (size_t)FileSystem::POINTERS_PER_BLOCK * FileSystem::POINTERS_PER_BLOCK * FileSystem::POINTERS_PER_BLOCK;
+
+const size_t BOUNDARIES[] = {
+    SINGLE, DOUBLE, DOUBLE + FileSystem::POINTERS_PER_BLOCK, TRIPLE,
+    TRIPLE + FileSystem::POINTERS_PER_BLOCK * FileSystem::POINTERS_PER_BLOCK,
+    LARGEST - 1,
+};
+
+// Sparse file written across a boundary
+struct File {
+    ssize_t	      Inumber;
+    size_t	      Offset;
+    std::vector<char> Data;
+};
+
+static size_t Failures = 0;
+
+static void fail(const char *what, ssize_t inumber) {
+    fprintf(stderr, "%s (inode %ld)\n", what, inumber);
+    Failures++;
+}
+
+// Compare written range against its shadow
+static void verify(FileSystem &fs, const File &file) {
+    std::vector<char> data(file.Data.size());
+    if (fs.read(file.Inumber, data.data(), data.size(), file.Offset) != (ssize_t)data.size() || data != file.Data)
+    	fail("read back differs", file.Inumber);
+    if (fs.stat(file.Inumber) != (ssize_t)(file.Offset + file.Data.size()))
+    	fail("size differs", file.Inumber);
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t blocks = 1000;
+
+    char temp[] = "/tmp/sfs.bigfile.XXXXXX";
+    const char *path = argc > 1 ? argv[1] : temp;
+    if (argc <= 1) {
+    	int fd = mkstemp(temp);
+    	if (fd < 0) {
+    	    perror("mkstemp");
+    	    return EXIT_FAILURE;
+    	}
+    	close(fd);
+    }
+
+    std::vector<File> files;
+    size_t freeBlocks;
+    {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(path, blocks);
+    	FileSystem::format(&disk);
+    	fs.mount(&disk);
+    	freeBlocks = fs.free_blocks();
+
+    	// half a block on either side of the boundary, plus one more block
+    	for (size_t boundary : BOUNDARIES) {
+    	    File file;
+    	    file.Inumber = fs.create();
+    	    file.Offset = boundary * Disk::BLOCK_SIZE - Disk::BLOCK_SIZE / 2;
+    	    file.Data.resize(boundary == LARGEST - 1 ? Disk::BLOCK_SIZE : 2 * Disk::BLOCK_SIZE);
+    	    for (size_t i = 0; i < file.Data.size(); i++)
+    	    	file.Data[i] = boundary * 7 + i;
+
+    	    if (fs.write(file.Inumber, file.Data.data(), file.Data.size(), file.Offset) != (ssize_t)file.Data.size())
+    	    	fail("write across boundary failed", file.Inumber);
+    	    verify(fs, file);
+    	    files.push_back(file);
+    	}
+
+    	// nothing maps blocks past the triple indirect tree
+    	ssize_t inumber = fs.create();
+    	char block[Disk::BLOCK_SIZE] = {0};
+    	if (fs.write(inumber, block, sizeof(block), LARGEST * Disk::BLOCK_SIZE) != -1 || fs.stat(inumber) != 0)
+    	    fail("write past largest file succeeded", inumber);
+    	fs.remove(inumber);
+
+    	if (!fs.check())
+    	    fail("bitmaps inconsistent after writes", -1);
+    }
+
+    // everything must survive a remount, and removing it frees every block
+    {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(path, blocks);
+    	if (!fs.mount(&disk))
+    	    fail("remount failed", -1);
+    	else if (!fs.check())
+    	    fail("bitmaps inconsistent after remount", -1);
+
+    	for (auto &file : files) {
+    	    verify(fs, file);
+    	    if (!fs.remove(file.Inumber))
+    	    	fail("remove failed", file.Inumber);
+    	}
+
+    	if (fs.free_blocks() != freeBlocks)
+    	    fail("blocks leaked by remove", -1);
+    	if (!fs.check())
+    	    fail("bitmaps inconsistent after remove", -1);
+    }
+
+    if (argc <= 1)
+    	unlink(path);
+    printf("%lu boundaries up to logical block %lu: %lu failures\n", files.size(), LARGEST - 1, Failures);
+    return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
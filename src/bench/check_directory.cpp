@@ -0,0 +1,140 @@
+// check_directory.cpp: Hashed directories keep every name through splits and unlinks
+
+#include "sfs/directory.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Enough names to split the table through several levels and chain overflows
+const size_t NAMES = 20000;
+
+static size_t Failures = 0;
+
+static void fail(const char *what, const std::string &name) {
+    fprintf(stderr, "%s (%s)\n", what, name.c_str());
+    Failures++;
+}
+
+// Compare lookups and readdir against the shadow
+static void verify(FileSystem &fs, size_t inumber, const std::map<std::string, size_t> &shadow) {
+    Directory directory(&fs, inumber);
+
+    for (size_t i = 0; i < NAMES; i++) {
+    	std::string name = "name-" + std::to_string(i);
+    	auto it = shadow.find(name);
+    	ssize_t found = directory.lookup(name);
+    	if (it == shadow.end() ? found != -1 : found != (ssize_t)it->second)
+    	    fail("lookup differs", name);
+    }
+
+    std::vector<Directory::Entry> entries;
+    if (!directory.readdir(&entries) || entries.size() != shadow.size() || directory.size() != (ssize_t)shadow.size())
+    	fail("readdir count differs", "");
+
+    std::map<std::string, size_t> listed;
+    for (auto &entry : entries)
+    	listed[std::string(entry.Name, entry.Length)] = entry.Inumber;
+    if (listed != shadow)
+    	fail("readdir entries differ", "");
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t blocks = 4000;
+
+    char temp[] = "/tmp/sfs.directory.XXXXXX";
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    std::map<std::string, size_t> shadow;
+    {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(temp, blocks);
+    	FileSystem::format(&disk);
+    	fs.mount(&disk);
+    	fs.set_group_commit(0);
+
+    	ssize_t root = Directory::root(&fs);
+    	ssize_t sub  = Directory::create(&fs);
+    	Directory directory(&fs, sub);
+    	if (root < 0 || sub < 0 || !Directory(&fs, root).link("sub", sub, Directory::DIRECTORY_ENTRY))
+    	    fail("root directory failed", "");
+
+    	// a few files, each linked under many names
+    	std::vector<ssize_t> files;
+    	for (size_t i = 0; i < 8; i++)
+    	    files.push_back(fs.create());
+
+    	for (size_t i = 0; i < NAMES; i++) {
+    	    std::string name = "name-" + std::to_string(i);
+    	    size_t inumber = files[i % files.size()];
+    	    if (!directory.link(name, inumber, Directory::FILE_ENTRY))
+    	    	fail("link failed", name);
+    	    shadow[name] = inumber;
+    	}
+
+    	if (directory.link("name-0", files[0], Directory::FILE_ENTRY))
+    	    fail("duplicate link succeeded", "name-0");
+    	if (directory.link("a/b", files[0], Directory::FILE_ENTRY) || directory.link(std::string(Directory::NAME_LENGTH + 1, 'x'), files[0], Directory::FILE_ENTRY))
+    	    fail("invalid name linked", "a/b");
+
+    	verify(fs, sub, shadow);
+
+    	// unlinking every other name empties and frees overflow blocks
+    	for (size_t i = 0; i < NAMES; i += 2) {
+    	    std::string name = "name-" + std::to_string(i);
+    	    if (!directory.unlink(name))
+    	    	fail("unlink failed", name);
+    	    shadow.erase(name);
+    	}
+    	if (directory.unlink("name-0"))
+    	    fail("second unlink succeeded", "name-0");
+
+    	verify(fs, sub, shadow);
+
+    	if (Directory::resolve(&fs, "/sub//name-1") != files[1] || Directory::resolve(&fs, "/sub/name-0") != -1 ||
+    	    Directory::resolve(&fs, "/sub/name-1/x") != -1)
+    	    fail("resolve differs", "/sub/name-1");
+
+    	fs.unmount();
+    }
+
+    // the root and every name survive a remount
+    {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(temp, blocks);
+    	if (!fs.mount(&disk)) {
+    	    fail("mount failed", temp);
+    	} else {
+    	    Directory::Type type;
+    	    ssize_t sub = Directory::resolve(&fs, "sub", &type);
+    	    if (sub < 0 || type != Directory::DIRECTORY_ENTRY)
+    	    	fail("root directory lost", "sub");
+    	    else
+    	    	verify(fs, sub, shadow);
+
+    	    if (!fs.check())
+    	    	fail("bitmaps inconsistent", temp);
+    	}
+    }
+
+    unlink(temp);
+    printf("%lu names linked and half unlinked: %lu failures\n", NAMES, Failures);
+    return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+// check_journal.cpp: Images left behind at a crash are repaired by replay
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Blocks per file, enough to need an indirect pointer block
+const size_t FILE_BLOCKS = 20;
+
+// File expected in an image
+struct File {
+    ssize_t	      Inumber;
+    std::vector<char> Data;
+};
+
+static size_t Failures = 0;
+
+static void fail(const char *what, const std::string &image) {
+    fprintf(stderr, "%s (%s)\n", what, image.c_str());
+    Failures++;
+}
+
+static File write_file(FileSystem &fs, char seed) {
+    File file;
+    file.Inumber = fs.create();
+    file.Data.resize(FILE_BLOCKS * Disk::BLOCK_SIZE);
+    for (size_t i = 0; i < file.Data.size(); i++)
+    	file.Data[i] = seed + i % 251;
+
+    fs.write(file.Inumber, file.Data.data(), file.Data.size(), 0);
+    return file;
+}
+
+// Copy disk image as it is on disk right now, as if the machine stopped here
+static void snapshot(const std::string &from, const std::string &to) {
+    FILE *in  = fopen(from.c_str(), "r");
+    FILE *out = fopen(to.c_str(), "w");
+    char buffer[BUFSIZ];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    	fwrite(buffer, 1, n, out);
+    fclose(in);
+    fclose(out);
+}
+
+// Corrupt the newest commit record, as if its write was torn
+static void tear(const std::string &image, size_t blocks) {
+    FILE *stream = fopen(image.c_str(), "r+");
+    uint32_t record[4];
+    long newest = -1;
+    uint32_t sequence = 0;
+    for (size_t b = 0; b < blocks; b++) {
+    	fseek(stream, b * Disk::BLOCK_SIZE, SEEK_SET);
+    	if (fread(record, sizeof(record), 1, stream) == 1
+    	&& record[0] == FileSystem::JOURNAL_MAGIC && record[1] == 3 && record[3] >= sequence) {
+    	    newest = b;
+    	    sequence = record[3];
+    	}
+    }
+
+    if (newest >= 0) {
+    	uint32_t garbage = 0xdeadbeef;
+    	fseek(stream, newest * Disk::BLOCK_SIZE + 6 * sizeof(uint32_t), SEEK_SET);
+    	fwrite(&garbage, sizeof(garbage), 1, stream);
+    }
+    fclose(stream);
+}
+
+// Mount crashed image, then check that exactly the expected files are there
+static void verify(const std::string &image, size_t blocks, const std::vector<File> &files, size_t freeBlocks) {
+    for (int pass = 0; pass < 2; pass++) {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(image.c_str(), blocks);
+    	if (!fs.mount(&disk)) {
+    	    fail("mount failed", image);
+    	    return;
+    	}
+
+    	for (auto &file : files) {
+    	    std::vector<char> data(file.Data.size());
+    	    if (fs.stat(file.Inumber) != (ssize_t)data.size()
+    	    || fs.read(file.Inumber, data.data(), data.size(), 0) != (ssize_t)data.size()
+    	    || data != file.Data)
+    	    	fail("file differs", image);
+    	}
+
+    	if (fs.free_blocks() != freeBlocks)
+    	    fail("free blocks differ", image);
+    	if (!fs.check())
+    	    fail("bitmaps inconsistent", image);
+    }
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t blocks = 2000;
+
+    char temp[] = "/tmp/sfs.journal.XXXXXX";
+    std::string path = argc > 1 ? argv[1] : temp;
+    if (argc <= 1) {
+    	int fd = mkstemp(temp);
+    	if (fd < 0) {
+    	    perror("mkstemp");
+    	    return EXIT_FAILURE;
+    	}
+    	close(fd);
+    	path = temp;
+    }
+
+    std::string first = path + ".first", second = path + ".second", torn = path + ".torn";
+    std::vector<File> committed, latest;
+    size_t firstFree, secondFree;
+    {
+    	Disk disk;
+    	FileSystem fs;
+
+    	disk.open(path.c_str(), blocks);
+    	FileSystem::format(&disk);
+    	fs.mount(&disk);
+    	fs.set_group_commit(0);
+
+    	// first transaction creates two files
+    	committed.push_back(write_file(fs, 'a'));
+    	committed.push_back(write_file(fs, 'b'));
+    	fs.sync();
+    	firstFree = fs.free_blocks();
+    	snapshot(path, first);
+
+    	// second one frees a file, pointer block included, and reuses its space
+    	fs.remove(committed[0].Inumber);
+    	latest.push_back(committed[1]);
+    	latest.push_back(write_file(fs, 'c'));
+    	fs.sync();
+    	secondFree = fs.free_blocks();
+    	snapshot(path, second);
+    	snapshot(path, torn);
+
+    	if (fs.checkpoints() != 0)
+    	    fail("journal checkpointed before unmount", path);
+
+    	// operations after the last commit are lost in a crash
+    	write_file(fs, 'd');
+    	fs.unmount();
+    }
+
+    if (!Failures) {
+    	tear(torn, blocks);
+    	verify(first, blocks, committed, firstFree);
+    	verify(second, blocks, latest, secondFree);
+    	verify(torn, blocks, committed, firstFree);
+    }
+
+    unlink(first.c_str());
+    unlink(second.c_str());
+    unlink(torn.c_str());
+    if (argc <= 1)
+    	unlink(path.c_str());
+    printf("3 crashed images replayed: %lu failures\n", Failures);
+    return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+// bench.cpp: Timing and measurement helpers shared by the benchmarks
+
+#include "bench.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double percentile(const std::vector<double> &sorted, size_t percent) {
+    if (sorted.empty())
+    	return 0;
+    return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+void evict(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    	return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
@@ -0,0 +1,20 @@
+// bench.h: Timing and measurement helpers shared by the benchmarks
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+// Return seconds elapsed on a monotonic clock
+double now();
+
+// Return the sample below which percent of the samples fall, 0 if none
+// @param	sorted	    Samples in ascending order
+// @param	percent	    Percentage between 0 and 100
+double percentile(const std::vector<double> &sorted, size_t percent);
+
+// Drop a file from the page cache so reads reach the device
+// @param	path	    Path to file
+void evict(const std::string &path);
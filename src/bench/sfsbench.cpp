@@ -0,0 +1,387 @@
+// sfsbench.cpp: Benchmarks of every file system operation
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Defaults, changed with command line options
+static size_t Operations = 2000;	// operations per random, churn and mixed run
+static size_t FileBytes  = 16 << 20;	// size of the file sequential runs go through
+static size_t Repeats    = 5;		// formats and mounts per image size
+static bool   Csv	 = false;	// print comma separated values
+static const char *Path  = NULL;	// disk image
+
+// I/O sizes of sequential and random runs
+const size_t SEQUENTIAL_SIZES[] = {512, 4096, 65536, 1 << 20};
+const size_t RANDOM_SIZES[]	= {512, 4096, 65536};
+
+// Image sizes formatted and mounted, in blocks
+const size_t IMAGE_SIZES[]	= {1024, 16384, 131072};
+
+// Timing helpers
+
+// Measurement of one run
+class Run {
+public:
+    Run(const char *name, const std::string &variant, Disk &disk)
+    	: name(name), variant(variant), disk(disk), bytes(0) {
+    	reads  = disk.reads();
+    	writes = disk.writes();
+    	start  = now();
+    }
+
+    // Time one operation moving bytes
+    void time(std::function<void()> operation, size_t moved = 0) {
+    	double begin = now();
+    	operation();
+    	latencies.push_back(now() - begin);
+    	bytes += moved;
+    }
+
+    // Print result, time spent since the last operation (such as a final
+    // sync) counts towards throughput but not latency
+    void report() {
+    	double seconds = now() - start;
+    	size_t count = latencies.size();
+    	std::sort(latencies.begin(), latencies.end());
+    	double p50 = percentile(latencies, 50);
+    	double p99 = percentile(latencies, 99);
+    	double perOp = count ? count : 1;
+
+    	printf(Csv ? "%s,%s,%lu,%.6f,%.1f,%.2f,%.2f,%.2f,%.3f,%.3f\n"
+    	    : "%-10s %-14s %8lu %10.3f %12.1f %10.2f %10.2f %10.2f %10.3f %10.3f\n",
+    	    name, variant.c_str(), count, seconds, count / seconds, bytes / seconds / (1 << 20),
+    	    p50 * 1e6, p99 * 1e6, (disk.reads() - reads) / perOp, (disk.writes() - writes) / perOp);
+    	fflush(stdout);
+    }
+
+private:
+    const char	       *name;
+    std::string		variant;
+    Disk	       &disk;
+    size_t		reads, writes, bytes;
+    double		start;
+    std::vector<double> latencies;
+};
+
+static std::string size_name(size_t bytes) {
+    char buffer[32];
+    if (bytes >= (1 << 20) && bytes % (1 << 20) == 0)
+    	snprintf(buffer, sizeof(buffer), "%luM", bytes >> 20);
+    else if (bytes >= 1024 && bytes % 1024 == 0)
+    	snprintf(buffer, sizeof(buffer), "%luK", bytes >> 10);
+    else
+    	snprintf(buffer, sizeof(buffer), "%lu", bytes);
+    return buffer;
+}
+
+// Blocks needed for bytes of file data plus pointer blocks and metadata
+static size_t image_blocks(size_t bytes) {
+    return bytes / Disk::BLOCK_SIZE * 5 / 4 + 4096;
+}
+
+// Open the image without the disk printing its counters on close, every
+// run reports them per operation instead
+static void open_image(Disk &disk, size_t blocks) {
+    disk.set_report(false);
+    disk.open(Path, blocks);
+}
+
+// Benchmarks
+
+// Create empty files, then remove them again
+static void bench_churn() {
+    Disk disk;
+    FileSystem fs;
+    open_image(disk, image_blocks(0));
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<ssize_t> inumbers;
+    {
+    	Run run("create", "empty", disk);
+    	for (size_t i = 0; i < Operations; i++)
+    	    run.time([&]() { inumbers.push_back(fs.create()); });
+    	fs.sync();
+    	run.report();
+    }
+    {
+    	Run run("remove", "empty", disk);
+    	for (auto inumber : inumbers)
+    	    run.time([&]() { fs.remove(inumber); });
+    	fs.sync();
+    	run.report();
+    }
+
+    // each file gets a block, so remove has something to free
+    {
+    	char block[Disk::BLOCK_SIZE] = {0};
+    	Run run("churn", "4K", disk);
+    	for (size_t i = 0; i < Operations; i++) {
+    	    run.time([&]() {
+    	    	ssize_t inumber = fs.create();
+    	    	fs.write(inumber, block, sizeof(block), 0);
+    	    	fs.remove(inumber);
+    	    }, sizeof(block));
+    	}
+    	fs.sync();
+    	run.report();
+    }
+    fs.unmount();
+}
+
+// Write a file front to back, then read it back with a cold cache
+static void bench_sequential() {
+    for (size_t size : SEQUENTIAL_SIZES) {
+    	Disk disk;
+    	FileSystem fs;
+    	open_image(disk, image_blocks(FileBytes));
+    	FileSystem::format(&disk);
+    	fs.mount(&disk);
+
+    	std::vector<char> buffer(size, 'x');
+    	ssize_t inumber = fs.create();
+    	{
+    	    Run run("seqwrite", size_name(size), disk);
+    	    for (size_t offset = 0; offset < FileBytes; offset += size)
+    	    	run.time([&]() { fs.write(inumber, buffer.data(), size, offset); }, size);
+    	    fs.sync();
+    	    run.report();
+    	}
+
+    	fs.unmount();
+    	fs.mount(&disk);
+    	{
+    	    Run run("seqread", size_name(size), disk);
+    	    for (size_t offset = 0; offset < FileBytes; offset += size)
+    	    	run.time([&]() { fs.read(inumber, buffer.data(), size, offset); }, size);
+    	    run.report();
+    	}
+    	fs.unmount();
+    }
+}
+
+// Read and overwrite random parts of a file, at offsets aligned to the I/O
+// size and at arbitrary byte offsets
+static void bench_random() {
+    Disk disk;
+    FileSystem fs;
+    open_image(disk, image_blocks(FileBytes));
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<char> buffer(1 << 20, 'x');
+    ssize_t inumber = fs.create();
+    for (size_t offset = 0; offset < FileBytes; offset += buffer.size())
+    	fs.write(inumber, buffer.data(), buffer.size(), offset);
+    fs.sync();
+
+    std::mt19937_64 random(42);
+    for (size_t size : RANDOM_SIZES) {
+    	for (bool aligned : {true, false}) {
+    	    std::string variant = size_name(size) + (aligned ? "" : "+unaligned");
+    	    auto offset = [&]() {
+    	    	size_t value = random() % (FileBytes - size);
+    	    	return aligned ? value / size * size : value;
+    	    };
+
+    	    fs.unmount();
+    	    fs.mount(&disk);
+    	    {
+    	    	Run run("randread", variant, disk);
+    	    	for (size_t i = 0; i < Operations; i++) {
+    	    	    size_t at = offset();
+    	    	    run.time([&]() { fs.read(inumber, buffer.data(), size, at); }, size);
+    	    	}
+    	    	run.report();
+    	    }
+    	    {
+    	    	Run run("randwrite", variant, disk);
+    	    	for (size_t i = 0; i < Operations; i++) {
+    	    	    size_t at = offset();
+    	    	    run.time([&]() { fs.write(inumber, buffer.data(), size, at); }, size);
+    	    	}
+    	    	fs.sync();
+    	    	run.report();
+    	    }
+    	}
+    }
+    fs.unmount();
+}
+
+// Format and mount images of several sizes
+static void bench_mount() {
+    for (size_t blocks : IMAGE_SIZES) {
+    	Disk disk;
+    	FileSystem fs;
+    	open_image(disk, blocks);
+    	std::string variant = std::to_string(blocks) + " blocks";
+
+    	{
+    	    Run run("format", variant, disk);
+    	    for (size_t i = 0; i < Repeats; i++)
+    	    	run.time([&]() { FileSystem::format(&disk); });
+    	    run.report();
+    	}
+
+    	// a few files so mount has bitmaps and inodes to load
+    	fs.mount(&disk);
+    	char block[Disk::BLOCK_SIZE] = {0};
+    	for (size_t i = 0; i < 64; i++)
+    	    fs.write(fs.create(), block, sizeof(block), 0);
+    	fs.unmount();
+
+    	{
+    	    Run run("mount", variant, disk);
+    	    for (size_t i = 0; i < Repeats; i++) {
+    	    	run.time([&]() { fs.mount(&disk); });
+    	    	fs.unmount();
+    	    }
+    	    run.report();
+    	}
+    }
+}
+
+// Small reads and writes over many files, with files coming and going
+static void bench_mixed() {
+    const size_t FILES = 64, FILE_SIZE = 64 << 10, IO_SIZE = 4096;
+
+    Disk disk;
+    FileSystem fs;
+    open_image(disk, image_blocks(2 * FILES * FILE_SIZE));
+    FileSystem::format(&disk);
+    fs.mount(&disk);
+
+    std::vector<char> buffer(FILE_SIZE, 'x');
+    std::vector<ssize_t> files;
+    for (size_t i = 0; i < FILES; i++) {
+    	files.push_back(fs.create());
+    	fs.write(files.back(), buffer.data(), FILE_SIZE, 0);
+    }
+    fs.sync();
+
+    // 60% reads, 25% writes, 15% replacing a whole file
+    std::mt19937_64 random(42);
+    Run run("mixed", "60r/25w/15c", disk);
+    for (size_t i = 0; i < Operations; i++) {
+    	size_t pick = random() % 100;
+    	ssize_t &file = files[random() % FILES];
+    	size_t at = random() % (FILE_SIZE / IO_SIZE) * IO_SIZE;
+
+    	if (pick < 60) {
+    	    run.time([&]() { fs.read(file, buffer.data(), IO_SIZE, at); }, IO_SIZE);
+    	} else if (pick < 85) {
+    	    run.time([&]() { fs.write(file, buffer.data(), IO_SIZE, at); }, IO_SIZE);
+    	} else {
+    	    run.time([&]() {
+    	    	fs.remove(file);
+    	    	file = fs.create();
+    	    	fs.write(file, buffer.data(), FILE_SIZE, 0);
+    	    }, FILE_SIZE);
+    	}
+    }
+    fs.sync();
+    run.report();
+    fs.unmount();
+}
+
+// Main execution
+
+struct Benchmark {
+    const char *Name;
+    void      (*Function)();
+};
+
+const Benchmark BENCHMARKS[] = {
+    {"churn",	   bench_churn},
+    {"sequential", bench_sequential},
+    {"random",	   bench_random},
+    {"mount",	   bench_mount},
+    {"mixed",	   bench_mixed},
+};
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-c] [-n operations] [-m megabytes] [-r repeats] [-f image] [benchmark ...]\n", program);
+    fprintf(stderr, "Benchmarks:");
+    for (auto &benchmark : BENCHMARKS)
+    	fprintf(stderr, " %s", benchmark.Name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "cn:m:r:f:")) != -1) {
+    	switch (option) {
+    	    case 'c':
+    	    	Csv = true;
+    	    	break;
+    	    case 'n':
+    	    	Operations = std::max(1UL, strtoul(optarg, NULL, 10));
+    	    	break;
+    	    case 'm':
+    	    	FileBytes = std::max(2UL, strtoul(optarg, NULL, 10)) << 20;
+    	    	break;
+    	    case 'r':
+    	    	Repeats = std::max(1UL, strtoul(optarg, NULL, 10));
+    	    	break;
+    	    case 'f':
+    	    	Path = optarg;
+    	    	break;
+    	    default:
+    	    	usage(argv[0]);
+    	    	return EXIT_FAILURE;
+    	}
+    }
+
+    std::vector<const Benchmark *> selected;
+    for (int i = optind; i < argc; i++) {
+    	const Benchmark *found = NULL;
+    	for (auto &benchmark : BENCHMARKS) {
+    	    if (strcmp(argv[i], benchmark.Name) == 0)
+    	    	found = &benchmark;
+    	}
+    	if (found == NULL) {
+    	    usage(argv[0]);
+    	    return EXIT_FAILURE;
+    	}
+    	selected.push_back(found);
+    }
+    if (selected.empty()) {
+    	for (auto &benchmark : BENCHMARKS)
+    	    selected.push_back(&benchmark);
+    }
+
+    char temp[] = "/tmp/sfs.bench.XXXXXX";
+    if (Path == NULL) {
+    	int fd = mkstemp(temp);
+    	if (fd < 0) {
+    	    perror("mkstemp");
+    	    return EXIT_FAILURE;
+    	}
+    	close(fd);
+    	Path = temp;
+    }
+
+    if (Csv)
+    	printf("benchmark,variant,ops,seconds,ops_per_s,mb_per_s,p50_us,p99_us,reads_per_op,writes_per_op\n");
+    else
+    	printf("%-10s %-14s %8s %10s %12s %10s %10s %10s %10s %10s\n",
+    	    "benchmark", "variant", "ops", "seconds", "ops/s", "MB/s", "p50 us", "p99 us", "reads/op", "writes/op");
+    for (auto benchmark : selected)
+    	benchmark->Function();
+
+    if (Path == temp)
+    	unlink(temp);
+    return EXIT_SUCCESS;
+}
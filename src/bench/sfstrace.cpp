@@ -0,0 +1,348 @@
+// sfstrace.cpp: Summarize, simulate and replay block access traces
+
+#include "common/bench.h"
+#include "sfs/disk.h"
+#include "sfs/stats.h"
+#include "sfs/tracer.h"
+
+#include <algorithm>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef std::vector<Tracer::Record> Trace;
+
+// Cache sizes simulated by default, in blocks
+const size_t CACHE_SIZES[] = {16, 64, 256, 1024, 4096};
+
+// First read-ahead window, doubled while reads stay sequential
+const size_t READAHEAD_MIN = 4;
+
+// Helpers
+
+static const char *type_name(uint8_t type) {
+    return type < Stats::BLOCK_TYPES ? Stats::name((Stats::BlockType)type) : "-";
+}
+
+// Summary ---------------------------------------------------------------------
+
+static void info(const Trace &trace) {
+    size_t records[Tracer::OPS][Stats::BLOCK_TYPES + 1] = {{0}};
+    size_t blocks[Tracer::OPS][Stats::BLOCK_TYPES + 1]  = {{0}};
+    std::unordered_set<uint32_t> touched;
+
+    for (auto &record : trace) {
+    	if (record.Op >= Tracer::OPS || record.Type > Stats::BLOCK_TYPES)
+    	    continue;
+    	records[record.Op][record.Type]++;
+    	blocks[record.Op][record.Type] += record.Count;
+    	if (record.Op == Tracer::READ || record.Op == Tracer::WRITE) {
+    	    for (size_t b = 0; b < record.Count; b++)
+    	    	touched.insert(record.Block + b);
+    	}
+    }
+
+    double seconds = trace.empty() ? 0 : trace.back().Time / 1e9;
+    printf("%lu records over %.3f seconds\n", trace.size(), seconds);
+    printf("%lu distinct blocks accessed by the file system\n", touched.size());
+    printf("    %-10s %-8s %10s %10s\n", "op", "type", "records", "blocks");
+    for (int op = 0; op < Tracer::OPS; op++) {
+    	for (int type = 0; type <= Stats::BLOCK_TYPES; type++) {
+    	    if (records[op][type])
+    	    	printf("    %-10s %-8s %10lu %10lu\n", Tracer::name((Tracer::Op)op), type_name(type),
+    	    	    records[op][type], blocks[op][type]);
+    	}
+    }
+}
+
+// Cache simulation ------------------------------------------------------------
+
+// Write-back LRU cache fed with the file system's block accesses, with
+// read-ahead of blocks following sequential data reads
+class Simulation {
+public:
+    Simulation(size_t capacity, size_t window)
+    	: capacity(capacity), maxWindow(window), window(0), next(0),
+    	  diskReads(0), diskWrites(0), prefetches(0), prefetchHits(0), prefetchWasted(0) {
+    	for (int t = 0; t < Stats::BLOCK_TYPES; t++)
+    	    reads[t] = hits[t] = 0;
+    }
+
+    void run(const Trace &trace) {
+    	for (auto &record : trace) {
+    	    if (record.Op != Tracer::READ && record.Op != Tracer::WRITE)
+    	    	continue;
+    	    uint8_t type = std::min<uint8_t>(record.Type, Stats::DATA_BLOCK);
+
+    	    for (size_t b = 0; b < record.Count; b++) {
+    	    	if (record.Op == Tracer::READ)
+    	    	    read(record.Block + b, type);
+    	    	else
+    	    	    write(record.Block + b);
+    	    }
+
+    	    if (record.Op == Tracer::READ && type == Stats::DATA_BLOCK)
+    	    	read_ahead(record.Block, record.Count);
+    	}
+
+    	// what is left dirty is written back eventually
+    	for (auto &entry : lru) {
+    	    if (entry.Dirty)
+    	    	diskWrites++;
+    	    if (entry.Prefetched)
+    	    	prefetchWasted++;
+    	}
+    }
+
+    void report(bool header) {
+    	if (header) {
+    	    printf("%8s %8s %10s %7s", "cache", "window", "reads", "hits");
+    	    for (int t = 0; t < Stats::BLOCK_TYPES; t++)
+    	    	printf(" %8s", Stats::name((Stats::BlockType)t));
+    	    printf(" %10s %10s %10s %10s %10s\n", "disk reads", "disk writes", "ahead", "ahead hits", "wasted");
+    	}
+
+    	size_t allReads = 0, allHits = 0;
+    	for (int t = 0; t < Stats::BLOCK_TYPES; t++) {
+    	    allReads += reads[t];
+    	    allHits  += hits[t];
+    	}
+
+    	printf("%8lu %8lu %10lu %6.1f%%", capacity, maxWindow, allReads, percent(allHits, allReads));
+    	for (int t = 0; t < Stats::BLOCK_TYPES; t++) {
+    	    if (reads[t])
+    	    	printf(" %7.1f%%", percent(hits[t], reads[t]));
+    	    else
+    	    	printf(" %8s", "-");
+    	}
+    	printf(" %10lu %10lu %10lu %10lu %10lu\n", diskReads, diskWrites, prefetches, prefetchHits, prefetchWasted);
+    }
+
+private:
+    struct Entry {
+    	uint32_t Block;
+    	bool	 Dirty;
+    	bool	 Prefetched;
+    };
+
+    static double percent(size_t part, size_t whole) { return whole ? 100.0 * part / whole : 0; }
+
+    Entry *lookup(uint32_t block) {
+    	auto it = map.find(block);
+    	if (it == map.end())
+    	    return NULL;
+    	lru.splice(lru.begin(), lru, it->second);
+    	return &lru.front();
+    }
+
+    Entry *insert(uint32_t block) {
+    	while (map.size() >= capacity) {
+    	    Entry &victim = lru.back();
+    	    if (victim.Dirty)
+    	    	diskWrites++;
+    	    if (victim.Prefetched)
+    	    	prefetchWasted++;
+    	    map.erase(victim.Block);
+    	    lru.pop_back();
+    	}
+
+    	lru.push_front({block, false, false});
+    	map[block] = lru.begin();
+    	return &lru.front();
+    }
+
+    void read(uint32_t block, uint8_t type) {
+    	reads[type]++;
+    	Entry *entry = lookup(block);
+    	if (entry != NULL) {
+    	    hits[type]++;
+    	    if (entry->Prefetched) {
+    	    	entry->Prefetched = false;
+    	    	prefetchHits++;
+    	    }
+    	    return;
+    	}
+
+    	diskReads++;
+    	insert(block);
+    }
+
+    void write(uint32_t block) {
+    	// whole block is overwritten, so a miss never reads the disk
+    	Entry *entry = lookup(block);
+    	if (entry == NULL)
+    	    entry = insert(block);
+    	entry->Dirty = true;
+    	entry->Prefetched = false;
+    }
+
+    void read_ahead(uint32_t block, size_t count) {
+    	if (maxWindow == 0)
+    	    return;
+
+    	// the window grows while reads continue where the last one ended,
+    	// and never covers more than half the cache
+    	bool sequential = block == next;
+    	next = block + count;
+    	if (!sequential) {
+    	    window = 0;
+    	    return;
+    	}
+    	window = std::min(std::max(window * 2, READAHEAD_MIN), std::min(maxWindow, capacity / 2));
+
+    	for (size_t b = next; b < next + window; b++) {
+    	    if (map.count(b))
+    	    	continue;
+    	    insert(b)->Prefetched = true;
+    	    diskReads++;
+    	    prefetches++;
+    	}
+    }
+
+    size_t capacity, maxWindow, window;
+    uint32_t next;
+    size_t reads[Stats::BLOCK_TYPES], hits[Stats::BLOCK_TYPES];
+    size_t diskReads, diskWrites, prefetches, prefetchHits, prefetchWasted;
+    std::list<Entry> lru;
+    std::unordered_map<uint32_t, std::list<Entry>::iterator> map;
+};
+
+static void simulate(const Trace &trace, const std::vector<size_t> &sizes, size_t window) {
+    size_t recorded = 0;
+    for (auto &record : trace) {
+    	if (record.Op == Tracer::DISK_READ)
+    	    recorded += record.Count;
+    }
+    printf("%lu disk block reads recorded\n", recorded);
+
+    bool header = true;
+    for (size_t size : sizes) {
+    	for (size_t w : {(size_t)0, window}) {
+    	    Simulation simulation(size, w);
+    	    simulation.run(trace);
+    	    simulation.report(header);
+    	    header = false;
+    	    if (window == 0)
+    	    	break;
+    	}
+    }
+}
+
+// Replay ----------------------------------------------------------------------
+
+static void replay(const Trace &trace, const char *path) {
+    // image just big enough for every block the trace touches
+    size_t blocks = 1;
+    for (auto &record : trace) {
+    	if (record.Op >= Tracer::DISK_READ && record.Op <= Tracer::DISK_ZERO)
+    	    blocks = std::max(blocks, (size_t)record.Block + record.Count);
+    }
+
+    if (truncate(path, 0) < 0 && errno != ENOENT)
+    	throw std::runtime_error(std::string("Unable to truncate ") + path + ": " + strerror(errno));
+
+    Disk disk;
+    disk.open(path, blocks);
+
+    std::vector<char> buffer(Disk::BLOCK_SIZE * UINT16_MAX, 'x');
+    size_t operations = 0, syncs = 0;
+    double start = now();
+    for (auto &record : trace) {
+    	switch (record.Op) {
+    	    case Tracer::DISK_READ:
+    	    	disk.readv(record.Block, record.Count, buffer.data());
+    	    	break;
+    	    case Tracer::DISK_WRITE:
+    	    	disk.write(record.Block, buffer.data(), record.Count);
+    	    	break;
+    	    case Tracer::DISK_ZERO:
+    	    	disk.zero(record.Block, record.Count);
+    	    	break;
+    	    case Tracer::DISK_SYNC:
+    	    	disk.sync();
+    	    	syncs++;
+    	    	break;
+    	    default:
+    	    	continue;
+    	}
+    	operations++;
+    }
+    double seconds = now() - start;
+
+    double recorded = trace.empty() ? 0 : trace.back().Time / 1e9;
+    printf("replayed %lu disk operations on %lu blocks in %.3f seconds (recorded over %.3f)\n",
+    	operations, blocks, seconds, recorded);
+    printf("    %lu blocks read, %lu blocks written, %lu syncs, %.1f MB/s\n", disk.reads(), disk.writes(), syncs,
+    	(disk.reads() + disk.writes()) * Disk::BLOCK_SIZE / std::max(seconds, 1e-9) / (1 << 20));
+}
+
+// Main execution
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s info <trace>\n", program);
+    fprintf(stderr, "       %s simulate [-c blocks[,blocks...]] [-a window] <trace>\n", program);
+    fprintf(stderr, "       %s replay <trace> <image>    (image is overwritten)\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+    	usage(argv[0]);
+    	return EXIT_FAILURE;
+    }
+
+    const char *command = argv[1];
+    std::vector<size_t> sizes(std::begin(CACHE_SIZES), std::end(CACHE_SIZES));
+    size_t window = 32;
+
+    // options follow the command
+    optind = 2;
+    int option;
+    while ((option = getopt(argc, argv, "c:a:")) != -1) {
+    	switch (option) {
+    	    case 'c':
+    	    	sizes.clear();
+    	    	for (char *size = strtok(optarg, ","); size; size = strtok(NULL, ","))
+    	    	    sizes.push_back(std::max(1UL, strtoul(size, NULL, 10)));
+    	    	break;
+    	    case 'a':
+    	    	window = strtoul(optarg, NULL, 10);
+    	    	break;
+    	    default:
+    	    	usage(argv[0]);
+    	    	return EXIT_FAILURE;
+    	}
+    }
+
+    bool known = (strcmp(command, "info") == 0 && argc - optind == 1)
+    	|| (strcmp(command, "simulate") == 0 && argc - optind == 1)
+    	|| (strcmp(command, "replay") == 0 && argc - optind == 2);
+    if (!known) {
+    	usage(argv[0]);
+    	return EXIT_FAILURE;
+    }
+
+    try {
+    	Trace trace;
+    	Tracer::load(argv[optind], &trace);
+
+    	if (strcmp(command, "info") == 0)
+    	    info(trace);
+    	else if (strcmp(command, "simulate") == 0)
+    	    simulate(trace, sizes, window);
+    	else
+    	    replay(trace, argv[optind + 1]);
+    } catch (std::runtime_error &e) {
+    	fprintf(stderr, "%s\n", e.what());
+    	return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
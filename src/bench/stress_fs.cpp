@@ -0,0 +1,272 @@
+// stress_fs.cpp: Multithreaded file system stress test
+
+#include "sfs/async_disk.h"
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/mmap_disk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Files never grow past this many bytes
+const size_t MAX_SIZE  = 256 * 1024;
+
+// Largest single read or write
+const size_t MAX_CHUNK = 64 * 1024;
+
+// Size of the file whose reads always fail
+const size_t FAULTY_SIZE = 5 * Disk::BLOCK_SIZE;
+
+// Asynchronous disk whose queued reads of the blocks written while
+// recording fail, so each failure belongs to exactly one batch
+class FaultyDisk : public AsyncDisk {
+private:
+    bool    Recording;		    // Whether or not writes mark blocks as faulty
+    bool    Armed;		    // Whether or not reads of faulty blocks fail
+    int	    First;		    // First faulty block
+    int	    Last;		    // Last faulty block, below First if none
+    char   *Trap;		    // Read only buffer that reads are diverted into
+
+public:
+    FaultyDisk() : AsyncDisk(8), Recording(false), Armed(false), First(0), Last(-1) {
+    	Trap = (char *)mmap(NULL, MAX_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    	if (Trap == MAP_FAILED)
+    	    throw std::runtime_error("Unable to map trap buffer");
+    }
+
+    ~FaultyDisk() { munmap(Trap, MAX_SIZE); }
+
+    void record(bool recording) { Recording = recording; }
+    void arm(bool armed) { Armed = armed; }
+    size_t faulty() const { return Last - First + 1; }
+
+    void submit_read(int blocknum, char *data, size_t count, Batch *batch) {
+    	// the transfer into read only memory fails with EFAULT
+    	if (Armed && blocknum <= Last && blocknum + (int)count > First)
+    	    data = Trap;
+    	AsyncDisk::submit_read(blocknum, data, count, batch);
+    }
+
+    void submit_write(int blocknum, char *data, size_t count, Batch *batch) {
+    	if (Recording) {
+    	    First = Last < First ? blocknum : std::min(First, blocknum);
+    	    Last  = std::max(Last, blocknum + (int)count - 1);
+    	}
+    	AsyncDisk::submit_write(blocknum, data, count, batch);
+    }
+};
+
+// Shadow copy of a file owned by one thread
+struct File {
+    ssize_t	      Inumber;
+    std::vector<char> Data;
+};
+
+static std::atomic<size_t> Failures(0);
+
+static void fail(size_t thread, const char *what, ssize_t inumber) {
+    fprintf(stderr, "thread %lu: %s (inode %ld)\n", thread, what, inumber);
+    Failures++;
+}
+
+// Compare whole file against its shadow
+static void verify(FileSystem &fs, const File &file, size_t thread) {
+    std::vector<char> buffer(file.Data.size() + 1);
+
+    if (fs.stat(file.Inumber) != (ssize_t)file.Data.size())
+    	fail(thread, "size mismatch", file.Inumber);
+    else if (fs.read(file.Inumber, buffer.data(), buffer.size(), 0) != (ssize_t)file.Data.size() && !file.Data.empty())
+    	fail(thread, "short read", file.Inumber);
+    else if (!std::equal(file.Data.begin(), file.Data.end(), buffer.begin()))
+    	fail(thread, "data mismatch", file.Inumber);
+}
+
+// Random mix of operations on files owned by this thread
+static void worker(FileSystem &fs, size_t thread, size_t operations, std::vector<File> *files) {
+    unsigned seed = 1 + thread;
+    std::vector<char> buffer(MAX_CHUNK);
+
+    for (size_t i = 0; i < 2; i++)
+    	files->push_back({fs.create(), std::vector<char>()});
+
+    for (size_t op = 0; op < operations; op++) {
+    	File  &file   = (*files)[rand_r(&seed) % files->size()];
+    	size_t size   = file.Data.size();
+    	int    action = rand_r(&seed) % 100;
+
+    	if (action < 45) {
+    	    // overwrite or append, never leaving a hole
+    	    size_t offset = rand_r(&seed) % (size + 1);
+    	    size_t length = 1 + rand_r(&seed) % MAX_CHUNK;
+    	    length = std::min(length, MAX_SIZE - std::min(offset, MAX_SIZE));
+    	    if (length == 0)
+    	    	continue;
+
+    	    memset(buffer.data(), 'a' + rand_r(&seed) % 26, length);
+    	    if (fs.write(file.Inumber, buffer.data(), length, offset) != (ssize_t)length) {
+    	    	fail(thread, "write failed", file.Inumber);
+    	    	continue;
+    	    }
+
+    	    if (offset + length > size)
+    	    	file.Data.resize(offset + length);
+    	    std::copy(buffer.begin(), buffer.begin() + length, file.Data.begin() + offset);
+    	} else if (action < 85) {
+    	    if (size == 0)
+    	    	continue;
+
+    	    size_t offset = rand_r(&seed) % size;
+    	    size_t length = 1 + rand_r(&seed) % MAX_CHUNK;
+    	    ssize_t result = fs.read(file.Inumber, buffer.data(), length, offset);
+    	    if (result != (ssize_t)std::min(length, size - offset) ||
+    	    	!std::equal(buffer.begin(), buffer.begin() + result, file.Data.begin() + offset))
+    	    	fail(thread, "read mismatch", file.Inumber);
+    	} else if (action < 93) {
+    	    if (fs.stat(file.Inumber) != (ssize_t)size)
+    	    	fail(thread, "stat mismatch", file.Inumber);
+    	} else if (action < 98) {
+    	    // replace file with a fresh one
+    	    if (!fs.remove(file.Inumber))
+    	    	fail(thread, "remove failed", file.Inumber);
+    	    file.Inumber = fs.create();
+    	    file.Data.clear();
+    	    if (file.Inumber < 0)
+    	    	fail(thread, "create failed", file.Inumber);
+    	} else {
+    	    fs.sync();
+    	}
+    }
+}
+
+// Run worker, any exception is a failure since its own reads never fail
+static void guarded_worker(FileSystem &fs, size_t thread, size_t operations, std::vector<File> *files) {
+    try {
+    	worker(fs, thread, operations, files);
+    } catch (const std::exception &e) {
+    	fail(thread, e.what(), -1);
+    }
+}
+
+// Read the faulty file until the workers are done, every read must throw
+static void faulty_reader(FileSystem &fs, ssize_t inumber, const std::atomic<bool> *done, size_t thread) {
+    std::vector<char> buffer(FAULTY_SIZE);
+    size_t reads = 0;
+
+    while (!*done || reads == 0) {
+    	try {
+    	    fs.read(inumber, buffer.data(), buffer.size(), 0);
+    	    fail(thread, "faulty read succeeded", inumber);
+    	} catch (const std::runtime_error &) {
+    	}
+    	reads++;
+    }
+}
+
+static Disk *open_disk(const std::string &backend) {
+    if (backend == "mmap")
+    	return new MmapDisk();
+    if (backend == "async")
+    	return new AsyncDisk(8);
+    if (backend == "faulty")
+    	return new FaultyDisk();
+    return new Disk();
+}
+
+// Main execution
+
+int main(int argc, char *argv[]) {
+    size_t      threads    = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+    size_t      operations = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000;
+    std::string backend    = argc > 3 ? argv[3] : "pread";
+    size_t      blocks     = 16384;
+
+    char path[] = "/tmp/sfs.stress.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+    	perror("mkstemp");
+    	return EXIT_FAILURE;
+    }
+    close(fd);
+
+    std::vector<std::vector<File>> files(threads);
+    {
+    	std::unique_ptr<Disk> disk(open_disk(backend));
+    	FileSystem fs;
+
+    	disk->open(path, blocks);
+    	FileSystem::format(disk.get());
+    	fs.mount(disk.get());
+
+    	// one more thread keeps reading a file whose reads always fail
+    	FaultyDisk *faulty = dynamic_cast<FaultyDisk *>(disk.get());
+    	ssize_t doomed = -1;
+    	if (faulty) {
+    	    // readahead would pull the faulty blocks in synchronously
+    	    fs.set_readahead(0);
+    	    std::vector<char> buffer(FAULTY_SIZE, 'z');
+    	    doomed = fs.create();
+    	    faulty->record(true);
+    	    fs.write(doomed, buffer.data(), buffer.size(), 0);
+    	    faulty->record(false);
+    	    if (faulty->faulty() == 0)
+    	    	fail(threads, "no faulty blocks", doomed);
+    	    faulty->arm(true);
+    	}
+
+    	std::atomic<bool> done(false);
+    	std::thread reader;
+    	if (faulty)
+    	    reader = std::thread(faulty_reader, std::ref(fs), doomed, &done, threads);
+
+    	std::vector<std::thread> workers;
+    	for (size_t t = 0; t < threads; t++)
+    	    workers.push_back(std::thread(guarded_worker, std::ref(fs), t, operations, &files[t]));
+    	for (auto &w : workers)
+    	    w.join();
+
+    	if (faulty) {
+    	    done = true;
+    	    reader.join();
+    	    faulty->arm(false);
+    	    if (!fs.remove(doomed))
+    	    	fail(threads, "remove failed", doomed);
+    	}
+
+    	if (!fs.check())
+    	    fail(threads, "bitmaps inconsistent after run", -1);
+    	for (size_t t = 0; t < threads; t++)
+    	    for (auto &file : files[t])
+    	    	verify(fs, file, t);
+    }
+
+    // everything must survive a remount
+    {
+    	std::unique_ptr<Disk> disk(open_disk(backend));
+    	FileSystem fs;
+
+    	disk->open(path, blocks);
+    	if (!fs.mount(disk.get()))
+    	    fail(threads, "remount failed", -1);
+    	else if (!fs.check())
+    	    fail(threads, "bitmaps inconsistent after remount", -1);
+
+    	for (size_t t = 0; t < threads; t++)
+    	    for (auto &file : files[t])
+    	    	verify(fs, file, t);
+    }
+
+    unlink(path);
+    printf("%lu threads, %lu operations each on %s: %lu failures\n", threads, operations, backend.c_str(), Failures.load());
+    return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
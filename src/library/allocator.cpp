@@ -0,0 +1,143 @@
+// allocator.cpp: Sharded next-fit block allocator over a packed bitmap
+
+#include "sfs/allocator.h"
+
+#include <algorithm>
+
+void Allocator::assign(size_t blocks, size_t low) {
+    Free.assign(blocks, true);
+    for (size_t i = 0; i < low && i < blocks; i++)
+    	Free.clear(i);
+
+    Low  = low;
+    Home = 0;
+
+    Shards.clear();
+    for (size_t start = 0; start < blocks; start += SHARD_BLOCKS) {
+    	Shard *shard  = new Shard();
+    	shard->Start  = std::max(start, low);
+    	shard->End    = std::min(start + SHARD_BLOCKS, blocks);
+    	shard->Cursor = shard->Start;
+    	Shards.push_back(std::unique_ptr<Shard>(shard));
+    }
+}
+
+void Allocator::reserve(size_t block) {
+    if (block >= Free.size())
+    	return;
+
+    std::lock_guard<std::mutex> guard(shard_of(block).Lock);
+    Free.clear(block);
+}
+
+ssize_t Allocator::allocate(size_t goal) {
+    size_t length;
+    return allocate_run(goal, 1, &length);
+}
+
+size_t Allocator::find_run(size_t from, size_t limit, size_t stop, size_t count, size_t *best, size_t *bestLength) const {
+    size_t block = Free.find_next(from, limit);
+    while (block != Bitmap::NONE) {
+    	// only the first count blocks of the extent matter
+    	size_t cap   = std::min(block + count, stop);
+    	size_t end   = Free.find_next_zero(block, cap);
+    	if (end == Bitmap::NONE)
+    	    end = cap;
+
+    	if (end - block >= count)
+    	    return block;
+
+    	if (end - block > *bestLength) {
+    	    *best       = block;
+    	    *bestLength = end - block;
+    	}
+
+    	block = Free.find_next(end, limit);
+    }
+
+    return Bitmap::NONE;
+}
+
+ssize_t Allocator::allocate_in(Shard &shard, size_t goal, size_t count, size_t *length) {
+    if (shard.Start >= shard.End)
+    	return -1;
+
+    bool   validGoal = goal >= shard.Start && goal < shard.End;
+    size_t start     = Bitmap::NONE;
+
+    if (validGoal && Free.test(goal)) {
+    	// keep growing the caller's extent even if it cannot be completed
+    	start = goal;
+    } else {
+    	size_t from       = validGoal ? goal : shard.Cursor;
+    	size_t best       = Bitmap::NONE;
+    	size_t bestLength = 0;
+
+    	start = find_run(from, shard.End, shard.End, count, &best, &bestLength);
+    	if (start == Bitmap::NONE)
+    	    start = find_run(shard.Start, from, shard.End, count, &best, &bestLength);
+    	if (start == Bitmap::NONE)
+    	    start = best;
+    }
+
+    if (start == Bitmap::NONE)
+    	return -1;
+
+    size_t end = Free.find_next_zero(start, std::min(start + count, shard.End));
+    if (end == Bitmap::NONE)
+    	end = std::min(start + count, shard.End);
+
+    for (size_t block = start; block < end; block++)
+    	Free.clear(block);
+
+    shard.Cursor = (end < shard.End) ? end : shard.Start;
+    *length      = end - start;
+    return start;
+}
+
+ssize_t Allocator::allocate_run(size_t goal, size_t count, size_t *length) {
+    *length = 0;
+    if (count == 0 || Free.count() == 0)
+    	return -1;
+
+    size_t  shards = Shards.size();
+    size_t  home   = Home.load(std::memory_order_relaxed);
+    ssize_t start  = -1;
+
+    if (goal >= Low && goal < Free.size()) {
+    	// stay next to the caller's previous block
+    	home = goal / SHARD_BLOCKS;
+    	std::lock_guard<std::mutex> guard(Shards[home]->Lock);
+    	start = allocate_in(*Shards[home], goal, count, length);
+    } else {
+    	// take the first shard nobody else is using
+    	for (size_t i = 0; i < shards && start < 0; i++) {
+    	    Shard &shard = *Shards[(home + i) % shards];
+    	    if (!shard.Lock.try_lock())
+    	    	continue;
+    	    start = allocate_in(shard, 0, count, length);
+    	    shard.Lock.unlock();
+    	}
+    }
+
+    // every shard was busy or full, wait for each in turn
+    for (size_t i = 0; i < shards && start < 0; i++) {
+    	Shard &shard = *Shards[(home + i) % shards];
+    	std::lock_guard<std::mutex> guard(shard.Lock);
+    	start = allocate_in(shard, 0, count, length);
+    }
+
+    // only a hint, so avoid writing the shared line when nothing moved
+    if (start >= 0 && (size_t)start / SHARD_BLOCKS != home)
+    	Home.store(start / SHARD_BLOCKS, std::memory_order_relaxed);
+    return start;
+}
+
+bool Allocator::release(size_t block) {
+    // null pointers and reserved metadata blocks are never handed out
+    if (block < Low || block >= Free.size())
+    	return false;
+
+    std::lock_guard<std::mutex> guard(shard_of(block).Lock);
+    return Free.set(block);
+}
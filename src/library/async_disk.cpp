@@ -0,0 +1,274 @@
+// async_disk.cpp: Disk emulator with asynchronous batched I/O
+
+#include "sfs/async_disk.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+AsyncDisk::AsyncDisk(size_t depth)
+    : Depth(std::max<size_t>(depth, 1)), InFlight(0), Peak(0), Submits(0)
+#ifdef HAVE_LIBURING
+    , RingReady(false), Unsubmitted(0)
+#else
+    , Stopping(false)
+#endif
+{
+}
+
+AsyncDisk::~AsyncDisk() {
+    // never leave requests running against a closed descriptor
+    try {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	drain(guard, NULL);
+    } catch (std::runtime_error &e) {
+    	fprintf(stderr, "%s\n", e.what());
+    }
+
+#ifdef HAVE_LIBURING
+    if (RingReady) {
+    	io_uring_queue_exit(&Ring);
+    	RingReady = false;
+    }
+#else
+    {
+    	std::lock_guard<std::mutex> guard(Lock);
+    	Stopping = true;
+    }
+    Ready.notify_all();
+    for (auto &worker : Workers)
+    	worker.join();
+    Workers.clear();
+#endif
+}
+
+void AsyncDisk::open(const char *path, size_t nblocks) {
+    Disk::open(path, nblocks);
+
+#ifdef HAVE_LIBURING
+    int result = io_uring_queue_init(Depth, &Ring, 0);
+    if (result < 0) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to set up io_uring: %s", strerror(-result));
+    	throw std::runtime_error(what);
+    }
+    RingReady = true;
+#else
+    for (size_t i = Workers.size(); i < std::min(Depth, (size_t)MAX_WORKERS); i++)
+    	Workers.push_back(std::thread(&AsyncDisk::work, this));
+#endif
+}
+
+std::string AsyncDisk::perform(const Request &request) {
+    size_t bytes  = request.Count*BLOCK_SIZE;
+    off_t  offset = (off_t)request.Block*BLOCK_SIZE;
+
+    ssize_t result = request.Write ?
+    	pwrite(FileDescriptor, request.Data, bytes, offset) :
+    	pread(FileDescriptor, request.Data, bytes, offset);
+
+    if (result == (ssize_t)bytes)
+    	return "";
+
+    char what[BUFSIZ];
+    snprintf(what, BUFSIZ, "Unable to %s %d+%lu: %s", request.Write ? "write" : "read",
+    	request.Block, request.Count, result < 0 ? strerror(errno) : "short transfer");
+    return what;
+}
+
+void AsyncDisk::submit_read(int blocknum, char *data, size_t count, Batch *batch) {
+    sanity_check(blocknum, data);
+    sanity_check(blocknum + (int)count - 1, data);
+
+    submit({false, blocknum, data, count, batch});
+    Reads += count;
+    trace(Tracer::DISK_READ, blocknum, count);
+}
+
+void AsyncDisk::submit_write(int blocknum, char *data, size_t count, Batch *batch) {
+    sanity_check(blocknum, data);
+    sanity_check(blocknum + (int)count - 1, data);
+
+    submit({true, blocknum, data, count, batch});
+    Writes += count;
+    trace(Tracer::DISK_WRITE, blocknum, count);
+}
+
+void AsyncDisk::zero(int blocknum, size_t count, bool release) {
+    // queued writes must not land on top of the zeros, their failures are
+    // left for their own batches
+    {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	drain(guard, NULL);
+    }
+    Disk::zero(blocknum, count, release);
+}
+
+void AsyncDisk::sync() {
+    {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	drain(guard, NULL);
+    }
+    Disk::sync();
+}
+
+void AsyncDisk::wait(Batch *batch) {
+    std::unique_lock<std::mutex> guard(Lock);
+    drain(guard, batch);
+
+    if (!batch->Error.empty()) {
+    	std::string what = batch->Error;
+    	batch->Error.clear();
+    	throw std::runtime_error(what);
+    }
+}
+
+void AsyncDisk::settle(Batch *batch) {
+    // runs from the batch's destructor, possibly while unwinding
+    try {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	drain(guard, batch);
+    } catch (std::runtime_error &e) {
+    	fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+#ifdef HAVE_LIBURING
+
+void AsyncDisk::flush_ring() {
+    if (Unsubmitted == 0)
+    	return;
+
+    Syscalls++;
+    int result = io_uring_submit(&Ring);
+    if (result < 0) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to submit: %s", strerror(-result));
+    	throw std::runtime_error(what);
+    }
+    Unsubmitted = 0;
+}
+
+void AsyncDisk::reap() {
+    struct io_uring_cqe *cqe;
+
+    Syscalls++;
+    int result = io_uring_wait_cqe(&Ring, &cqe);
+    if (result < 0) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to wait for completion: %s", strerror(-result));
+    	throw std::runtime_error(what);
+    }
+
+    // the request travels in the user data
+    Request *request = (Request *)io_uring_cqe_get_data(cqe);
+    if (cqe->res != (int)(request->Count*BLOCK_SIZE) && request->Owner->Error.empty()) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to %s %d+%lu: %s", request->Write ? "write" : "read",
+    	    request->Block, request->Count, cqe->res < 0 ? strerror(-cqe->res) : "short transfer");
+    	request->Owner->Error = what;
+    }
+
+    io_uring_cqe_seen(&Ring, cqe);
+    request->Owner->InFlight--;
+    InFlight--;
+    delete request;
+}
+
+void AsyncDisk::submit(const Request &request) {
+    std::lock_guard<std::mutex> guard(Lock);
+    request.Owner->Owner = this;
+
+    // make room by handing the batch over and reaping a completion
+    if (InFlight == Depth) {
+    	flush_ring();
+    	reap();
+    }
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&Ring);
+    size_t bytes  = request.Count*BLOCK_SIZE;
+    off_t  offset = (off_t)request.Block*BLOCK_SIZE;
+
+    if (request.Write)
+    	io_uring_prep_write(sqe, FileDescriptor, request.Data, bytes, offset);
+    else
+    	io_uring_prep_read(sqe, FileDescriptor, request.Data, bytes, offset);
+    io_uring_sqe_set_data(sqe, new Request(request));
+
+    Unsubmitted++;
+    request.Owner->InFlight++;
+    InFlight++;
+    Submits++;
+    Peak = std::max(Peak, InFlight);
+}
+
+void AsyncDisk::drain(std::unique_lock<std::mutex> &guard, Batch *batch) {
+    if (!RingReady)
+    	return;
+
+    // completions of other batches are reaped along the way
+    flush_ring();
+    while (batch ? batch->InFlight > 0 : InFlight > 0)
+    	reap();
+}
+
+const char *AsyncDisk::engine() const {
+    return "io_uring";
+}
+
+#else
+
+void AsyncDisk::work() {
+    std::unique_lock<std::mutex> guard(Lock);
+
+    while (true) {
+    	Ready.wait(guard, [this]() { return Stopping || !Queue.empty(); });
+    	if (Queue.empty())
+    	    return;
+
+    	Request request = Queue.front();
+    	Queue.pop_front();
+
+    	// do the transfer without holding the lock
+    	guard.unlock();
+    	std::string error = perform(request);
+    	guard.lock();
+
+    	if (!error.empty() && request.Owner->Error.empty())
+    	    request.Owner->Error = error;
+
+    	request.Owner->InFlight--;
+    	InFlight--;
+    	Done.notify_all();
+    }
+}
+
+void AsyncDisk::submit(const Request &request) {
+    {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	Done.wait(guard, [this]() { return InFlight < Depth; });
+
+    	Queue.push_back(request);
+    	request.Owner->Owner = this;
+    	request.Owner->InFlight++;
+    	InFlight++;
+    	Submits++;
+    	Syscalls++;
+    	Peak = std::max(Peak, InFlight);
+    }
+    Ready.notify_one();
+}
+
+void AsyncDisk::drain(std::unique_lock<std::mutex> &guard, Batch *batch) {
+    Done.wait(guard, [&]() { return batch ? batch->InFlight == 0 : InFlight == 0; });
+}
+
+const char *AsyncDisk::engine() const {
+    return "threads";
+}
+
+#endif
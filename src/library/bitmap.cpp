@@ -0,0 +1,151 @@
+// bitmap.cpp: Packed bitmap of free objects
+
+#include "sfs/bitmap.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+Bitmap &Bitmap::operator=(const Bitmap &other) {
+    Words = other.Words;
+    Bits  = other.Bits;
+    Count = other.Count.load();
+    return *this;
+}
+
+void Bitmap::assign(size_t bits, bool value) {
+    Bits  = bits;
+    Count = value ? bits : 0;
+    Words.assign((bits + WORD_BITS - 1) / WORD_BITS, value ? ~0ULL : 0);
+
+    // keep bits past the end clear so word scans never report them
+    if (value && bits % WORD_BITS)
+    	Words.back() = (1ULL << (bits % WORD_BITS)) - 1;
+}
+
+bool Bitmap::set(size_t bit) {
+    uint64_t mask = 1ULL << (bit % WORD_BITS);
+    uint64_t &word = Words[bit / WORD_BITS];
+
+    if (word & mask)
+    	return false;
+
+    word |= mask;
+    Count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool Bitmap::clear(size_t bit) {
+    uint64_t mask = 1ULL << (bit % WORD_BITS);
+    uint64_t &word = Words[bit / WORD_BITS];
+
+    if (!(word & mask))
+    	return false;
+
+    word &= ~mask;
+    Count.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t Bitmap::skip_empty(size_t w, size_t end) const {
+#ifdef __SSE2__
+    // test four words (256 bits) per iteration while they are all zero
+    const __m128i zero = _mm_setzero_si128();
+    while (w + 4 <= end) {
+    	__m128i lo = _mm_loadu_si128((const __m128i *)&Words[w]);
+    	__m128i hi = _mm_loadu_si128((const __m128i *)&Words[w + 2]);
+    	__m128i any = _mm_or_si128(lo, hi);
+    	if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+    	    break;
+    	w += 4;
+    }
+#endif
+    while (w < end && Words[w] == 0)
+    	w++;
+
+    return w;
+}
+
+size_t Bitmap::find_next(size_t start, size_t limit) const {
+    limit = std::min(limit, Bits);
+    if (start >= limit)
+    	return NONE;
+
+    // mask off bits before start in the first word
+    size_t w    = start / WORD_BITS;
+    size_t end  = (limit + WORD_BITS - 1) / WORD_BITS;
+    uint64_t word = Words[w] & (~0ULL << (start % WORD_BITS));
+
+    // skip over fully clear regions
+    if (word == 0) {
+    	w = skip_empty(w + 1, end);
+    	if (w == end)
+    	    return NONE;
+    	word = Words[w];
+    }
+
+    size_t bit = w * WORD_BITS + __builtin_ctzll(word);
+    return bit < limit ? bit : NONE;
+}
+
+size_t Bitmap::find_next_zero(size_t start, size_t limit) const {
+    limit = std::min(limit, Bits);
+    if (start >= limit)
+    	return NONE;
+
+    // invert words so that clear bits can be found with ctz
+    size_t w    = start / WORD_BITS;
+    size_t end  = (limit + WORD_BITS - 1) / WORD_BITS;
+    uint64_t word = ~Words[w] & (~0ULL << (start % WORD_BITS));
+    while (word == 0) {
+    	if (++w == end)
+    	    return NONE;
+    	word = ~Words[w];
+    }
+
+    // bits past the end are clear, so they show up here and must be ignored
+    size_t bit = w * WORD_BITS + __builtin_ctzll(word);
+    return bit < limit ? bit : NONE;
+}
+
+void Bitmap::copy_out(size_t offset, char *data, size_t length) const {
+    size_t bytes  = Words.size() * sizeof(uint64_t);
+    size_t copied = offset < bytes ? std::min(length, bytes - offset) : 0;
+
+    memcpy(data, (const char *)Words.data() + offset, copied);
+    memset(data + copied, 0, length - copied);
+}
+
+void Bitmap::copy_in(size_t offset, const char *data, size_t length) {
+    size_t bytes  = Words.size() * sizeof(uint64_t);
+    size_t copied = offset < bytes ? std::min(length, bytes - offset) : 0;
+
+    memcpy((char *)Words.data() + offset, data, copied);
+
+    // keep bits past the end clear
+    if (Bits % WORD_BITS && !Words.empty())
+    	Words.back() &= (1ULL << (Bits % WORD_BITS)) - 1;
+}
+
+void Bitmap::recount() {
+    size_t count = 0;
+    for (auto word : Words)
+    	count += __builtin_popcountll(word);
+    Count = count;
+}
+
+void Bitmap::merge(const Bitmap &other) {
+    for (size_t w = 0; w < Words.size(); w++)
+    	Words[w] |= other.Words[w];
+    recount();
+}
+
+void Bitmap::subtract(const Bitmap &other) {
+    for (size_t w = 0; w < Words.size(); w++)
+    	Words[w] &= ~other.Words[w];
+    recount();
+}
@@ -0,0 +1,336 @@
+// cache.cpp: Write-back LRU block cache
+
+#include "sfs/cache.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <string.h>
+
+Cache::~Cache() {
+    detach();
+}
+
+void Cache::attach(Disk *disk) {
+    detach();
+
+    std::lock_guard<std::mutex> guard(Lock);
+    this->disk = disk;
+    Hits      = 0;
+    Misses    = 0;
+    Evictions = 0;
+    Prefetches     = 0;
+    PrefetchHits   = 0;
+    PrefetchWasted = 0;
+}
+
+void Cache::detach() {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (disk == NULL)
+    	return;
+
+    flush_locked();
+    LRU.clear();
+    Map.clear();
+    disk = NULL;
+}
+
+Cache::Entry *Cache::lookup(int blocknum) {
+    auto it = Map.find(blocknum);
+    if (it == Map.end())
+    	return NULL;
+
+    // move to front of LRU list
+    LRU.splice(LRU.begin(), LRU, it->second);
+    return &LRU.front();
+}
+
+Cache::Entry *Cache::insert(int blocknum) {
+    // leave room for the new entry
+    shrink(Capacity - 1);
+
+    LRU.emplace_front();
+    Entry &entry = LRU.front();
+    entry.Block = blocknum;
+    entry.Dirty = false;
+    entry.Prefetched = false;
+    Map[blocknum] = LRU.begin();
+
+    return &entry;
+}
+
+void Cache::shrink(size_t capacity) {
+    while (Map.size() > capacity) {
+    	Entry &victim = LRU.back();
+
+    	// write back before dropping
+    	if (victim.Dirty)
+    	    disk->write(victim.Block, victim.Data);
+    	if (victim.Prefetched)
+    	    PrefetchWasted++;
+
+    	Map.erase(victim.Block);
+    	LRU.pop_back();
+    	Evictions++;
+    }
+}
+
+Cache::Entry *Cache::fetch(int blocknum) {
+    Entry *entry = lookup(blocknum);
+    if (entry != NULL) {
+    	claim(entry);
+    	return entry;
+    }
+
+    Misses++;
+
+    // caching disabled, caller goes straight to disk
+    if (Capacity == 0)
+    	return NULL;
+
+    entry = insert(blocknum);
+    try {
+    	disk->read(blocknum, entry->Data);
+    } catch (...) {
+    	// do not leave a bogus block behind
+    	Map.erase(blocknum);
+    	LRU.pop_front();
+    	throw;
+    }
+    return entry;
+}
+
+void Cache::claim(Entry *entry) {
+    Hits++;
+    if (entry->Prefetched) {
+    	entry->Prefetched = false;
+    	PrefetchHits++;
+    }
+}
+
+void Cache::erase(std::unordered_map<int, List::iterator>::iterator it) {
+    if (it->second->Prefetched)
+    	PrefetchWasted++;
+
+    LRU.erase(it->second);
+    Map.erase(it);
+}
+
+void Cache::read(int blocknum, char *data) {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    Entry *entry = fetch(blocknum);
+    if (entry != NULL)
+    	memcpy(data, entry->Data, Disk::BLOCK_SIZE);
+    else
+    	disk->read(blocknum, data);
+}
+
+void Cache::read(int blocknum, char *data, size_t offset, size_t length) {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    Entry *entry = lookup(blocknum);
+    if (entry != NULL) {
+    	claim(entry);
+    	memcpy(data, entry->Data + offset, length);
+    	return;
+    }
+
+    // not resident, so the disk copy is current
+    const char *view = disk->view(blocknum);
+    if (view != NULL) {
+    	Misses++;
+    	memcpy(data, view + offset, length);
+    	return;
+    }
+
+    entry = fetch(blocknum);
+    if (entry != NULL) {
+    	memcpy(data, entry->Data + offset, length);
+    } else {
+    	char block[Disk::BLOCK_SIZE];
+    	disk->read(blocknum, block);
+    	memcpy(data, block + offset, length);
+    }
+}
+
+void Cache::fill(int blocknum, const char *data) {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (Capacity == 0 || Map.count(blocknum))
+    	return;
+
+    memcpy(insert(blocknum)->Data, data, Disk::BLOCK_SIZE);
+}
+
+void Cache::write(int blocknum, char *data) {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    // caching disabled, write through
+    if (Capacity == 0) {
+    	disk->write(blocknum, data);
+    	return;
+    }
+
+    // whole block is overwritten, so a miss never needs to read the disk
+    Entry *entry = lookup(blocknum);
+    if (entry == NULL)
+    	entry = insert(blocknum);
+    else if (entry->Prefetched)
+    	PrefetchWasted++;
+
+    memcpy(entry->Data, data, Disk::BLOCK_SIZE);
+    entry->Dirty = true;
+    entry->Prefetched = false;
+}
+
+void Cache::read_run(int blocknum, char *data, size_t count, Disk::Batch *batch) {
+    // gaps are read after the lock is dropped
+    std::vector<std::pair<size_t, size_t>> gaps;
+
+    {
+    	std::lock_guard<std::mutex> guard(Lock);
+
+    	size_t i = 0;
+    	while (i < count) {
+    	    Entry *entry = lookup(blocknum + i);
+    	    if (entry != NULL) {
+    	    	claim(entry);
+    	    	memcpy(data + i*Disk::BLOCK_SIZE, entry->Data, Disk::BLOCK_SIZE);
+    	    	i++;
+    	    	continue;
+    	    }
+
+    	    // read the whole gap up to the next resident block at once
+    	    size_t j = i + 1;
+    	    while (j < count && Map.find(blocknum + j) == Map.end())
+    	    	j++;
+
+    	    Misses += j - i;
+    	    gaps.push_back(std::make_pair(i, j - i));
+    	    i = j;
+    	}
+    }
+
+    for (auto &gap : gaps)
+    	disk->submit_read(blocknum + gap.first, data + gap.first*Disk::BLOCK_SIZE, gap.second, batch);
+}
+
+void Cache::prefetch(const uint32_t *blocks, size_t count) {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    // a run longer than the cache would evict itself
+    if (disk == NULL || count > Capacity / 2)
+    	return;
+
+    std::vector<struct iovec> iov;
+    size_t i = 0;
+    while (i < count) {
+    	if (blocks[i] == 0 || Map.count(blocks[i])) {
+    	    i++;
+    	    continue;
+    	}
+
+    	// gather adjacent missing blocks into a single vectored read
+    	size_t j = i;
+    	iov.clear();
+    	do {
+    	    Entry *entry = insert(blocks[j]);
+    	    entry->Prefetched = true;
+    	    iov.push_back({entry->Data, Disk::BLOCK_SIZE});
+    	    j++;
+    	} while (j < count && blocks[j] == blocks[j - 1] + 1 && !Map.count(blocks[j]));
+
+    	try {
+    	    disk->readv(blocks[i], iov.data(), iov.size());
+    	} catch (...) {
+    	    // do not leave bogus blocks behind
+    	    for (size_t k = i; k < j; k++) {
+    	    	LRU.erase(Map[blocks[k]]);
+    	    	Map.erase(blocks[k]);
+    	    }
+    	    throw;
+    	}
+
+    	Prefetches += j - i;
+    	i = j;
+    }
+}
+
+void Cache::write_run(int blocknum, char *data, size_t count, Disk::Batch *batch) {
+    {
+    	std::lock_guard<std::mutex> guard(Lock);
+
+    	// stale copies must not be written back over the new data later
+    	for (size_t i = 0; i < count && !Map.empty(); i++) {
+    	    auto it = Map.find(blocknum + i);
+    	    if (it != Map.end())
+    	    	erase(it);
+    	}
+    }
+
+    disk->submit_write(blocknum, data, count, batch);
+}
+
+void Cache::flush() {
+    std::lock_guard<std::mutex> guard(Lock);
+    flush_locked();
+}
+
+void Cache::flush_locked() {
+    if (disk == NULL)
+    	return;
+
+    // write back in block order so the image is written sequentially
+    std::vector<Entry *> dirtyEntries;
+    for (auto &entry : LRU) {
+    	if (entry.Dirty)
+    	    dirtyEntries.push_back(&entry);
+    }
+
+    std::sort(dirtyEntries.begin(), dirtyEntries.end(),
+    	[](const Entry *a, const Entry *b) { return a->Block < b->Block; });
+
+    // gather runs of adjacent blocks into a single vectored write
+    std::vector<struct iovec> iov;
+    for (size_t i = 0; i < dirtyEntries.size(); ) {
+    	size_t j = i;
+    	iov.clear();
+    	do {
+    	    iov.push_back({dirtyEntries[j]->Data, Disk::BLOCK_SIZE});
+    	    j++;
+    	} while (j < dirtyEntries.size() && dirtyEntries[j]->Block == dirtyEntries[j - 1]->Block + 1);
+
+    	disk->writev(dirtyEntries[i]->Block, iov.data(), iov.size());
+
+    	for (; i < j; i++)
+    	    dirtyEntries[i]->Dirty = false;
+    }
+}
+
+void Cache::sync() {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (disk == NULL)
+    	return;
+
+    flush_locked();
+    disk->sync();
+}
+
+void Cache::resize(size_t capacity) {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    Capacity = capacity;
+    if (disk != NULL)
+    	shrink(Capacity);
+}
+
+size_t Cache::dirty() const {
+    std::lock_guard<std::mutex> guard(Lock);
+
+    size_t count = 0;
+    for (auto &entry : LRU) {
+    	if (entry.Dirty)
+    	    count++;
+    }
+    return count;
+}
@@ -0,0 +1,397 @@
+// directory.cpp: Hashed directories
+
+#include "sfs/directory.h"
+#include "sfs/rwlock.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <string.h>
+
+static_assert(sizeof(Directory::Entry) == 64, "directory entry must be 64 bytes");
+
+// Directories are locked by inode, shared to look up and exclusive to change
+const static size_t DIRECTORY_LOCKS = 64;
+static RWLock directoryLocks[DIRECTORY_LOCKS];
+
+static RWLock &directory_lock(size_t inumber) {
+    return directoryLocks[inumber % DIRECTORY_LOCKS];
+}
+
+// Makes the root directory only once when several threads find it missing
+static std::mutex rootLock;
+
+// Hashing --------------------------------------------------------------------
+
+uint32_t Directory::hash(const std::string &name) {
+    // FNV-1a
+    uint32_t value = 2166136261u;
+    for (unsigned char c : name) {
+        value ^= c;
+        value *= 16777619u;
+    }
+    return value;
+}
+
+size_t Directory::bucket_of(const Header &head, uint32_t hash) {
+    // buckets before Split have already been split into the next level
+    size_t bucket = hash & ((1u << head.Level) - 1);
+    if (bucket < head.Split)
+        bucket = hash & ((1u << (head.Level + 1)) - 1);
+    return bucket;
+}
+
+bool Directory::matches(const Entry &entry, const std::string &name, uint32_t hash) {
+    return entry.Hash == hash && entry.Length == name.size() &&
+           memcmp(entry.Name, name.data(), name.size()) == 0;
+}
+
+// Block I/O ------------------------------------------------------------------
+
+bool Directory::read_block(size_t block, Block *data) {
+    ssize_t result = fs->read(Inumber, data->Data, Disk::BLOCK_SIZE, block * Disk::BLOCK_SIZE);
+    if (result < 0)
+        return false;
+
+    // buckets not yet written are empty
+    memset(data->Data + result, 0, Disk::BLOCK_SIZE - result);
+    return true;
+}
+
+bool Directory::write_block(size_t block, Block *data) {
+    return fs->write(Inumber, data->Data, Disk::BLOCK_SIZE, block * Disk::BLOCK_SIZE) == (ssize_t)Disk::BLOCK_SIZE;
+}
+
+bool Directory::read_header(Block *data) {
+    return read_block(0, data) && data->Head.Magic == MAGIC;
+}
+
+bool Directory::read_chain(const Header &head, size_t bucket, std::vector<uint32_t> *blocks, std::vector<Entry> *entries) {
+    Block data;
+    size_t block = bucket_block(bucket);
+    while (true) {
+        if (!read_block(block, &data) || data.Bucket.Count > ENTRIES_PER_BUCKET)
+            return false;
+
+        blocks->push_back(block);
+        entries->insert(entries->end(), data.Bucket.Entries, data.Bucket.Entries + data.Bucket.Count);
+
+        block = data.Bucket.Next;
+        if (block == 0)
+            return true;
+
+        // a chain longer than the overflow blocks in use is corrupt
+        if (blocks->size() > head.Overflows)
+            return false;
+    }
+}
+
+// Overflow blocks ------------------------------------------------------------
+
+bool Directory::allocate_overflow(Header *head, uint32_t *block) {
+    // reuse a freed block first, they are linked through Next
+    if (head->FreeOverflow != 0) {
+        Block data;
+        if (!read_block(head->FreeOverflow, &data))
+            return false;
+        *block = head->FreeOverflow;
+        head->FreeOverflow = data.Bucket.Next;
+        return true;
+    }
+
+    if (OVERFLOW_START + head->Overflows >= fs->max_file_blocks())
+        return false;
+
+    *block = OVERFLOW_START + head->Overflows++;
+    return true;
+}
+
+bool Directory::free_overflow(Header *head, uint32_t block) {
+    Block data;
+    memset(&data, 0, sizeof(data));
+    data.Bucket.Next = head->FreeOverflow;
+    if (!write_block(block, &data))
+        return false;
+
+    head->FreeOverflow = block;
+    return true;
+}
+
+bool Directory::write_chain(Header *head, std::vector<uint32_t> blocks, const std::vector<Entry> &entries) {
+    // every chain keeps its bucket block, even when empty
+    size_t needed = std::max<size_t>(1, (entries.size() + ENTRIES_PER_BUCKET - 1) / ENTRIES_PER_BUCKET);
+
+    while (blocks.size() < needed) {
+        uint32_t block;
+        if (!allocate_overflow(head, &block))
+            return false;
+        blocks.push_back(block);
+    }
+
+    for (size_t i = needed; i < blocks.size(); i++) {
+        if (!free_overflow(head, blocks[i]))
+            return false;
+    }
+
+    Block data;
+    for (size_t i = 0; i < needed; i++) {
+        memset(&data, 0, sizeof(data));
+
+        size_t first = i * ENTRIES_PER_BUCKET;
+        size_t count = std::min<size_t>(size_t(ENTRIES_PER_BUCKET), entries.size() - std::min(first, entries.size()));
+        data.Bucket.Count = count;
+        data.Bucket.Next  = i + 1 < needed ? blocks[i + 1] : 0;
+        memcpy(data.Bucket.Entries, entries.data() + first, count * sizeof(Entry));
+
+        if (!write_block(blocks[i], &data))
+            return false;
+    }
+    return true;
+}
+
+bool Directory::split(Header *head) {
+    size_t from = head->Split;
+    size_t to   = from + ((size_t)1 << head->Level);
+
+    std::vector<uint32_t> blocks;
+    std::vector<Entry> entries;
+    if (!read_chain(*head, from, &blocks, &entries))
+        return false;
+
+    // entries move by the next hash bit, names are not hashed again
+    std::vector<Entry> stay, move;
+    for (auto &entry : entries) {
+        if (entry.Hash & (1u << head->Level))
+            move.push_back(entry);
+        else
+            stay.push_back(entry);
+    }
+
+    if (!write_chain(head, blocks, stay) ||
+        !write_chain(head, std::vector<uint32_t>(1, bucket_block(to)), move))
+        return false;
+
+    if (++head->Split == (1u << head->Level)) {
+        head->Split = 0;
+        head->Level++;
+    }
+    return true;
+}
+
+// Directory operations -------------------------------------------------------
+
+ssize_t Directory::create(FileSystem *fs) {
+    ssize_t inumber = fs->create();
+    if (inumber < 0)
+        return -1;
+
+    // one empty bucket to start with
+    Block data;
+    memset(&data, 0, sizeof(data));
+    data.Head.Magic = MAGIC;
+
+    Directory directory(fs, inumber);
+    if (!directory.write_block(0, &data)) {
+        fs->remove(inumber);
+        return -1;
+    }
+    return inumber;
+}
+
+bool Directory::valid() {
+    ReadGuard guard(directory_lock(Inumber));
+
+    Block data;
+    return read_header(&data);
+}
+
+ssize_t Directory::lookup(const std::string &name, Type *type) {
+    ReadGuard guard(directory_lock(Inumber));
+
+    Block head;
+    if (!read_header(&head))
+        return -1;
+
+    // only the bucket the name hashes to is read
+    uint32_t value = hash(name);
+    Block data;
+    size_t block = bucket_block(bucket_of(head.Head, value));
+    for (size_t chain = 0; chain <= head.Head.Overflows; chain++) {
+        if (!read_block(block, &data) || data.Bucket.Count > ENTRIES_PER_BUCKET)
+            return -1;
+
+        for (size_t i = 0; i < data.Bucket.Count; i++) {
+            Entry &entry = data.Bucket.Entries[i];
+            if (matches(entry, name, value)) {
+                if (type != NULL)
+                    *type = (Type)entry.Type;
+                return entry.Inumber;
+            }
+        }
+
+        block = data.Bucket.Next;
+        if (block == 0)
+            break;
+    }
+    return -1;
+}
+
+bool Directory::link(const std::string &name, size_t inumber, Type type) {
+    if (name.empty() || name.size() > NAME_LENGTH || name.find('/') != std::string::npos ||
+        name == "." || name == ".." || fs->stat(inumber) < 0)
+        return false;
+
+    WriteGuard guard(directory_lock(Inumber));
+
+    Block head;
+    if (!read_header(&head))
+        return false;
+
+    uint32_t value = hash(name);
+    size_t bucket = bucket_of(head.Head, value);
+
+    std::vector<uint32_t> blocks;
+    std::vector<Entry> entries;
+    if (!read_chain(head.Head, bucket, &blocks, &entries))
+        return false;
+
+    for (auto &entry : entries) {
+        if (matches(entry, name, value))
+            return false;
+    }
+
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.Inumber = inumber;
+    entry.Hash    = value;
+    entry.Type    = type;
+    entry.Length  = name.size();
+    memcpy(entry.Name, name.data(), name.size());
+    entries.push_back(entry);
+
+    if (!write_chain(&head.Head, blocks, entries))
+        return false;
+
+    // grow by one bucket at a time once buckets are three quarters full
+    head.Head.Entries++;
+    if (head.Head.Entries * 4 > buckets(head.Head) * ENTRIES_PER_BUCKET * 3 && !split(&head.Head))
+        return false;
+
+    return write_block(0, &head);
+}
+
+bool Directory::unlink(const std::string &name) {
+    WriteGuard guard(directory_lock(Inumber));
+
+    Block head;
+    if (!read_header(&head))
+        return false;
+
+    uint32_t value = hash(name);
+    size_t bucket = bucket_of(head.Head, value);
+
+    std::vector<uint32_t> blocks;
+    std::vector<Entry> entries;
+    if (!read_chain(head.Head, bucket, &blocks, &entries))
+        return false;
+
+    // move the last entry into the hole, emptied overflow blocks are freed
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (matches(entries[i], name, value)) {
+            entries[i] = entries.back();
+            entries.pop_back();
+
+            if (!write_chain(&head.Head, blocks, entries))
+                return false;
+
+            head.Head.Entries--;
+            return write_block(0, &head);
+        }
+    }
+    return false;
+}
+
+bool Directory::readdir(std::vector<Entry> *entries) {
+    ReadGuard guard(directory_lock(Inumber));
+
+    Block head;
+    if (!read_header(&head))
+        return false;
+
+    for (size_t bucket = 0; bucket < buckets(head.Head); bucket++) {
+        std::vector<uint32_t> blocks;
+        if (!read_chain(head.Head, bucket, &blocks, entries))
+            return false;
+    }
+    return true;
+}
+
+ssize_t Directory::size() {
+    ReadGuard guard(directory_lock(Inumber));
+
+    Block head;
+    if (!read_header(&head))
+        return -1;
+    return head.Head.Entries;
+}
+
+// Paths ----------------------------------------------------------------------
+
+ssize_t Directory::root(FileSystem *fs) {
+    ssize_t inumber = fs->root_directory();
+    if (inumber >= 0)
+        return inumber;
+
+    std::lock_guard<std::mutex> guard(rootLock);
+    inumber = fs->root_directory();
+    if (inumber >= 0)
+        return inumber;
+
+    inumber = create(fs);
+    if (inumber < 0)
+        return -1;
+
+    if (!fs->set_root_directory(inumber)) {
+        fs->remove(inumber);
+        return -1;
+    }
+    return inumber;
+}
+
+ssize_t Directory::resolve(FileSystem *fs, const std::string &path, Type *type) {
+    ssize_t inumber = root(fs);
+    Type    kind    = DIRECTORY_ENTRY;
+
+    size_t start = 0;
+    while (inumber >= 0 && start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+
+        // empty names between repeated slashes are skipped
+        if (end > start) {
+            if (kind != DIRECTORY_ENTRY)
+                return -1;
+            inumber = Directory(fs, inumber).lookup(path.substr(start, end - start), &kind);
+        }
+        start = end + 1;
+    }
+
+    if (inumber >= 0 && type != NULL)
+        *type = kind;
+    return inumber;
+}
+
+ssize_t Directory::parent(FileSystem *fs, const std::string &path, std::string *name) {
+    size_t end = path.find_last_not_of('/');
+    if (end == std::string::npos)
+        return -1;
+
+    size_t start = path.rfind('/', end);
+    start = start == std::string::npos ? 0 : start + 1;
+    *name = path.substr(start, end - start + 1);
+
+    Type type;
+    ssize_t inumber = resolve(fs, path.substr(0, start), &type);
+    return inumber >= 0 && type == DIRECTORY_ENTRY ? inumber : -1;
+}
@@ -2,10 +2,12 @@
 
 #include "sfs/disk.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -23,15 +25,19 @@ void Disk::open(const char *path, size_t nblocks) {
     	throw std::runtime_error(what);
     }
 
-    Blocks = nblocks;
-    Reads  = 0;
-    Writes = 0;
+    Blocks   = nblocks;
+    Reads    = 0;
+    Writes   = 0;
+    Punches  = 0;
+    Syscalls = 0;
 }
 
 Disk::~Disk() {
     if (FileDescriptor > 0) {
-    	printf("%lu disk block reads\n", Reads);
-    	printf("%lu disk block writes\n", Writes);
+    	if (Report) {
+    	    printf("%lu disk block reads\n", Reads.load());
+    	    printf("%lu disk block writes\n", Writes.load());
+    	}
     	close(FileDescriptor);
     	FileDescriptor = 0;
     }
@@ -56,38 +62,162 @@ void Disk::sanity_check(int blocknum, char *data) {
     }
 }
 
-void Disk::read(int blocknum, char *data) {
-    sanity_check(blocknum, data);
+size_t Disk::sanity_check(int blocknum, const struct iovec *iov, int iovcnt) {
+    char   what[BUFSIZ];
+    size_t bytes = 0;
 
-    if (lseek(FileDescriptor, blocknum*BLOCK_SIZE, SEEK_SET) < 0) {
-    	char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, "Unable to lseek %d: %s", blocknum, strerror(errno));
-    	throw std::runtime_error(what);
+    if (iovcnt <= 0) {
+    	snprintf(what, BUFSIZ, "iovcnt (%d) is not positive!", iovcnt);
+    	throw std::invalid_argument(what);
     }
 
-    if (::read(FileDescriptor, data, BLOCK_SIZE) != BLOCK_SIZE) {
+    for (int i = 0; i < iovcnt; i++) {
+    	if (iov[i].iov_len == 0 || iov[i].iov_len % BLOCK_SIZE) {
+    	    snprintf(what, BUFSIZ, "iov_len (%lu) is not a multiple of a block!", iov[i].iov_len);
+    	    throw std::invalid_argument(what);
+    	}
+
+    	bytes += iov[i].iov_len;
+    	sanity_check(blocknum, (char *)iov[i].iov_base);
+    }
+
+    // last block covered must exist as well
+    sanity_check(blocknum + (int)(bytes / BLOCK_SIZE) - 1, (char *)iov[0].iov_base);
+    return bytes / BLOCK_SIZE;
+}
+
+void Disk::read(int blocknum, char *data) {
+    sanity_check(blocknum, data);
+
+    Syscalls++;
+    if (pread(FileDescriptor, data, BLOCK_SIZE, (off_t)blocknum*BLOCK_SIZE) != BLOCK_SIZE) {
     	char what[BUFSIZ];
     	snprintf(what, BUFSIZ, "Unable to read %d: %s", blocknum, strerror(errno));
     	throw std::runtime_error(what);
     }
 
     Reads++;
+    trace(Tracer::DISK_READ, blocknum);
 }
 
 void Disk::write(int blocknum, char *data) {
     sanity_check(blocknum, data);
 
-    if (lseek(FileDescriptor, blocknum*BLOCK_SIZE, SEEK_SET) < 0) {
+    Syscalls++;
+    if (pwrite(FileDescriptor, data, BLOCK_SIZE, (off_t)blocknum*BLOCK_SIZE) != BLOCK_SIZE) {
     	char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, "Unable to lseek %d: %s", blocknum, strerror(errno));
+    	snprintf(what, BUFSIZ, "Unable to write %d: %s", blocknum, strerror(errno));
     	throw std::runtime_error(what);
     }
 
-    if (::write(FileDescriptor, data, BLOCK_SIZE) != BLOCK_SIZE) {
+    Writes++;
+    trace(Tracer::DISK_WRITE, blocknum);
+}
+
+void Disk::readv(int blocknum, size_t count, char *data) {
+    struct iovec iov = {data, count*BLOCK_SIZE};
+    readv(blocknum, &iov, 1);
+}
+
+void Disk::readv(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count = sanity_check(blocknum, iov, iovcnt);
+
+    // the kernel caps the number of buffers per call
+    for (int done = 0; done < iovcnt; ) {
+    	int     batch = std::min(iovcnt - done, IOV_MAX);
+    	ssize_t bytes = 0;
+    	for (int i = done; i < done + batch; i++)
+    	    bytes += iov[i].iov_len;
+
+    	Syscalls++;
+    	if (preadv(FileDescriptor, iov + done, batch, (off_t)blocknum*BLOCK_SIZE) != bytes) {
+    	    char what[BUFSIZ];
+    	    snprintf(what, BUFSIZ, "Unable to read %d+%lu: %s", blocknum, bytes / BLOCK_SIZE, strerror(errno));
+    	    throw std::runtime_error(what);
+    	}
+
+    	blocknum += bytes / BLOCK_SIZE;
+    	done     += batch;
+    }
+
+    Reads += count;
+    trace(Tracer::DISK_READ, blocknum - count, count);
+}
+
+void Disk::write(int blocknum, char *data, size_t count) {
+    struct iovec iov = {data, count*BLOCK_SIZE};
+    writev(blocknum, &iov, 1);
+}
+
+void Disk::writev(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count = sanity_check(blocknum, iov, iovcnt);
+
+    // the kernel caps the number of buffers per call
+    for (int done = 0; done < iovcnt; ) {
+    	int     batch = std::min(iovcnt - done, IOV_MAX);
+    	ssize_t bytes = 0;
+    	for (int i = done; i < done + batch; i++)
+    	    bytes += iov[i].iov_len;
+
+    	Syscalls++;
+    	if (pwritev(FileDescriptor, iov + done, batch, (off_t)blocknum*BLOCK_SIZE) != bytes) {
+    	    char what[BUFSIZ];
+    	    snprintf(what, BUFSIZ, "Unable to write %d+%lu: %s", blocknum, bytes / BLOCK_SIZE, strerror(errno));
+    	    throw std::runtime_error(what);
+    	}
+
+    	blocknum += bytes / BLOCK_SIZE;
+    	done     += batch;
+    }
+
+    Writes += count;
+    trace(Tracer::DISK_WRITE, blocknum - count, count);
+}
+
+void Disk::zero(int blocknum, size_t count, bool release) {
+    static char empty[BLOCK_SIZE];
+
+    if (count == 0)
+    	return;
+    sanity_check(blocknum, empty);
+    sanity_check(blocknum + (int)count - 1, empty);
+
+    if (release) {
+    	Syscalls++;
+    	if (fallocate(FileDescriptor, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+    	    (off_t)blocknum*BLOCK_SIZE, (off_t)count*BLOCK_SIZE) == 0) {
+    	    Punches += count;
+    	    trace(Tracer::DISK_ZERO, blocknum, count);
+    	    return;
+    	}
+
+    	if (errno != EOPNOTSUPP && errno != ENOSYS) {
+    	    char what[BUFSIZ];
+    	    snprintf(what, BUFSIZ, "Unable to zero %d+%lu: %s", blocknum, count, strerror(errno));
+    	    throw std::runtime_error(what);
+    	}
+    }
+
+    // every buffer points at the same zero block, so no large buffer is needed
+    struct iovec iov[ZERO_BATCH];
+    for (size_t i = 0; i < ZERO_BATCH; i++)
+    	iov[i] = {empty, BLOCK_SIZE};
+
+    while (count > 0) {
+    	size_t batch = std::min(count, (size_t)ZERO_BATCH);
+    	writev(blocknum, iov, batch);
+    	blocknum += batch;
+    	count    -= batch;
+    }
+}
+
+void Disk::sync() {
+    Syscalls++;
+    if (fsync(FileDescriptor) < 0) {
     	char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, "Unable to write %d: %s", blocknum, strerror(errno));
+    	snprintf(what, BUFSIZ, "Unable to sync: %s", strerror(errno));
     	throw std::runtime_error(what);
     }
 
-    Writes++;
+    trace(Tracer::DISK_SYNC, 0, 0);
 }
@@ -0,0 +1,162 @@
+// file.cpp: Open file handle
+
+#include "sfs/file.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+ssize_t File::pread(char *data, size_t length, size_t offset) {
+    if (fs == NULL)
+        return -1;
+
+    Stats::Timer timer(fs->statistics, Stats::READ);
+    ReadGuard guard(fs->mountLock);
+    ReadGuard inodeGuard(fs->inode_lock(Inumber));
+
+    // nothing to read at or past end of file
+    size_t fileSize = FileSystem::inode_size(Node);
+    if (offset >= fileSize || length == 0)
+        return 0;
+
+    // inline data is in the pinned inode
+    size_t rlength = std::min(length, fileSize - offset);
+    if (FileSystem::is_inline(Node)) {
+        memcpy(data, FileSystem::inline_bytes(&Node) + offset, rlength);
+        fs->statistics.add(Stats::BYTES_READ, rlength);
+        return rlength;
+    }
+
+    // index the pinned map, no inode or pointer block is read
+    size_t size = 0;
+    size_t first = offset / Disk::BLOCK_SIZE;
+    size_t last = (offset + rlength + Disk::BLOCK_SIZE - 1) / Disk::BLOCK_SIZE;
+    size_t skipBlocks = 0;
+    size_t remainder = offset % Disk::BLOCK_SIZE;
+
+    Disk::Batch pending;
+    ssize_t result = fs->readArray(&Map[first], last - first, &size,
+    &skipBlocks, &remainder, &rlength, data, &pending);
+
+    // queued block reads land in data, so they must finish before returning
+    fs->disk->wait(&pending);
+
+    if (result != 0)
+        return -1;
+    fs->statistics.add(Stats::BYTES_READ, size);
+
+    // fetch what a sequential reader asks for next while it uses this
+    size_t aheadStart, aheadEnd;
+    fs->plan_readahead(Inumber, offset, size, (fileSize + Disk::BLOCK_SIZE - 1) / Disk::BLOCK_SIZE,
+        &aheadStart, &aheadEnd);
+    if (aheadStart < aheadEnd)
+        fs->read_ahead(&Map[aheadStart], std::min(aheadEnd, Map.size()) - aheadStart);
+
+    return size;
+}
+
+ssize_t File::pwrite(char *data, size_t length, size_t offset) {
+    if (fs == NULL)
+        return -1;
+
+    Stats::Timer timer(fs->statistics, Stats::WRITE);
+    FileSystem::Operation operation(fs);
+    ReadGuard  guard(fs->mountLock);
+    WriteGuard inodeGuard(fs->inode_lock(Inumber));
+    return write_locked(data, length, offset);
+}
+
+ssize_t File::append(char *data, size_t length) {
+    if (fs == NULL)
+        return -1;
+
+    Stats::Timer timer(fs->statistics, Stats::WRITE);
+    FileSystem::Operation operation(fs);
+    ReadGuard  guard(fs->mountLock);
+    WriteGuard inodeGuard(fs->inode_lock(Inumber));
+    return write_locked(data, length, FileSystem::inode_size(Node));
+}
+
+ssize_t File::write_locked(char *data, size_t length, size_t offset) {
+    if (length == 0)
+        return 0;
+
+    // nothing maps blocks past the largest file
+    if ((offset + length + Disk::BLOCK_SIZE - 1) / Disk::BLOCK_SIZE > fs->max_file_blocks())
+        return -1;
+
+    // small files stay in the inode, until they outgrow it
+    if (fs->fits_inline(Node, std::max<uint64_t>(FileSystem::inode_size(Node), offset + length))) {
+        fs->write_inline(&Node, data, length, offset);
+        NodeDirty = true;
+        fs->statistics.add(Stats::BYTES_WRITTEN, length);
+        return length;
+    }
+
+    // the pinned map starts out with the block the data moved to
+    if (FileSystem::is_inline(Node)) {
+        uint32_t block;
+        if (!fs->promote_inline(&Node, &block))
+            return -1;
+        NodeDirty = true;
+        Map.assign(block ? 1 : 0, block);
+    }
+
+    // reserve all missing blocks up front so they are handed out as runs,
+    // new pointer blocks go to the cache right away
+    size_t first = offset / Disk::BLOCK_SIZE;
+    size_t last = (offset + length + Disk::BLOCK_SIZE - 1) / Disk::BLOCK_SIZE;
+    std::vector<uint32_t> map(last - first);
+    fs->reserve_blocks(&Node, offset, length, map.data(), data);
+    NodeDirty = true;
+
+    // pinned map covers the file, and whatever was reserved past its end
+    if (Map.size() < last)
+        Map.resize(last);
+    std::copy(map.begin(), map.end(), Map.begin() + first);
+
+    size_t rlength = length;
+    size_t size = 0;
+    size_t skipBlocks = 0;
+    size_t remainder = offset % Disk::BLOCK_SIZE;
+
+    Disk::Batch pending;
+    ssize_t result = fs->writeArray(map.data(), map.size(), &size,
+    &skipBlocks, &remainder, &rlength, data, &pending);
+
+    // queued block writes still point into data
+    fs->disk->wait(&pending);
+
+    // overwriting existing data does not grow the file
+    if (size > 0)
+        FileSystem::set_inode_size(&Node, std::max<uint64_t>(FileSystem::inode_size(Node), offset + size));
+    fs->statistics.add(Stats::BYTES_WRITTEN, size);
+
+    // anything but a completed write means we ran out of blocks
+    return result == 0 ? (ssize_t)size : -1;
+}
+
+void File::flush() {
+    if (NodeDirty) {
+        fs->save_inode(Inumber, &Node);
+        NodeDirty = false;
+    }
+}
+
+bool File::close() {
+    if (fs == NULL)
+        return false;
+
+    {
+        FileSystem::Operation operation(fs);
+        ReadGuard  guard(fs->mountLock);
+        WriteGuard inodeGuard(fs->inode_lock(Inumber));
+        flush();
+
+        std::lock_guard<std::mutex> metaGuard(fs->metaLock);
+        fs->openFiles.erase(Inumber);
+    }
+
+    fs = NULL;
+    return true;
+}
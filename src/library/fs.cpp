@@ -1,10 +1,16 @@
 // fs.cpp: File System
 
 #include "sfs/fs.h"
+#include "sfs/file.h"
 
 #include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -19,50 +25,86 @@ void FileSystem::debug(Disk *disk) {
     printf("SuperBlock:\n");
     printf("    magic number is %s\n", 
         superBlock.Super.MagicNumber == MAGIC_NUMBER ? "valid" : "invalid");
+    if (superBlock.Super.Version >= VERSION_BITMAPS)
+        printf("    version %u\n"    , superBlock.Super.Version);
     printf("    %u blocks\n"         , superBlock.Super.Blocks);
+    if (superBlock.Super.Version >= VERSION_BITMAPS) {
+        printf("    %u bitmap blocks\n"      , superBlock.Super.BitmapBlocks);
+        printf("    %u inode bitmap blocks\n", superBlock.Super.InodeBitmapBlocks);
+    }
+    if (superBlock.Super.Version >= VERSION_JOURNAL)
+        printf("    %u journal blocks\n" , superBlock.Super.JournalBlocks);
     printf("    %u inode blocks\n"   , superBlock.Super.InodeBlocks);
+    if (superBlock.Super.Version >= VERSION_INODE_MARK)
+        printf("    %u initialized inode blocks\n", superBlock.Super.InitializedInodeBlocks);
     printf("    %u inodes\n"         , superBlock.Super.Inodes);
+    if (superBlock.Super.RootDirectory)
+        printf("    root directory is inode %u\n", superBlock.Super.RootDirectory - 1);
 
-    // Read Inode blocks
+    // Read Inode blocks, those past the high-water mark hold no inodes
     Block inodeBlock;
+    size_t inodeStart = inode_start(superBlock.Super);
+    size_t inodeBlocks = superBlock.Super.InodeBlocks;
+    if (superBlock.Super.Version >= VERSION_INODE_MARK)
+        inodeBlocks = std::min(inodeBlocks, (size_t)superBlock.Super.InitializedInodeBlocks);
     // loop over inode blocks
-    for (size_t i = 0; i < superBlock.Super.InodeBlocks; i++) {
+    for (size_t i = 0; i < inodeBlocks; i++) {
         // read in one inode block
-        disk->read(i + 1, inodeBlock.Data);
+        disk->read(inodeStart + i, inodeBlock.Data);
+        Inode inodes[INODES_PER_BLOCK];
+        decode_inodes(inodeBlock.Data, superBlock.Super.Version, inodes);
 
         // loop over inodes in the block
-        for (size_t j = 0; j < INODES_PER_BLOCK; j++) {
-            Inode inode = inodeBlock.Inodes[j];
+        for (size_t j = 0; j < inodes_per_block(superBlock.Super.Version); j++) {
+            Inode inode = inodes[j];
 
             // skip invalid inode
             if (!inode.Valid)
                 continue;
+
+            printf("Inode %zu:\n"            , j);
+            printf("    size: %lu bytes\n"  , (unsigned long)inode_size(inode));
+
+            // inline data has no blocks to list
+            if (is_inline(inode)) {
+                printf("    inline data\n");
+                continue;
+            }
             
             // loop over direct blocks
             std::string directBlocks = "";
             debugArray(inode.Direct, POINTERS_PER_INODE, &directBlocks);
-            printf("Inode %zu:\n"            , j);
-            printf("    size: %u bytes\n"   , inode.Size);
             printf("    direct blocks:%s\n" , directBlocks.c_str());
 
-            // skip invalid indirect node
-            if (!inode.Indirect)
-                continue;
-            
-            // loop over indirect blocks
-            Block indirect;
-            disk->read(inode.Indirect, indirect.Data);
-            std::string indirectBlocks = "";
-            debugArray(indirect.Pointers, POINTERS_PER_BLOCK, &indirectBlocks);
-            printf("    indirect block: %u\n"       , inode.Indirect);
-            printf("    indirect data blocks:%s\n"  , indirectBlocks.c_str());
+            // loop over indirect blocks if there are
+            if (inode.Indirect) {
+                std::string indirectBlocks = "";
+                debugTree(disk, inode.Indirect, 1, &indirectBlocks);
+                printf("    indirect block: %u\n"       , inode.Indirect);
+                printf("    indirect data blocks:%s\n"  , indirectBlocks.c_str());
+            }
+
+            // only wide inodes have deeper trees
+            if (inode.DoubleIndirect) {
+                std::string doubleBlocks = "";
+                debugTree(disk, inode.DoubleIndirect, 2, &doubleBlocks);
+                printf("    double indirect block: %u\n"       , inode.DoubleIndirect);
+                printf("    double indirect data blocks:%s\n"  , doubleBlocks.c_str());
+            }
+
+            if (inode.TripleIndirect) {
+                std::string tripleBlocks = "";
+                debugTree(disk, inode.TripleIndirect, 3, &tripleBlocks);
+                printf("    triple indirect block: %u\n"       , inode.TripleIndirect);
+                printf("    triple indirect data blocks:%s\n"  , tripleBlocks.c_str());
+            }
         }
     }
 }
 
 // Format file system ----------------------------------------------------------
 
-bool FileSystem::format(Disk *disk) {
+bool FileSystem::format(Disk *disk, bool full) {
     // return false if mounted
     if (disk->mounted())
         return false;
@@ -73,22 +115,60 @@ bool FileSystem::format(Disk *disk) {
     superBlock.Super.MagicNumber = MAGIC_NUMBER;
     superBlock.Super.Blocks = disk->size();
     superBlock.Super.InodeBlocks = 0.1 * disk->size() + 0.5; // 0.5 for rounding
-    superBlock.Super.Inodes = superBlock.Super.InodeBlocks * INODES_PER_BLOCK;
+    superBlock.Super.Inodes = superBlock.Super.InodeBlocks * inodes_per_block(VERSION);
+    superBlock.Super.Version = VERSION;
+    superBlock.Super.BitmapBlocks = 
+        (superBlock.Super.Blocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    superBlock.Super.InodeBitmapBlocks = 
+        (superBlock.Super.Inodes + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    superBlock.Super.InitializedInodeBlocks = 0;
+    superBlock.Super.JournalBlocks = journal_blocks(superBlock.Super.Blocks);
+
+    // metadata must leave room for data
+    size_t inodeStart = inode_start(superBlock.Super);
+    if (inodeStart + superBlock.Super.InodeBlocks >= superBlock.Super.Blocks)
+        return false;
+
     disk->write(0, superBlock.Data);
 
-    // Clear all other blocks
-    Block empty;
-    memset(empty.Data, 0, disk->BLOCK_SIZE);
-    for (size_t i = 1; i < superBlock.Super.Blocks; i++) {
-        disk->write(i, empty.Data);
+    // Write bitmaps, every data block and every inode is free
+    Allocator freeBlocks;
+    freeBlocks.assign(superBlock.Super.Blocks, inodeStart + superBlock.Super.InodeBlocks);
+    Bitmap freeInodes;
+    freeInodes.assign(superBlock.Super.Inodes, true);
+
+    size_t blockBytes = superBlock.Super.BitmapBlocks * disk->BLOCK_SIZE;
+    size_t inodeBytes = superBlock.Super.InodeBitmapBlocks * disk->BLOCK_SIZE;
+    std::vector<char> bitmaps(blockBytes + inodeBytes);
+    freeBlocks.bitmap().copy_out(0, bitmaps.data(), blockBytes);
+    freeInodes.copy_out(0, bitmaps.data() + blockBytes, inodeBytes);
+    disk->write(1, bitmaps.data(), superBlock.Super.BitmapBlocks + superBlock.Super.InodeBitmapBlocks);
+
+    // Write empty journal, records left over from an earlier file system
+    // carry another identity and are never replayed
+    if (superBlock.Super.JournalBlocks) {
+        Block header;
+        memset(header.Data, 0, disk->BLOCK_SIZE);
+        header.Journal.Magic = JOURNAL_MAGIC;
+        header.Journal.Type = JOURNAL_HEADER;
+        header.Journal.Id = std::random_device()();
+        header.Journal.Sequence = 1;
+        disk->write(1 + superBlock.Super.BitmapBlocks + superBlock.Super.InodeBitmapBlocks, header.Data);
     }
 
+    // Clear all other blocks, the inode table is never read before it is
+    // written so only a full format has to put zeros on disk
+    disk->zero(inodeStart, superBlock.Super.Blocks - inodeStart, !full);
+
     return true;
 }
 
 // Mount file system -----------------------------------------------------------
 
 bool FileSystem::mount(Disk *disk) {
+    Stats::Timer timer(statistics, Stats::MOUNT);
+    WriteGuard guard(mountLock);
+
     // return false if mounted, prevent repeated mounting
     if (disk->mounted())
         return false;
@@ -99,7 +179,22 @@ bool FileSystem::mount(Disk *disk) {
 
     if (superBlock.Super.MagicNumber != MAGIC_NUMBER  // check magic number
     || superBlock.Super.InodeBlocks != (size_t)((float)(superBlock.Super.Blocks * 0.1) + 0.5)  // check inode ratio
-    || superBlock.Super.Inodes != superBlock.Super.InodeBlocks * INODES_PER_BLOCK) // check inode number
+    || superBlock.Super.Inodes != superBlock.Super.InodeBlocks * inodes_per_block(superBlock.Super.Version) // check inode number
+    || superBlock.Super.Version > VERSION) // check format version
+        return false;
+
+    if (superBlock.Super.Version >= VERSION_BITMAPS // check bitmap sizes
+    && (superBlock.Super.BitmapBlocks != (superBlock.Super.Blocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK
+    || superBlock.Super.InodeBitmapBlocks != (superBlock.Super.Inodes + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK
+    || inode_start(superBlock.Super) + superBlock.Super.InodeBlocks > superBlock.Super.Blocks))
+        return false;
+
+    if (superBlock.Super.Version >= VERSION_JOURNAL // check journal size
+    && superBlock.Super.JournalBlocks != journal_blocks(superBlock.Super.Blocks))
+        return false;
+
+    if (superBlock.Super.Version >= VERSION_INODE_MARK // check high-water mark
+    && superBlock.Super.InitializedInodeBlocks > superBlock.Super.InodeBlocks)
         return false;
 
     // Set device and mount
@@ -107,56 +202,218 @@ bool FileSystem::mount(Disk *disk) {
 
     // Copy metadata
     this->disk = disk;
+    note_read(Stats::SUPER_BLOCK, 0);
     this->blocks = superBlock.Super.Blocks;
     this->inodeBlocks = superBlock.Super.InodeBlocks;
     this->inodes = superBlock.Super.Inodes;
+    this->version = superBlock.Super.Version;
+    this->bitmapBlocks = version >= VERSION_BITMAPS ? superBlock.Super.BitmapBlocks : 0;
+    this->inodeBitmapBlocks = version >= VERSION_BITMAPS ? superBlock.Super.InodeBitmapBlocks : 0;
+    this->inodeStart = inode_start(superBlock.Super);
+    this->initializedInodeBlocks = version >= VERSION_INODE_MARK ? superBlock.Super.InitializedInodeBlocks : inodeBlocks;
+    this->superBlockDirty = false;
+    this->rootDirectory = superBlock.Super.RootDirectory;
+    this->inodesPerBlock = inodes_per_block(version);
+    this->maxDepth = version >= VERSION_WIDE_INODES ? MAX_DEPTH : 1;
+    this->journalStart = 1 + bitmapBlocks + inodeBitmapBlocks;
+    this->journalBlocks = version >= VERSION_JOURNAL ? superBlock.Super.JournalBlocks : 0;
+
+    pendingPointers.clear();
+    journaledPointers.clear();
+    revokedBlocks.clear();
+    dirtyMetadata = 0;
+    finishedOperations = 0;
+    committedOperations = 0;
+    commitCount = 0;
+    journalWrites = 0;
+    checkpointCount = 0;
+
+    // Put committed metadata in place before anything reads it
+    if (journalBlocks) {
+        bool replayed;
+        if (!replay_journal(&replayed)) {
+            disk->unmount();
+            this->disk = NULL;
+            return false;
+        }
+
+        // the high-water mark may have moved
+        if (replayed) {
+            disk->read(0, superBlock.Data);
+            note_read(Stats::SUPER_BLOCK, 0);
+            this->initializedInodeBlocks = superBlock.Super.InitializedInodeBlocks;
+            this->rootDirectory = superBlock.Super.RootDirectory;
+        }
+    }
+
+    // All further block I/O goes through the cache
+    blockCache.attach(disk);
+    reset_streams();
 
-    // Allocate free block bitmap
-    initialize_free_blocks();
+    // Inode table stays resident once its blocks are read
+    load_inode_table();
+
+    if (version >= VERSION_BITMAPS) {
+        // Bitmaps are on disk, inode blocks are only read on first use
+        load_bitmaps();
+    } else {
+        // Legacy image, rebuild bitmaps by scanning every inode
+        scan_metadata();
+    }
 
     return true;
 }
 
-// Create inode ----------------------------------------------------------------
+// Check file system -----------------------------------------------------------
 
-ssize_t FileSystem::create() {
-    // Locate free inode in inode table
-    // Read Inode blocks
-    Block inodeBlock;
-    Inode inode;
-    // loop over inode blocks to find an empty inode
-    ssize_t inumber = -1;
-    for (size_t i = 0; i < inodeBlocks; i++) {
-        // read in one inode block
-        disk->read(i + 1, inodeBlock.Data);
+bool FileSystem::check() {
+    WriteGuard guard(mountLock);
 
-        // loop over inodes in the block
-        for (size_t j = 0; j < INODES_PER_BLOCK; j++) {
-            inode = inodeBlock.Inodes[j];
-            // find invalid inode
-            if (!inode.Valid) {
-                inumber =  i * INODES_PER_BLOCK + j;
-                break;
-            }
-        }
+    // nothing to check if not mounted
+    if (!disk)
+        return false;
 
-        // break if already found invalid node
-        if (inumber != -1)
-            break;
+    // blocks reserved through open handles must be in the inode table, and
+    // pointer blocks waiting for the journal in the cache
+    flush_files();
+    if (journalBlocks)
+        commit();
+
+    // keep bitmaps as loaded, then rebuild both by scanning like a legacy mount
+    Bitmap loadedInodes = freeInodes;
+    Bitmap loadedBlocks = blockAllocator.bitmap();
+
+    scan_metadata();
+
+    if (freeInodes == loadedInodes && blockAllocator.bitmap() == loadedBlocks)
+        return true;
+
+    // scanned bitmaps win, write them all back
+    dirtyBitmapBlocks.assign(bitmapBlocks + inodeBitmapBlocks, true);
+    return false;
+}
+
+// Unmount file system ---------------------------------------------------------
+
+void FileSystem::unmount() {
+    WriteGuard guard(mountLock);
+
+    // nothing to do if not mounted
+    if (!disk)
+        return;
+
+    // write back dirty blocks before letting go of the disk, leaving the
+    // journal empty
+    flush_all();
+    if (journalBlocks) {
+        checkpoint();
+        disk->sync();
+    }
+    blockCache.detach();
+
+    // handles still open are closed behind their owners' backs
+    for (auto &open : openFiles)
+        open.second->fs = NULL;
+    openFiles.clear();
+
+    inodeTable.clear();
+    loadedInodeBlocks.clear();
+    dirtyInodeBlocks.clear();
+    dirtyBitmapBlocks.clear();
+    freeInodes.assign(0, false);
+
+    disk->unmount();
+    disk = NULL;
+}
+
+FileSystem::~FileSystem() {
+    unmount();
+}
+
+// Sync file system ------------------------------------------------------------
+
+void FileSystem::sync() {
+    // waits for running operations, so the flushed state is consistent
+    WriteGuard guard(mountLock);
+    flush_all();
+}
+
+void FileSystem::flush_all() {
+    // operations finished so far are all in what is flushed
+    size_t covered = finishedOperations;
+
+    flush_files();
+    if (journalBlocks) {
+        commit();
+    } else {
+        flush_inodes();
+        flush_superblock();
+        flush_bitmaps();
+        blockCache.sync();
+        dirtyMetadata = 0;
     }
 
+    if (committedOperations < covered)
+        committedOperations = covered;
+}
+
+void FileSystem::flush_files() {
+    // mount lock is held exclusively, so no handle is in use
+    for (auto &open : openFiles)
+        open.second->flush();
+}
+
+bool FileSystem::is_open(size_t inumber) {
+    std::lock_guard<std::mutex> guard(metaLock);
+    return openFiles.count(inumber) > 0;
+}
+
+void FileSystem::flush_superblock() {
+    // only the high-water mark and root directory change after format
+    if (!superBlockDirty)
+        return;
+
+    // block 0 sorts first, so the mark is on disk before the blocks it covers
+    Block superBlock;
+    superblock_image(&superBlock);
+    blockCache.write(0, superBlock.Data);
+    note_write(Stats::SUPER_BLOCK, 0);
+    superBlockDirty = false;
+}
+
+void FileSystem::superblock_image(Block *superBlock) {
+    memset(superBlock->Data, 0, disk->BLOCK_SIZE);
+    superBlock->Super.MagicNumber = MAGIC_NUMBER;
+    superBlock->Super.Blocks = blocks;
+    superBlock->Super.InodeBlocks = inodeBlocks;
+    superBlock->Super.Inodes = inodes;
+    superBlock->Super.Version = version;
+    superBlock->Super.BitmapBlocks = bitmapBlocks;
+    superBlock->Super.InodeBitmapBlocks = inodeBitmapBlocks;
+    superBlock->Super.InitializedInodeBlocks = initializedInodeBlocks;
+    superBlock->Super.JournalBlocks = journalBlocks;
+    superBlock->Super.RootDirectory = rootDirectory;
+}
+
+// Create inode ----------------------------------------------------------------
+
+ssize_t FileSystem::create() {
+    Stats::Timer timer(statistics, Stats::CREATE);
+    Operation operation(this);
+    ReadGuard guard(mountLock);
+
+    // Locate free inode in free inode bitmap
+    ssize_t inumber = allocate_free_inode();
+
     // found, write inode
     if (inumber != -1) {
+        // size and every pointer start out zero
         Inode inode;
+        memset(&inode, 0, sizeof(inode));
         inode.Valid = 1;
-        inode.Size = 0;
-        for (size_t k = 0; k < POINTERS_PER_INODE; k++) {
-            inode.Direct[k] = 0;
-        }
-        inode.Indirect = 0;
 
-        // write inode onto disk
-        save_inode(inumber, &inode, &inodeBlock, false);
+        // record inode in inode table
+        save_inode(inumber, &inode);
     }
 
     // Record inode, if not found, inumber = -1
@@ -166,112 +423,270 @@ ssize_t FileSystem::create() {
 // Remove inode ----------------------------------------------------------------
 
 bool FileSystem::remove(size_t inumber) {
-    // Load inode information
-    Block inodeBlock;
+    Stats::Timer timer(statistics, Stats::REMOVE);
+    Operation  operation(this);
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    // Load inode information, an open inode stays until closed
     Inode inode;
-    if (!load_inode(inumber, &inode, &inodeBlock, true))
+    if (!load_inode(inumber, &inode) || is_open(inumber))
         // invalid inode to remove
         return false;
 
-    // Free direct blocks
-    for (size_t i = 0; i < POINTERS_PER_INODE; i++) {
-        bitMap[inode.Direct[i]] = FREE;
-    }
-
-    // Free indirect blocks if there are
-    if (inode.Indirect) {
-        Block indirect;
-        disk->read(inode.Indirect, indirect.Data);
-        for (size_t i = 0; i < POINTERS_PER_BLOCK; i++) {
-            bitMap[indirect.Pointers[i]] = FREE;
+    // inline data goes with the inode
+    if (!is_inline(inode)) {
+        // Free direct blocks
+        for (size_t i = 0; i < POINTERS_PER_INODE; i++) {
+            free_block(data_block(inode.Direct[i]));
         }
+
+        // Free indirect trees if there are, including the pointer blocks themselves
+        free_tree(inode.Indirect, 1);
+        free_tree(inode.DoubleIndirect, 2);
+        free_tree(inode.TripleIndirect, 3);
     }
 
     // Clear inode in inode table
     inode.Valid = 0;
-    save_inode(inumber, &inode, &inodeBlock, false);
+    inode.Flags = 0;
+    save_inode(inumber, &inode);
+
+    // Return inode to free inode bitmap
+    free_inode(inumber);
 
     return true;
 }
 
+// Open inode ------------------------------------------------------------------
+
+bool FileSystem::open(size_t inumber, File *file) {
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    if (file->is_open() || is_open(inumber))
+        return false;
+
+    // Load inode information
+    Inode inode;
+    if (!load_inode(inumber, &inode))
+        return false;
+
+    // pin inode and decode its block map once, inline data has none
+    file->Node = inode;
+    file->Map.resize(is_inline(inode) ? 0 : (inode_size(inode) + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE);
+    map_blocks(&inode, 0, file->Map.size(), file->Map.data());
+
+    file->Inumber = inumber;
+    file->NodeDirty = false;
+    file->fs = this;
+
+    std::lock_guard<std::mutex> metaGuard(metaLock);
+    openFiles[inumber] = file;
+    return true;
+}
+
 // Inode stat ------------------------------------------------------------------
 
 ssize_t FileSystem::stat(size_t inumber) {
+    ReadGuard guard(mountLock);
+    ReadGuard inodeGuard(inode_lock(inumber));
+
     // Load inode information
-    Block inodeBlock;
     Inode inode;
-    if (!load_inode(inumber, &inode, &inodeBlock, true)) {
+    if (!load_inode(inumber, &inode)) {
         // invalid inode to remove
         return -1;
     }
     
-    return inode.Size;
+    return inode_size(inode);
+}
+
+ssize_t FileSystem::extents(size_t inumber) {
+    ReadGuard guard(mountLock);
+    ReadGuard inodeGuard(inode_lock(inumber));
+
+    Inode inode;
+    if (!load_inode(inumber, &inode))
+        return -1;
+    if (is_inline(inode))
+        return 0;
+
+    std::vector<uint32_t> map((inode_size(inode) + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE);
+    map_blocks(&inode, 0, map.size(), map.data());
+
+    // a new extent starts wherever a block does not follow the one before
+    size_t count = 0;
+    uint32_t previous = 0;
+    for (auto pointer : map) {
+        uint32_t block = data_block(pointer);
+        if (block && block != previous + 1)
+            count++;
+        previous = block;
+    }
+    return count;
+}
+
+// Root directory --------------------------------------------------------------
+
+ssize_t FileSystem::root_directory() {
+    ReadGuard guard(mountLock);
+    std::lock_guard<std::mutex> metaGuard(metaLock);
+    return (ssize_t)rootDirectory - 1;
+}
+
+bool FileSystem::set_root_directory(size_t inumber) {
+    Operation operation(this);
+    ReadGuard guard(mountLock);
+
+    Inode inode;
+    if (!load_inode(inumber, &inode))
+        return false;
+
+    // goes out with the next flush or commit, like the high-water mark
+    std::lock_guard<std::mutex> metaGuard(metaLock);
+    rootDirectory = inumber + 1;
+    superBlockDirty = true;
+    dirtyMetadata++;
+    return true;
 }
 
 // Read from inode -------------------------------------------------------------
 
 ssize_t FileSystem::read(size_t inumber, char *data, size_t length, size_t offset) {
+    Stats::Timer timer(statistics, Stats::READ);
+    ReadGuard guard(mountLock);
+    ReadGuard inodeGuard(inode_lock(inumber));
+
     // Load inode information
-    Block inodeBlock;
     Inode inode;
-    if (!load_inode(inumber, &inode, &inodeBlock, true)) {
+    if (!load_inode(inumber, &inode)) {
         // invalid inode to remove
         return -1;
     }
 
-    // Adjust length, length shouldn't be larger than the data remaining
-    size_t rlength = std::min(length, inode.Size - offset);
-    size_t size = 0;
-
     // return when there is nothing to read
-    if (rlength == 0)
+    size_t fileSize = inode_size(inode);
+    size_t size = 0;
+    if (offset >= fileSize || length == 0)
         return size;
 
+    // Adjust length, length shouldn't be larger than the data remaining
+    size_t rlength = std::min(length, fileSize - offset);
+
+    // inline data came in with the inode
+    if (is_inline(inode)) {
+        memcpy(data, inline_bytes(&inode) + offset, rlength);
+        statistics.add(Stats::BYTES_READ, rlength);
+        return rlength;
+    }
+
+    // Look up the blocks being read, unmapped ones are holes
+    size_t first = offset / disk->BLOCK_SIZE;
+    std::vector<uint32_t> map((offset + rlength + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE - first);
+    map_blocks(&inode, first, map.size(), map.data());
+
     // Read block and copy to data
-    size_t skipBlocks = offset / disk->BLOCK_SIZE;
+    size_t skipBlocks = 0;
     size_t remainder = offset % disk->BLOCK_SIZE;
 
-    switch (readArray(inode.Direct, POINTERS_PER_INODE, &size, 
-    &skipBlocks, &remainder, &rlength, data)) {
-        case 0: // if read finished
-            return size;
-        case -1: // error occurred
-            return -1;
-        case 1: // still needs reading
-            break;
-    }
-    
-    // indirect block needs to be read
-    // if there is no indirect block
-    if (!inode.Indirect) {
+    Disk::Batch pending;
+    ssize_t result = readArray(map.data(), map.size(), &size,
+    &skipBlocks, &remainder, &rlength, data, &pending);
+
+    // queued block reads land in data, so they must finish before returning
+    disk->wait(&pending);
+
+    // still having bytes unread means something is wrong
+    if (result != 0)
         return -1;
+    statistics.add(Stats::BYTES_READ, size);
+
+    // fetch what a sequential reader asks for next while it uses this
+    size_t aheadStart, aheadEnd;
+    plan_readahead(inumber, offset, size, (fileSize + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE,
+        &aheadStart, &aheadEnd);
+    if (aheadStart < aheadEnd)
+        read_ahead(&inode, aheadStart, aheadEnd);
+
+    return size;
+}
+
+void FileSystem::plan_readahead(size_t inumber, size_t offset, size_t length, size_t fileBlocks, size_t *start, size_t *end) {
+    // the window must fit in the cache next to what is being read
+    size_t cap = blockCache.capacity() / 2;
+
+    std::lock_guard<std::mutex> guard(streamLock);
+    cap = std::min(cap, maxReadAhead);
+
+    Stream &stream = streams[inumber % READAHEAD_STREAMS];
+    bool sequential = stream.Inumber == inumber && stream.Next == offset;
+    if (sequential && stream.Window > 0) {
+        // still streaming, double the window
+        stream.Window = std::min(stream.Window * 2, cap);
+    } else if (sequential || offset == 0) {
+        // new stream, start small
+        stream.Window = std::min((size_t)READAHEAD_MIN, cap);
+        stream.Ahead = 0;
+    } else {
+        // random access, reading ahead would only waste cache
+        stream.Window = 0;
+        stream.Ahead = 0;
     }
+    stream.Inumber = inumber;
+    stream.Next = offset + length;
+
+    // refill once less than half a window is left, so prefetches stay batched
+    size_t last = (offset + length + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE;
+    *start = *end = 0;
+    if (stream.Window == 0 || stream.Ahead >= last + stream.Window / 2)
+        return;
+
+    *start = std::max(last, stream.Ahead);
+    *end = std::min(last + stream.Window, fileBlocks);
+    stream.Ahead = std::max(*start, *end);
+}
 
-    // read in indirect block
-    Block indirect;
-    disk->read(inode.Indirect, indirect.Data);
-    
-    switch (readArray(indirect.Pointers, POINTERS_PER_BLOCK, &size, 
-    &skipBlocks, &remainder, &rlength, data)) {
-        case 0: // if read finished
-            return size;
-        case -1: // error occurred
-            return -1;
-        case 1: // still needs reading
-            break;
+void FileSystem::read_ahead(Inode *inode, size_t start, size_t end) {
+    // pointer blocks come in through the cache, where the next read finds them
+    std::vector<uint32_t> pointers(end - start);
+    map_blocks(inode, start, pointers.size(), pointers.data());
+
+    read_ahead(pointers.data(), pointers.size());
+}
+
+void FileSystem::read_ahead(const uint32_t *map, size_t count) {
+    // corrupt pointers are left for the read that needs them to report
+    std::vector<uint32_t> pointers(map, map + count);
+    for (auto &pointer : pointers) {
+        if (pointer >= blocks)
+            pointer = 0;
+    }
+
+    blockCache.prefetch(pointers.data(), pointers.size());
+}
+
+void FileSystem::reset_streams() {
+    std::lock_guard<std::mutex> guard(streamLock);
+    for (auto &stream : streams) {
+        stream.Inumber = (size_t)-1;
+        stream.Next = 0;
+        stream.Window = 0;
+        stream.Ahead = 0;
     }
-        
-    // still have bytes unread, something wrong
-    return -1;
 }
 
 // Write to inode --------------------------------------------------------------
 
 ssize_t FileSystem::write(size_t inumber, char *data, size_t length, size_t offset) {
-    // Load inode
-    Block inodeBlock;
+    Stats::Timer timer(statistics, Stats::WRITE);
+    Operation  operation(this);
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    // Load inode, an open inode is only written through its handle
     Inode inode;
-    if (!load_inode(inumber, &inode, &inodeBlock, true)) {
+    if (!load_inode(inumber, &inode) || is_open(inumber)) {
         // invalid inode to remove
         return -1;
     }
@@ -283,179 +698,1307 @@ ssize_t FileSystem::write(size_t inumber, char *data, size_t length, size_t offs
     if (rlength == 0)
         return size;
 
-    // Read block and copy to data
-    size_t skipBlocks = offset / disk->BLOCK_SIZE;
+    // nothing maps blocks past the largest file
+    if ((offset + length + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE > max_file_blocks())
+        return -1;
+
+    // small files stay in the inode, until they outgrow it
+    if (fits_inline(inode, std::max<uint64_t>(inode_size(inode), offset + length))) {
+        write_inline(&inode, data, length, offset);
+        save_inode(inumber, &inode);
+        statistics.add(Stats::BYTES_WRITTEN, length);
+        return length;
+    }
+
+    uint32_t block;
+    if (is_inline(inode) && !promote_inline(&inode, &block))
+        return -1;
+
+    // reserve all missing blocks up front so they are handed out as runs
+    size_t first = offset / disk->BLOCK_SIZE;
+    std::vector<uint32_t> map((offset + length + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE - first);
+    reserve_blocks(&inode, offset, length, map.data(), data);
+
+    // Copy data to blocks
+    size_t skipBlocks = 0;
     size_t remainder = offset % disk->BLOCK_SIZE;
 
-    switch (writeArray(inode.Direct, POINTERS_PER_INODE, &size, 
-    &skipBlocks, &remainder, &rlength, data)) {
-        case 0: // if write finished
-            // update inode
-            inode.Size += size;
-            save_inode(inumber, &inode, &inodeBlock, false);
-            return size;
-        case -1: // error occurred
-            // update inode
-            inode.Size += size;
-            save_inode(inumber, &inode, &inodeBlock, false);
-            return -1;
-        case 1: // still needs writing
-            break;
+    Disk::Batch pending;
+    ssize_t result = writeArray(map.data(), map.size(), &size,
+    &skipBlocks, &remainder, &rlength, data, &pending);
+
+    // queued block writes still point into data
+    disk->wait(&pending);
+
+    // update inode, overwriting existing data does not grow the file
+    if (size > 0)
+        set_inode_size(&inode, std::max<uint64_t>(inode_size(inode), offset + size));
+    save_inode(inumber, &inode);
+    statistics.add(Stats::BYTES_WRITTEN, size);
+
+    // anything but a completed write means we ran out of blocks
+    return result == 0 ? (ssize_t)size : -1;
+}
+
+// Return whether or not a whole block is zero
+static bool is_zero(const char *data) {
+    const uint64_t *words = (const uint64_t *)data;
+    for (size_t i = 0; i < Disk::BLOCK_SIZE / sizeof(uint64_t); i++) {
+        if (words[i])
+            return false;
     }
-    
-    // indirect block needs to be read
-    Block indirect;
+    return true;
+}
 
-    // if there is no indirect block, allocate one
-    if (!inode.Indirect) {
-        ssize_t blockNum = allocate_free_block();
+void FileSystem::reserve_blocks(Inode *inode, size_t offset, size_t length, uint32_t *map, const char *data, bool unwritten) {
+    size_t first = offset / disk->BLOCK_SIZE;
+    size_t end   = (offset + length + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE;
+
+    // whole blocks of zeros that are not mapped yet are left as holes
+    std::vector<bool> holes;
+    if (sparseWrites && data != NULL) {
+        holes.resize(end - first);
+        for (size_t b = first; b < end; b++) {
+            holes[b - first] = b * disk->BLOCK_SIZE >= offset
+                && (b + 1) * disk->BLOCK_SIZE <= offset + length
+                && is_zero(data + b * disk->BLOCK_SIZE - offset);
+        }
+    }
 
-        // no free block
-        if (blockNum == -1)
-            return -1;
-        
-        inode.Indirect = blockNum;
+    // count missing data and pointer blocks on a copy of the map first, so
+    // they can all be asked for at once and handed out as runs
+    Cursor cursors[MAX_DEPTH + 1];
+    for (auto &cursor : cursors) {
+        cursor.Number = 0;
+        cursor.Dirty = false;
+    }
+
+    Reservation reservation = {true, unwritten, 0, 0, 0, 0, 0};
+    Inode copy = *inode;
+    map_blocks(&copy, first, end - first, map);
+    for (size_t b = first; b < end; b++) {
+        if (map[b - first] == 0 && (holes.empty() || !holes[b - first]))
+            walk(&copy, b, cursors, &reservation, NULL);
+    }
+
+    // preallocated blocks being written for the first time lose their flag
+    // on the way below
+    bool flagged = false;
+    for (size_t b = first; b < end && !unwritten; b++)
+        flagged |= (map[b - first] & UNWRITTEN) != 0;
 
-        memset(indirect.Data, 0, disk->BLOCK_SIZE);
+    if (reservation.Count == 0 && !flagged)
+        return;
+
+    // continue right after the block in front of the write
+    for (auto &cursor : cursors)
+        cursor.Number = 0;
+    uint32_t before = first > 0 ? data_block(walk(inode, first - 1, cursors, NULL, NULL)) : 0;
+    reservation = {false, unwritten, 0, 0, 0, before ? before + 1 : (size_t)0, reservation.Count};
+
+    // new blocks that are only partly written must not expose old contents
+    Block zero;
+    memset(zero.Data, 0, disk->BLOCK_SIZE);
+
+    for (size_t b = first; b < end; b++) {
+        if (!holes.empty() && holes[b - first] && map[b - first] == 0)
+            continue;
+
+        bool added = false;
+        map[b - first] = walk(inode, b, cursors, &reservation, &added);
+
+        if (added && !unwritten && ((b == first && offset % disk->BLOCK_SIZE) ||
+                      (b == end - 1 && (offset + length) % disk->BLOCK_SIZE))) {
+            blockCache.write(map[b - first], zero.Data);
+            note_write(Stats::DATA_BLOCK, map[b - first]);
+        }
+    }
+
+    for (auto &cursor : cursors)
+        write_back(&cursor);
+}
+
+// Punch hole ------------------------------------------------------------------
+
+bool FileSystem::punch_hole(size_t inumber, size_t offset, size_t length) {
+    Operation  operation(this);
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    // Load inode, an open inode is only changed through its handle
+    Inode inode;
+    if (!load_inode(inumber, &inode) || is_open(inumber))
+        return false;
+
+    // nothing past the end of the file needs punching
+    size_t fileSize = inode_size(inode);
+    if (offset >= fileSize || length == 0)
+        return true;
+    size_t end = fileSize - offset > length ? offset + length : fileSize;
+
+    if (is_inline(inode)) {
+        memset(inline_bytes(&inode) + offset, 0, end - offset);
+        return save_inode(inumber, &inode);
+    }
+
+    // blocks wholly inside the hole, the last block of the file counts as
+    // whole when the hole reaches the end
+    size_t first = (offset + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE;
+    size_t last  = end == fileSize ? (end + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE : end / disk->BLOCK_SIZE;
+
+    // blocks at the edges keep the bytes outside the hole
+    if (first > last) {
+        zero_range(&inode, offset, end);
     } else {
-        // already have indirect block, read in
-        disk->read(inode.Indirect, indirect.Data);
+        if (offset < first * disk->BLOCK_SIZE)
+            zero_range(&inode, offset, first * disk->BLOCK_SIZE);
+        if (last * disk->BLOCK_SIZE < end)
+            zero_range(&inode, last * disk->BLOCK_SIZE, end);
     }
-    
-    switch (writeArray(indirect.Pointers, POINTERS_PER_BLOCK, &size, 
-    &skipBlocks, &remainder, &rlength, data)) {
-        case 0: // if write finished
-            // update inode
-            inode.Size += size;
-            save_inode(inumber, &inode, &inodeBlock, false);
-            disk->write(inode.Indirect, indirect.Data);
-            return size;
-        case -1: // error occurred
-            // update inode
-            inode.Size += size;
-            save_inode(inumber, &inode, &inodeBlock, false);
-            disk->write(inode.Indirect, indirect.Data);
-            return -1;
-        case 1: // still needs writing
+
+    free_range(&inode, first, last);
+    return save_inode(inumber, &inode);
+}
+
+void FileSystem::free_range(Inode *inode, size_t first, size_t last) {
+    // free direct blocks, then every tree the range reaches into
+    for (size_t b = first; b < last && b < POINTERS_PER_INODE; b++) {
+        free_block(data_block(inode->Direct[b]));
+        inode->Direct[b] = 0;
+    }
+
+    uint32_t *roots[] = {&inode->Indirect, &inode->DoubleIndirect, &inode->TripleIndirect};
+    size_t base = POINTERS_PER_INODE;
+    size_t span = 1;
+    for (size_t depth = 1; depth <= maxDepth && base < last; depth++) {
+        span *= POINTERS_PER_BLOCK;
+        if (base + span > first)
+            punch_tree(roots[depth - 1], depth, base, first, last);
+        base += span;
+    }
+}
+
+void FileSystem::zero_range(Inode *inode, size_t start, size_t end) {
+    // only a mapped block has bytes to clear, both ends lie in that block
+    uint32_t block;
+    map_blocks(inode, start / disk->BLOCK_SIZE, 1, &block);
+    if (block == 0 || block >= blocks)
+        return;
+
+    Block data;
+    blockCache.read(block, data.Data);
+    memset(data.Data + start % disk->BLOCK_SIZE, 0, end - start);
+    blockCache.write(block, data.Data);
+    note_read(Stats::DATA_BLOCK, block);
+    note_write(Stats::DATA_BLOCK, block);
+}
+
+// Preallocate and truncate ----------------------------------------------------
+
+bool FileSystem::fallocate(size_t inumber, size_t offset, size_t length) {
+    Operation  operation(this);
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    // Load inode, an open inode is only changed through its handle
+    Inode inode;
+    if (!load_inode(inumber, &inode) || is_open(inumber))
+        return false;
+
+    // older formats cannot mark a block unwritten
+    size_t end = (offset + length + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE;
+    if (version < VERSION_UNWRITTEN || length == 0 || end > max_file_blocks())
+        return false;
+
+    // reserved blocks take the place of inline data
+    uint32_t block;
+    if (is_inline(inode) && !promote_inline(&inode, &block))
+        return false;
+
+    // missing blocks are asked for at once, so they come as runs
+    std::vector<uint32_t> map(end - offset / disk->BLOCK_SIZE);
+    reserve_blocks(&inode, offset, length, map.data(), NULL, true);
+
+    // out of blocks, nothing may stay mapped past the end of the file
+    bool complete = std::find(map.begin(), map.end(), 0) == map.end();
+    if (complete)
+        set_inode_size(&inode, std::max<uint64_t>(inode_size(inode), offset + length));
+    else
+        free_range(&inode, (inode_size(inode) + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE, max_file_blocks());
+
+    save_inode(inumber, &inode);
+    return complete;
+}
+
+bool FileSystem::truncate(size_t inumber, size_t size) {
+    Operation  operation(this);
+    ReadGuard  guard(mountLock);
+    WriteGuard inodeGuard(inode_lock(inumber));
+
+    // Load inode, an open inode is only changed through its handle
+    Inode inode;
+    if (!load_inode(inumber, &inode) || is_open(inumber))
+        return false;
+
+    if ((size + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE > max_file_blocks())
+        return false;
+
+    size_t fileSize = inode_size(inode);
+    if (is_inline(inode)) {
+        // bytes past the end are kept zero
+        if (size <= INLINE_DATA_SIZE) {
+            if (size < fileSize)
+                memset(inline_bytes(&inode) + size, 0, fileSize - size);
+            set_inode_size(&inode, size);
+            return save_inode(inumber, &inode);
+        }
+
+        uint32_t block;
+        if (!promote_inline(&inode, &block))
+            return false;
+    }
+
+    // the new last block keeps zeros past the end, for the file to grow into
+    if (size < fileSize) {
+        if (size % disk->BLOCK_SIZE)
+            zero_range(&inode, size, (size / disk->BLOCK_SIZE + 1) * disk->BLOCK_SIZE);
+        free_range(&inode, (size + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE, max_file_blocks());
+    }
+
+    // growing only moves the end, what lies past the old end is a hole
+    set_inode_size(&inode, size);
+    return save_inode(inumber, &inode);
+}
+
+// Inline data -----------------------------------------------------------------
+
+bool FileSystem::fits_inline(const Inode &inode, size_t end) const {
+    if (version < VERSION_INLINE_DATA || end > INLINE_DATA_SIZE)
+        return false;
+    if (is_inline(inode))
+        return true;
+
+    // only a file without a single block can move in
+    static const char zero[INLINE_DATA_SIZE] = {0};
+    return inlineData && memcmp(inode.Direct, zero, INLINE_DATA_SIZE) == 0;
+}
+
+void FileSystem::write_inline(Inode *inode, const char *data, size_t length, size_t offset) {
+    // bytes past the end are kept zero, so a gap before offset reads as zeros
+    memcpy(inline_bytes(inode) + offset, data, length);
+    inode->Flags |= INODE_INLINE;
+    set_inode_size(inode, std::max<uint64_t>(inode_size(*inode), offset + length));
+}
+
+bool FileSystem::promote_inline(Inode *inode, uint32_t *block) {
+    Block data;
+    memset(data.Data, 0, disk->BLOCK_SIZE);
+    memcpy(data.Data, inline_bytes(inode), INLINE_DATA_SIZE);
+
+    // pointers start out zero, then the data moves to a block of its own
+    Inode original = *inode;
+    memset(inline_bytes(inode), 0, INLINE_DATA_SIZE);
+    inode->Flags &= ~INODE_INLINE;
+
+    *block = 0;
+    if (inode_size(*inode) == 0)
+        return true;
+
+    reserve_blocks(inode, 0, disk->BLOCK_SIZE, block, NULL);
+    if (*block == 0) {
+        *inode = original;
+        return false;
+    }
+
+    blockCache.write(*block, data.Data);
+    note_write(Stats::DATA_BLOCK, *block);
+    return true;
+}
+
+// Block map walker ------------------------------------------------------------
+
+size_t FileSystem::block_path(size_t logical, size_t path[MAX_DEPTH + 1]) {
+    if (logical < POINTERS_PER_INODE) {
+        path[0] = logical;
+        return 0;
+    }
+
+    // find the tree holding the block, then its index at every level
+    logical -= POINTERS_PER_INODE;
+    size_t span = 1;
+    for (size_t depth = 1; depth <= MAX_DEPTH; depth++) {
+        span *= POINTERS_PER_BLOCK;
+        if (logical < span) {
+            for (size_t level = depth; level >= 1; level--) {
+                path[level] = logical % POINTERS_PER_BLOCK;
+                logical /= POINTERS_PER_BLOCK;
+            }
+            return depth;
+        }
+        logical -= span;
+    }
+
+    // past the largest file
+    return MAX_DEPTH + 1;
+}
+
+size_t FileSystem::max_file_blocks() const {
+    size_t count = POINTERS_PER_INODE;
+    size_t span = 1;
+    for (size_t depth = 1; depth <= maxDepth; depth++) {
+        span *= POINTERS_PER_BLOCK;
+        count += span;
+    }
+    return count;
+}
+
+uint32_t FileSystem::walk(Inode *inode, size_t logical, Cursor cursors[MAX_DEPTH + 1], Reservation *reservation, bool *added) {
+    size_t path[MAX_DEPTH + 1];
+    size_t depth = block_path(logical, path);
+    if (depth > maxDepth)
+        return 0;
+
+    uint32_t *slot = depth == 0 ? &inode->Direct[path[0]] :
+                     depth == 1 ? &inode->Indirect :
+                     depth == 2 ? &inode->DoubleIndirect : &inode->TripleIndirect;
+
+    for (size_t level = 1; level <= depth; level++) {
+        Cursor &cursor = cursors[level];
+
+        if (*slot == 0) {
+            // missing pointer block, only a write adds one
+            uint32_t block = reservation ? take(reservation) : 0;
+            if (block == 0)
+                return 0;
+
+            // placeholders of a counting pass are never written back
+            *slot = block;
+            if (level > 1 && !reservation->Dry)
+                cursors[level - 1].Dirty = true;
+
+            write_back(&cursor);
+            memset(cursor.Pointers.Data, 0, disk->BLOCK_SIZE);
+            cursor.Number = block;
+            cursor.Dirty = !reservation->Dry;
+        } else if (cursor.Number == *slot) {
+            // same pointer block as the last walk at this level
+        } else if (*slot >= blocks) {
+            // corrupt pointer, the blocks below it are unreachable
+            return 0;
+        } else {
+            write_back(&cursor);
+            read_pointers(*slot, &cursor.Pointers);
+            cursor.Number = *slot;
+
+            // new blocks under an existing pointer block go right after it
+            if (reservation && path[level] == 0)
+                reservation->Goal = *slot + 1;
+        }
+
+        slot = &cursor.Pointers.Pointers[path[level]];
+    }
+
+    if (*slot == 0 && reservation) {
+        *slot = take(reservation);
+        if (*slot && reservation->Unwritten)
+            *slot |= UNWRITTEN;
+        if (*slot && depth > 0 && !reservation->Dry)
+            cursors[depth].Dirty = true;
+        if (added)
+            *added = *slot != 0;
+    } else if ((*slot & UNWRITTEN) && reservation && !reservation->Dry && !reservation->Unwritten) {
+        // first write to a preallocated block, which holds zeros until then
+        *slot &= ~UNWRITTEN;
+        if (depth > 0)
+            cursors[depth].Dirty = true;
+        if (added)
+            *added = true;
+    }
+
+    return *slot;
+}
+
+void FileSystem::write_back(Cursor *cursor) {
+    if (cursor->Dirty) {
+        write_pointers(cursor->Number, &cursor->Pointers);
+        cursor->Dirty = false;
+    }
+}
+
+void FileSystem::read_pointers(uint32_t block, Block *pointers) {
+    note_read(Stats::INDIRECT_BLOCK, block);
+
+    // a pointer block changed since the last commit only lives in memory
+    if (journalBlocks) {
+        std::lock_guard<std::mutex> guard(metaLock);
+        auto it = pendingPointers.find(block);
+        if (it != pendingPointers.end()) {
+            *pointers = it->second;
+            return;
+        }
+    }
+
+    blockCache.read(block, pointers->Data);
+}
+
+void FileSystem::write_pointers(uint32_t block, const Block *pointers) {
+    if (!journalBlocks) {
+        blockCache.write(block, (char *)pointers->Data);
+        note_write(Stats::INDIRECT_BLOCK, block);
+        return;
+    }
+
+    // kept out of the cache, which could write it home before it is committed
+    std::lock_guard<std::mutex> guard(metaLock);
+    auto inserted = pendingPointers.insert(std::make_pair(block, *pointers));
+    if (inserted.second)
+        dirtyMetadata++;
+    else
+        inserted.first->second = *pointers;
+}
+
+uint32_t FileSystem::take(Reservation *reservation) {
+    reservation->Count++;
+
+    // counting pass only needs distinct non-zero numbers past the disk
+    if (reservation->Dry)
+        return blocks + reservation->Count;
+
+    if (reservation->Length == 0) {
+        size_t run;
+        ssize_t start = allocate_free_run(reservation->Goal, reservation->Wanted, &run);
+
+        // no free block, the write stops at the first unmapped slot
+        if (start == -1)
+            return 0;
+
+        reservation->Start = start;
+        reservation->Length = run;
+        reservation->Goal = start + run;
+    }
+
+    reservation->Wanted = std::max<size_t>(reservation->Wanted, 2) - 1;
+    reservation->Length--;
+    return reservation->Start++;
+}
+
+void FileSystem::map_blocks(Inode *inode, size_t first, size_t count, uint32_t *map) {
+    Cursor cursors[MAX_DEPTH + 1];
+    for (auto &cursor : cursors) {
+        cursor.Number = 0;
+        cursor.Dirty = false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        map[i] = walk(inode, first + i, cursors, NULL, NULL);
+}
+
+void FileSystem::free_tree(uint32_t block, size_t depth) {
+    if (!block)
+        return;
+
+    // free everything below the pointer block, then the block itself
+    Block pointers;
+    read_pointers(block, &pointers);
+    for (size_t i = 0; i < POINTERS_PER_BLOCK; i++) {
+        if (depth > 1)
+            free_tree(pointers.Pointers[i], depth - 1);
+        else
+            free_block(data_block(pointers.Pointers[i]));
+    }
+    free_block(block);
+}
+
+void FileSystem::punch_tree(uint32_t *slot, size_t depth, size_t base, size_t first, size_t last) {
+    // corrupt pointers are left for check to deal with
+    if (*slot == 0 || *slot >= blocks)
+        return;
+
+    // blocks mapped by each pointer in this block
+    size_t span = 1;
+    for (size_t level = 1; level < depth; level++)
+        span *= POINTERS_PER_BLOCK;
+
+    Block pointers;
+    read_pointers(*slot, &pointers);
+
+    bool changed = false;
+    bool empty = true;
+    for (size_t p = 0; p < POINTERS_PER_BLOCK; p++) {
+        uint32_t &pointer = pointers.Pointers[p];
+        size_t start = base + p * span;
+
+        if (pointer && start < last && start + span > first) {
+            if (depth == 1) {
+                free_block(data_block(pointer));
+                pointer = 0;
+            } else if (first <= start && start + span <= last) {
+                free_tree(pointer, depth - 1);
+                pointer = 0;
+            } else {
+                punch_tree(&pointer, depth - 1, start, first, last);
+            }
+            changed |= pointer == 0;
+        }
+        empty &= pointer == 0;
+    }
+
+    // a pointer block left mapping nothing goes as well
+    if (empty) {
+        free_block(*slot);
+        *slot = 0;
+    } else if (changed) {
+        write_pointers(*slot, &pointers);
+    }
+}
+
+void FileSystem::scan_tree(uint32_t block, size_t depth, size_t *blockNum, Bitmap *used) {
+    // a missing pointer block still accounts for every block it would map
+    if (!block || block >= blocks) {
+        size_t span = 1;
+        for (size_t level = 0; level < depth && span <= *blockNum; level++)
+            span *= POINTERS_PER_BLOCK;
+        *blockNum -= std::min(*blockNum, span);
+        return;
+    }
+
+    used->set(block);
+    if (*blockNum == 0)
+        return;
+
+    Block pointers;
+    read_pointers(block, &pointers);
+    for (size_t p = 0; p < POINTERS_PER_BLOCK && *blockNum > 0; p++) {
+        if (depth > 1) {
+            scan_tree(pointers.Pointers[p], depth - 1, blockNum, used);
+        } else {
+            if (data_block(pointers.Pointers[p]) < blocks)
+                used->set(data_block(pointers.Pointers[p]));
+            (*blockNum)--;
+        }
+    }
+}
+
+// Metadata journal ------------------------------------------------------------
+
+// FNV-1a over the words of a block
+static uint32_t checksum(const char *data, uint32_t sum) {
+    const uint32_t *words = (const uint32_t *)data;
+    for (size_t i = 0; i < Disk::BLOCK_SIZE / sizeof(uint32_t); i++)
+        sum = (sum ^ words[i]) * 16777619;
+    return sum;
+}
+
+void FileSystem::end_operation() {
+    size_t ticket = ++finishedOperations;
+    size_t group = groupCommit;
+
+    // commit once the group is big enough, or before it outgrows the journal
+    bool due = group > 0 && ticket >= committedOperations + group;
+    bool full = journalBlocks > 0 && dirtyMetadata >= journalBlocks / 2;
+    if (!due && !full)
+        return;
+
+    // whoever gets here first commits for everyone waiting behind it
+    std::lock_guard<std::mutex> guard(commitLock);
+    if (committedOperations >= ticket && dirtyMetadata < journalBlocks / 2)
+        return;
+
+    WriteGuard mountGuard(mountLock);
+    if (disk)
+        flush_all();
+}
+
+void FileSystem::commit() {
+    // images of everything changed, inode blocks before the superblock
+    // since they may raise the high-water mark
+    std::vector<uint32_t> homes;
+    std::vector<Block>    images;
+
+    for (size_t i = 0; i < dirtyInodeBlocks.size(); i++) {
+        if (!dirtyInodeBlocks[i])
+            continue;
+
+        homes.push_back(inodeStart + i);
+        images.emplace_back();
+        encode_inodes(&inodeTable[i * inodesPerBlock], version, images.back().Data);
+        dirtyInodeBlocks[i] = false;
+
+        if (i >= initializedInodeBlocks) {
+            initializedInodeBlocks = i + 1;
+            superBlockDirty = true;
+        }
+    }
+
+    if (superBlockDirty) {
+        homes.push_back(0);
+        images.emplace_back();
+        superblock_image(&images.back());
+        superBlockDirty = false;
+    }
+
+    for (size_t i = 0; i < dirtyBitmapBlocks.size(); i++) {
+        if (!dirtyBitmapBlocks[i])
+            continue;
+
+        homes.push_back(1 + i);
+        images.emplace_back();
+        if (i < bitmapBlocks)
+            blockAllocator.bitmap().copy_out(i * disk->BLOCK_SIZE, images.back().Data, disk->BLOCK_SIZE);
+        else
+            freeInodes.copy_out((i - bitmapBlocks) * disk->BLOCK_SIZE, images.back().Data, disk->BLOCK_SIZE);
+        dirtyBitmapBlocks[i] = false;
+    }
+
+    size_t firstPointer = homes.size();
+    for (auto &pending : pendingPointers) {
+        homes.push_back(pending.first);
+        images.push_back(pending.second);
+    }
+
+    std::vector<uint32_t> revokes;
+    revokes.swap(revokedBlocks);
+    pendingPointers.clear();
+    dirtyMetadata = 0;
+
+    // nothing to journal, only data has to be made durable
+    if (homes.empty() && revokes.empty()) {
+        blockCache.sync();
+        return;
+    }
+
+    // data the metadata points to goes out ahead of it, and becomes durable
+    // with the same fsync as the journal record
+    blockCache.flush();
+
+    size_t needed = images.size() + 2;
+    if (needed > journalBlocks - 1 || homes.size() + revokes.size() > JOURNAL_TAGS) {
+        // group is too big for the journal, so it goes home directly and is
+        // made durable right away, only losing atomicity for this group
+        for (size_t k = 0; k < images.size(); k++) {
+            blockCache.write(homes[k], images[k].Data);
+            note_write(metadata_type(homes[k]), homes[k]);
+        }
+        checkpoint();
+        disk->sync();
+        commitCount++;
+        return;
+    }
+
+    if (journalNext + needed > journalBlocks)
+        checkpoint();
+
+    // descriptor, images and commit record go out in one sequential write
+    Block descriptor, record;
+    memset(descriptor.Data, 0, disk->BLOCK_SIZE);
+    descriptor.Journal.Magic = JOURNAL_MAGIC;
+    descriptor.Journal.Type = JOURNAL_DESCRIPTOR;
+    descriptor.Journal.Id = journalId;
+    descriptor.Journal.Sequence = journalSequence;
+    descriptor.Journal.Blocks = images.size();
+    descriptor.Journal.Revokes = revokes.size();
+
+    uint32_t *tags = descriptor.Pointers + sizeof(JournalRecord) / sizeof(uint32_t);
+    std::copy(homes.begin(), homes.end(), tags);
+    std::copy(revokes.begin(), revokes.end(), tags + homes.size());
+
+    record = descriptor;
+    record.Journal.Type = JOURNAL_COMMIT;
+    record.Journal.Checksum = checksum(descriptor.Data, 2166136261u);
+    for (auto &image : images)
+        record.Journal.Checksum = checksum(image.Data, record.Journal.Checksum);
+
+    std::vector<struct iovec> iov;
+    iov.push_back({descriptor.Data, disk->BLOCK_SIZE});
+    for (auto &image : images)
+        iov.push_back({image.Data, disk->BLOCK_SIZE});
+    iov.push_back({record.Data, disk->BLOCK_SIZE});
+
+    disk->writev(journalStart + journalNext, iov.data(), iov.size());
+    disk->sync();
+    note_write(Stats::JOURNAL_BLOCK, journalStart + journalNext, needed);
+
+    journalNext += needed;
+    journalSequence++;
+    commitCount++;
+    journalWrites += needed;
+
+    // committed, so home copies may be written back whenever the cache likes
+    for (size_t k = 0; k < images.size(); k++) {
+        blockCache.write(homes[k], images[k].Data);
+        note_write(metadata_type(homes[k]), homes[k]);
+    }
+    journaledPointers.insert(homes.begin() + firstPointer, homes.end());
+}
+
+void FileSystem::checkpoint() {
+    // every committed image is home and durable before the journal is reused
+    blockCache.sync();
+
+    journalNext = 1;
+    journaledPointers.clear();
+    write_journal_header();
+    checkpointCount++;
+}
+
+void FileSystem::write_journal_header() {
+    Block header;
+    memset(header.Data, 0, disk->BLOCK_SIZE);
+    header.Journal.Magic = JOURNAL_MAGIC;
+    header.Journal.Type = JOURNAL_HEADER;
+    header.Journal.Id = journalId;
+    header.Journal.Sequence = journalSequence;
+    disk->write(journalStart, header.Data);
+    note_write(Stats::JOURNAL_BLOCK, journalStart);
+}
+
+bool FileSystem::replay_journal(bool *replayed) {
+    *replayed = false;
+
+    Block header;
+    disk->read(journalStart, header.Data);
+    note_read(Stats::JOURNAL_BLOCK, journalStart);
+    if (header.Journal.Magic != JOURNAL_MAGIC || header.Journal.Type != JOURNAL_HEADER)
+        return false;
+
+    journalId = header.Journal.Id;
+    journalSequence = header.Journal.Sequence;
+    journalNext = 1;
+
+    // collect committed transactions, the first torn or stale one ends the log
+    struct Transaction {
+        uint32_t              Sequence;
+        std::vector<uint32_t> Homes;
+        std::vector<Block>    Images;
+    };
+    std::vector<Transaction> transactions;
+    std::unordered_map<uint32_t, uint32_t> revokedAt; // block to last transaction revoking it
+
+    size_t next = 1;
+    uint32_t sequence = journalSequence;
+    while (next + 2 <= journalBlocks) {
+        Block descriptor;
+        disk->read(journalStart + next, descriptor.Data);
+        note_read(Stats::JOURNAL_BLOCK, journalStart + next);
+
+        JournalRecord &record = descriptor.Journal;
+        if (record.Magic != JOURNAL_MAGIC || record.Type != JOURNAL_DESCRIPTOR
+        || record.Id != journalId || record.Sequence != sequence
+        || record.Blocks + record.Revokes > JOURNAL_TAGS
+        || next + record.Blocks + 2 > journalBlocks)
             break;
+
+        // images and commit record, which must vouch for all of them
+        Transaction transaction;
+        transaction.Sequence = sequence;
+        transaction.Images.resize(record.Blocks + 1);
+        disk->readv(journalStart + next + 1, transaction.Images.size(), transaction.Images[0].Data);
+        note_read(Stats::JOURNAL_BLOCK, journalStart + next + 1, transaction.Images.size());
+
+        uint32_t sum = checksum(descriptor.Data, 2166136261u);
+        for (size_t k = 0; k < record.Blocks; k++)
+            sum = checksum(transaction.Images[k].Data, sum);
+
+        JournalRecord &commit = transaction.Images.back().Journal;
+        if (commit.Magic != JOURNAL_MAGIC || commit.Type != JOURNAL_COMMIT
+        || commit.Id != journalId || commit.Sequence != sequence || commit.Checksum != sum)
+            break;
+
+        const uint32_t *tags = descriptor.Pointers + sizeof(JournalRecord) / sizeof(uint32_t);
+        transaction.Homes.assign(tags, tags + record.Blocks);
+        for (size_t r = 0; r < record.Revokes; r++)
+            revokedAt[tags[record.Blocks + r]] = sequence;
+        transaction.Images.pop_back();
+        transactions.push_back(std::move(transaction));
+
+        next += record.Blocks + 2;
+        sequence++;
     }
-        
-    // still have bytes unwritten, something wrong
-    // update inode
-    inode.Size += size;
-    save_inode(inumber, &inode, &inodeBlock, false);
-    disk->write(inode.Indirect, indirect.Data);
-    return -1;
+
+    if (transactions.empty())
+        return true;
+
+    // write images home in commit order, skipping those revoked later
+    for (auto &transaction : transactions) {
+        for (size_t k = 0; k < transaction.Homes.size(); k++) {
+            uint32_t home = transaction.Homes[k];
+            auto revoked = revokedAt.find(home);
+            if (home >= blocks || (revoked != revokedAt.end() && revoked->second > transaction.Sequence))
+                continue;
+            disk->write(home, transaction.Images[k].Data);
+            note_write(metadata_type(home), home);
+        }
+    }
+    disk->sync();
+
+    // replayed transactions are home, start over behind them
+    journalSequence = sequence;
+    write_journal_header();
+    disk->sync();
+
+    *replayed = true;
+    return true;
+}
+
+// Statistics ------------------------------------------------------------------
+
+std::string FileSystem::stats_json() {
+    ReadGuard guard(mountLock);
+
+    std::string json = "{\"fs\": " + statistics.json();
+    char buffer[BUFSIZ];
+
+    // disk and cache are only known while mounted
+    if (disk) {
+        snprintf(buffer, sizeof(buffer),
+            ", \"disk\": {\"blocks\": %lu, \"reads\": %lu, \"writes\": %lu, \"punches\": %lu, \"syscalls\": %lu, \"depth\": %lu}",
+            disk->size(), disk->reads(), disk->writes(), disk->punches(), disk->syscalls(), disk->depth());
+        json += buffer;
+
+        snprintf(buffer, sizeof(buffer),
+            ", \"cache\": {\"capacity\": %lu, \"resident\": %lu, \"dirty\": %lu, \"hits\": %lu, \"misses\": %lu"
+            ", \"evictions\": %lu, \"prefetches\": %lu, \"prefetch_hits\": %lu, \"prefetch_wasted\": %lu}",
+            blockCache.capacity(), blockCache.resident(), blockCache.dirty(), blockCache.hits(), blockCache.misses(),
+            blockCache.evictions(), blockCache.prefetches(), blockCache.prefetch_hits(), blockCache.prefetch_wasted());
+        json += buffer;
+
+        snprintf(buffer, sizeof(buffer),
+            ", \"journal\": {\"blocks\": %lu, \"group_commit\": %lu, \"commits\": %lu, \"writes\": %lu, \"checkpoints\": %lu}",
+            journalBlocks, group_commit(), commits(), journal_writes(), checkpoints());
+        json += buffer;
+
+        snprintf(buffer, sizeof(buffer), ", \"free_blocks\": %lu", free_blocks());
+        json += buffer;
+    }
+
+    return json + "}";
 }
 
 // Helper functions ------------------------------------------------------------
 
-void FileSystem::initialize_free_blocks() {
-    bitMap = std::vector<int>(blocks, FREE);
+void FileSystem::scan_metadata() {
+    freeInodes.assign(inodes, false);
+    nextFreeInode = 0;
+
+    // split the inode table between threads, each with enough work to pay off
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (size_t)SCAN_THREADS);
+    threads = std::max((size_t)1, std::min(threads, inodeBlocks / SCAN_MIN_BLOCKS));
+    size_t slice = (inodeBlocks + threads - 1) / threads;
+
+    std::vector<Bitmap> used(threads);
+    std::vector<std::string> errors(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; t++) {
+        size_t first = std::min(t * slice, inodeBlocks);
+        size_t last = std::min(first + slice, inodeBlocks);
+        workers.push_back(std::thread(&FileSystem::scan_inode_blocks, this,
+            first, last, &used[t], &errors[t]));
+    }
+    scan_inode_blocks(0, std::min(slice, inodeBlocks), &used[0], &errors[0]);
+    for (auto &worker : workers)
+        worker.join();
 
-    // super block is occupied
-    bitMap[0] = OCCUPIED;
+    for (auto &error : errors) {
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
 
-    // Read Inode blocks
-    Block inodeBlock;
-    // loop over inode blocks
-    for (size_t i = 0; i < inodeBlocks; i++) {
-        // inode blocks are occupied
-        bitMap[i + 1] = OCCUPIED;
+    // whole table is resident now
+    loadedInodeBlocks.assign(inodeBlocks, true);
 
-        // read in one inode block
-        disk->read(i + 1, inodeBlock.Data);
+    // super block, bitmap blocks and inode blocks are occupied
+    for (size_t t = 1; t < threads; t++)
+        used[0].merge(used[t]);
+    blockAllocator.assign(blocks, inodeStart + inodeBlocks);
+    blockAllocator.bitmap().subtract(used[0]);
+}
 
-        // loop over inodes in the block
-        for (size_t j = 0; j < INODES_PER_BLOCK; j++) {
-            Inode inode = inodeBlock.Inodes[j];
+void FileSystem::scan_inode_blocks(size_t first, size_t last, Bitmap *used, std::string *error) {
+    used->assign(blocks, false);
+
+    try {
+        // read inode blocks not yet resident straight into the table, a
+        // resident block may be newer than the one on disk, and those past
+        // the high-water mark are already zero in the table
+        size_t end = std::min(last, initializedInodeBlocks);
+        size_t i = first;
+        while (i < end) {
+            if (loadedInodeBlocks[i]) {
+                i++;
+                continue;
+            }
+
+            size_t count = 1;
+            while (i + count < end && count < SCAN_BATCH && !loadedInodeBlocks[i + count])
+                count++;
+            if (version >= VERSION_WIDE_INODES) {
+                disk->readv(inodeStart + i, count, (char *)&inodeTable[i * inodesPerBlock]);
+            } else {
+                // narrow inodes are widened on the way in
+                std::vector<Block> narrow(count);
+                disk->readv(inodeStart + i, count, narrow[0].Data);
+                for (size_t k = 0; k < count; k++)
+                    decode_inodes(narrow[k].Data, version, &inodeTable[(i + k) * inodesPerBlock]);
+            }
+            note_read(Stats::INODE_BLOCK, inodeStart + i, count);
+            i += count;
+        }
+
+        // inode slices start on a block, so threads never share a bitmap word
+        std::vector<std::pair<uint32_t, size_t>> indirects;
+        for (size_t i = first * inodesPerBlock; i < last * inodesPerBlock; i++) {
+            Inode &inode = inodeTable[i];
 
             // skip invalid inode
-            if (!inode.Valid)
+            if (!inode.Valid) {
+                freeInodes.set(i);
                 continue;
-            
-            // // compute how many blocks are needed
-            size_t blockNum = inode.Size / disk->BLOCK_SIZE;
-            if ((inode.Size % disk->BLOCK_SIZE) > 0)
+            }
+
+            // inline data has no blocks
+            if (is_inline(inode))
+                continue;
+
+            // compute how many blocks are needed
+            size_t blockNum = inode_size(inode) / disk->BLOCK_SIZE;
+            if ((inode_size(inode) % disk->BLOCK_SIZE) > 0)
                 blockNum++;
-            
+
             // loop over direct blocks
-            for (size_t k = 0; k < POINTERS_PER_INODE && blockNum > 0; k++) {
-                bitMap[inode.Direct[k]] = OCCUPIED;
-                blockNum--;
+            for (size_t k = 0; k < POINTERS_PER_INODE && blockNum > 0; k++, blockNum--) {
+                if (data_block(inode.Direct[k]) < blocks)
+                    used->set(data_block(inode.Direct[k]));
             }
 
-            // skip invalid indirect node
-            if (!inode.Indirect)
-                continue;
-            
-            // loop over indirect blocks
-            Block indirect;
-            disk->read(inode.Indirect, indirect.Data);
-            bitMap[inode.Indirect] = OCCUPIED;
-            for (size_t k = 0; k < POINTERS_PER_BLOCK && blockNum > 0; k++) {
-                bitMap[indirect.Pointers[k]] = OCCUPIED;
-                blockNum--;
+            // indirect blocks are batched below, deeper trees are walked now
+            if (inode.Indirect && inode.Indirect < blocks) {
+                used->set(inode.Indirect);
+                if (blockNum > 0)
+                    indirects.push_back(std::make_pair(inode.Indirect, i));
+            }
+            blockNum -= std::min(blockNum, (size_t)POINTERS_PER_BLOCK);
+
+            scan_tree(inode.DoubleIndirect, 2, &blockNum, used);
+            scan_tree(inode.TripleIndirect, 3, &blockNum, used);
+        }
+
+        // read indirect blocks in block order, adjacent ones in one call,
+        // through the cache since a resident copy may be newer
+        std::sort(indirects.begin(), indirects.end());
+        std::vector<Block> batch(SCAN_BATCH);
+        size_t j = 0;
+        while (j < indirects.size()) {
+            size_t count = 1;
+            while (j + count < indirects.size() && count < SCAN_BATCH
+                && indirects[j + count].first == indirects[j].first + count)
+                count++;
+            Disk::Batch pending;
+            blockCache.read_run(indirects[j].first, batch[0].Data, count, &pending);
+            disk->wait(&pending);
+            note_read(Stats::INDIRECT_BLOCK, indirects[j].first, count);
+
+            for (size_t k = 0; k < count; k++, j++) {
+                Inode &inode = inodeTable[indirects[j].second];
+                size_t blockNum = (inode_size(inode) + disk->BLOCK_SIZE - 1) / disk->BLOCK_SIZE - POINTERS_PER_INODE;
+
+                // loop over indirect blocks
+                for (size_t p = 0; p < POINTERS_PER_BLOCK && p < blockNum; p++) {
+                    if (data_block(batch[k].Pointers[p]) < blocks)
+                        used->set(data_block(batch[k].Pointers[p]));
+                }
+
+                // keep it around, it is likely to be read again soon
+                blockCache.fill(indirects[j].first, batch[k].Data);
             }
         }
+    } catch (std::exception &e) {
+        *error = e.what();
+    }
+}
+
+ssize_t FileSystem::allocate_free_inode() {
+    std::lock_guard<std::mutex> guard(metaLock);
+
+    // no free inode lies before the hint, so lowest free inode is found first
+    size_t inumber = freeInodes.find_next(nextFreeInode);
+    if (inumber == Bitmap::NONE) {
+        nextFreeInode = inodes;
+        return -1;
     }
+
+    freeInodes.clear(inumber);
+    nextFreeInode = inumber + 1;
+    statistics.add(Stats::INODES_ALLOCATED);
+    if (version >= VERSION_BITMAPS)
+        mark_dirty(dirtyBitmapBlocks, bitmapBlocks + inumber / BITS_PER_BLOCK);
+    return inumber;
 }
 
-ssize_t FileSystem::allocate_free_block() {
-    for (size_t i = 1 + inodeBlocks; i < blocks; i++) {
-        if (bitMap[i] == FREE) {
-            bitMap[i] = OCCUPIED;
-            return i;
+void FileSystem::free_inode(size_t inumber) {
+    std::lock_guard<std::mutex> guard(metaLock);
+
+    freeInodes.set(inumber);
+    nextFreeInode = std::min(nextFreeInode, inumber);
+    statistics.add(Stats::INODES_FREED);
+    if (version >= VERSION_BITMAPS)
+        mark_dirty(dirtyBitmapBlocks, bitmapBlocks + inumber / BITS_PER_BLOCK);
+}
+
+ssize_t FileSystem::allocate_free_run(size_t goal, size_t count, size_t *length) {
+    ssize_t start = blockAllocator.allocate_run(goal, count, length);
+    if (start >= 0) {
+        statistics.add(Stats::ALLOCATION_RUNS);
+        statistics.add(Stats::BLOCKS_ALLOCATED, *length);
+    }
+    if (start >= 0 && version >= VERSION_BITMAPS) {
+        std::lock_guard<std::mutex> guard(metaLock);
+        for (size_t block = start; block < start + (*length); block++)
+            mark_dirty(dirtyBitmapBlocks, block / BITS_PER_BLOCK);
+    }
+    return start;
+}
+
+void FileSystem::free_block(size_t block) {
+    if (!blockAllocator.release(block))
+        return;
+
+    statistics.add(Stats::BLOCKS_FREED);
+    if (version >= VERSION_BITMAPS) {
+        std::lock_guard<std::mutex> guard(metaLock);
+        mark_dirty(dirtyBitmapBlocks, block / BITS_PER_BLOCK);
+
+        // a freed pointer block is never written home, and its images
+        // already in the journal must not be replayed over its next use
+        if (journalBlocks) {
+            pendingPointers.erase(block);
+            if (journaledPointers.erase(block))
+                revokedBlocks.push_back(block);
         }
     }
-    return -1; 
 }
 
-bool FileSystem::load_inode(size_t inumber, Inode *node, Block *block, bool needRead) {
-    size_t blockIndex = (inumber / INODES_PER_BLOCK) + 1;
-    size_t pointerIndex = inumber % INODES_PER_BLOCK;
+void FileSystem::note_read(Stats::BlockType type, size_t block, size_t count) {
+    statistics.count_read(type, count);
+    if (Tracer *tracer = disk->tracer())
+        tracer->record(Tracer::READ, block, count, type);
+}
 
-    // read the whole block if needed
-    if (needRead)
-        disk->read(blockIndex, block->Data);
+void FileSystem::note_write(Stats::BlockType type, size_t block, size_t count) {
+    statistics.count_write(type, count);
+    if (Tracer *tracer = disk->tracer())
+        tracer->record(Tracer::WRITE, block, count, type);
+}
 
-    // read the inode
-    *node = block->Inodes[pointerIndex];
+Stats::BlockType FileSystem::metadata_type(size_t block) const {
+    if (block == 0)
+        return Stats::SUPER_BLOCK;
+    if (block < journalStart)
+        return Stats::BITMAP_BLOCK;
+    if (block >= inodeStart && block < inodeStart + inodeBlocks)
+        return Stats::INODE_BLOCK;
 
-    return node->Valid;
+    // only pointer blocks are journaled outside the fixed regions
+    return Stats::INDIRECT_BLOCK;
 }
 
-bool FileSystem::save_inode(size_t inumber, Inode *node, Block *block, bool needRead) {
-    size_t blockIndex = (inumber / INODES_PER_BLOCK) + 1;
-    size_t pointerIndex = inumber % INODES_PER_BLOCK;
+void FileSystem::mark_dirty(std::vector<bool> &flags, size_t index) {
+    if (!flags[index]) {
+        flags[index] = true;
+        dirtyMetadata++;
+    }
+}
 
-    // read the whole block if needed
-    if (needRead)
-        disk->read(blockIndex, block->Data);
+void FileSystem::load_bitmaps() {
+    Block bitmap;
 
-    // modify the inode
-    block->Inodes[pointerIndex] = *node;
+    // free block bitmap, metadata blocks are never free
+    blockAllocator.assign(blocks, inodeStart + inodeBlocks);
+    for (size_t i = 0; i < bitmapBlocks; i++) {
+        disk->read(1 + i, bitmap.Data);
+        blockAllocator.bitmap().copy_in(i * disk->BLOCK_SIZE, bitmap.Data, disk->BLOCK_SIZE);
+        note_read(Stats::BITMAP_BLOCK, 1 + i);
+    }
+    for (size_t i = 0; i < inodeStart + inodeBlocks; i++)
+        blockAllocator.reserve(i);
+    blockAllocator.bitmap().recount();
+
+    // free inode bitmap
+    freeInodes.assign(inodes, false);
+    for (size_t i = 0; i < inodeBitmapBlocks; i++) {
+        disk->read(1 + bitmapBlocks + i, bitmap.Data);
+        freeInodes.copy_in(i * disk->BLOCK_SIZE, bitmap.Data, disk->BLOCK_SIZE);
+        note_read(Stats::BITMAP_BLOCK, 1 + bitmapBlocks + i);
+    }
+    freeInodes.recount();
+    nextFreeInode = 0;
 
-    // write back
-    disk->write(blockIndex, block->Data);
+    dirtyBitmapBlocks.assign(bitmapBlocks + inodeBitmapBlocks, false);
+}
+
+void FileSystem::flush_bitmaps() {
+    // write back only the bitmap blocks that changed since last flush
+    for (size_t i = 0; i < dirtyBitmapBlocks.size(); i++) {
+        if (!dirtyBitmapBlocks[i])
+            continue;
+
+        Block bitmap;
+        if (i < bitmapBlocks)
+            blockAllocator.bitmap().copy_out(i * disk->BLOCK_SIZE, bitmap.Data, disk->BLOCK_SIZE);
+        else
+            freeInodes.copy_out((i - bitmapBlocks) * disk->BLOCK_SIZE, bitmap.Data, disk->BLOCK_SIZE);
+        blockCache.write(1 + i, bitmap.Data);
+        note_write(Stats::BITMAP_BLOCK, 1 + i);
+        dirtyBitmapBlocks[i] = false;
+    }
+}
+
+size_t FileSystem::inode_start(const SuperBlock &super) {
+    // bitmaps and journal sit between the superblock and the inode table
+    if (super.Version >= VERSION_JOURNAL)
+        return 1 + super.BitmapBlocks + super.InodeBitmapBlocks + super.JournalBlocks;
+    if (super.Version >= VERSION_BITMAPS)
+        return 1 + super.BitmapBlocks + super.InodeBitmapBlocks;
+    return 1;
+}
+
+size_t FileSystem::journal_blocks(size_t blocks) {
+    size_t journal = std::min(blocks / JOURNAL_RATIO, (size_t)JOURNAL_MAX_BLOCKS);
+    return journal >= JOURNAL_MIN_BLOCKS ? journal : 0;
+}
+
+void FileSystem::load_inode_table() {
+    inodeTable.assign(inodes, Inode());
+    loadedInodeBlocks.assign(inodeBlocks, false);
+    dirtyInodeBlocks.assign(inodeBlocks, false);
+}
+
+void FileSystem::fetch_inode_block(size_t index) {
+    if (loadedInodeBlocks[index])
+        return;
+
+    Inode *first = &inodeTable[index * inodesPerBlock];
+
+    // a block past the high-water mark or holding only free inodes has
+    // nothing worth reading
+    bool allFree = version >= VERSION_BITMAPS;
+    for (size_t j = 0; allFree && j < inodesPerBlock; j++)
+        allFree = freeInodes.test(index * inodesPerBlock + j);
+
+    if (allFree || index >= initializedInodeBlocks) {
+        std::fill(first, first + inodesPerBlock, Inode());
+    } else {
+        // read straight from disk, the table replaces the block in cache
+        Block inodeBlock;
+        disk->read(inodeStart + index, inodeBlock.Data);
+        note_read(Stats::INODE_BLOCK, inodeStart + index);
+        decode_inodes(inodeBlock.Data, version, first);
+    }
+
+    loadedInodeBlocks[index] = true;
+}
+
+void FileSystem::flush_inodes() {
+    // write back only the inode blocks that changed since last flush
+    for (size_t i = 0; i < dirtyInodeBlocks.size(); i++) {
+        if (!dirtyInodeBlocks[i])
+            continue;
+
+        Block inodeBlock;
+        encode_inodes(&inodeTable[i * inodesPerBlock], version, inodeBlock.Data);
+        blockCache.write(inodeStart + i, inodeBlock.Data);
+        note_write(Stats::INODE_BLOCK, inodeStart + i);
+        dirtyInodeBlocks[i] = false;
+
+        // raise high-water mark past the block
+        if (i >= initializedInodeBlocks) {
+            initializedInodeBlocks = i + 1;
+            superBlockDirty = true;
+        }
+    }
+}
+
+bool FileSystem::load_inode(size_t inumber, Inode *node) {
+    // out of range inode is never valid
+    if (inumber >= inodes)
+        return false;
+
+    // read the inode from resident table
+    std::lock_guard<std::mutex> guard(metaLock);
+    fetch_inode_block(inumber / inodesPerBlock);
+    *node = inodeTable[inumber];
+
+    return node->Valid;
+}
+
+bool FileSystem::save_inode(size_t inumber, Inode *node) {
+    if (inumber >= inodes)
+        return false;
+
+    // modify the inode and mark its block for write back
+    std::lock_guard<std::mutex> guard(metaLock);
+    fetch_inode_block(inumber / inodesPerBlock);
+    inodeTable[inumber] = *node;
+    mark_dirty(dirtyInodeBlocks, inumber / inodesPerBlock);
 
     return true;
 }
 
+void FileSystem::decode_inodes(const char *data, uint32_t version, Inode *inodes) {
+    static_assert(sizeof(Inode) * WIDE_INODES_PER_BLOCK == Disk::BLOCK_SIZE, "wide inodes must fill a block");
+    static_assert(offsetof(Inode, DoubleIndirect) == NARROW_INODE_SIZE, "narrow inodes end at the indirect pointer");
+    static_assert(offsetof(Inode, SizeHigh) - offsetof(Inode, Direct) == INLINE_DATA_SIZE, "inline data fills the pointers");
+
+    if (version >= VERSION_WIDE_INODES) {
+        memcpy(inodes, data, Disk::BLOCK_SIZE);
+        return;
+    }
+
+    // narrow inodes are a prefix of wide ones, the rest stays zero
+    for (size_t i = 0; i < INODES_PER_BLOCK; i++) {
+        memset(&inodes[i], 0, sizeof(Inode));
+        memcpy(&inodes[i], data + i * NARROW_INODE_SIZE, NARROW_INODE_SIZE);
+    }
+}
+
+void FileSystem::encode_inodes(const Inode *inodes, uint32_t version, char *data) {
+    if (version >= VERSION_WIDE_INODES) {
+        memcpy(data, inodes, Disk::BLOCK_SIZE);
+        return;
+    }
+
+    for (size_t i = 0; i < INODES_PER_BLOCK; i++)
+        memcpy(data + i * NARROW_INODE_SIZE, &inodes[i], NARROW_INODE_SIZE);
+}
+
 void FileSystem::debugArray(uint32_t array[], size_t arraySize, std::string* string) {
     for (size_t i = 0; i < arraySize; i++) {
         if (array[i]) {// if is 0, means null
             *string += " ";
-            *string += std::to_string(array[i]);
+            *string += std::to_string(data_block(array[i]));
+            if (array[i] & UNWRITTEN)
+                *string += "u";
         }
     }
 }
 
+void FileSystem::debugTree(Disk *disk, uint32_t block, size_t depth, std::string *string) {
+    Block pointers;
+    disk->read(block, pointers.Data);
+    if (depth == 1) {
+        debugArray(pointers.Pointers, POINTERS_PER_BLOCK, string);
+        return;
+    }
+
+    // list data blocks only, in logical order
+    for (size_t i = 0; i < POINTERS_PER_BLOCK; i++) {
+        if (pointers.Pointers[i])
+            debugTree(disk, pointers.Pointers[i], depth - 1, string);
+    }
+}
+
 ssize_t FileSystem::readArray(uint32_t array[], size_t arraySize, size_t *size, 
-size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
-    // block for reading data
-    Block block;
-    
+size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data, Disk::Batch *pending) {
     for (size_t i = 0; i < arraySize; i++) {
         // skip blocks if needed
         if ((*skipBlocks) > 0) {
@@ -463,20 +2006,35 @@ size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
             continue;
         }
 
-        // invalid blocks
-        if (array[i] == 0)
-            return -1;
-            
-        disk->read(array[i], block.Data);
-
         // determine how long to read
         size_t bytesToRead = std::min(disk->BLOCK_SIZE - (*remainder), (*rlength));
 
-        // skip remainder if there is, only first block will have remainder
-        memcpy(data + (*size), block.Data + (*remainder), bytesToRead);
+        // holes and unwritten blocks read as zeros without going to the disk
+        if (array[i] == 0 || (array[i] & UNWRITTEN)) {
+            memset(data + (*size), 0, bytesToRead);
+        } else {
+            // whole blocks that are adjacent on disk come in with one read
+            size_t count = 1;
+            if (bytesToRead == disk->BLOCK_SIZE) {
+                while (i + count < arraySize && (*rlength) >= (count + 1) * disk->BLOCK_SIZE
+                    && array[i + count] == array[i] + count)
+                    count++;
+            }
+
+            // an asynchronous disk gets every whole block queued, even single ones
+            note_read(Stats::DATA_BLOCK, array[i], count);
+            if (count > 1 || (bytesToRead == disk->BLOCK_SIZE && disk->depth() > 1)) {
+                blockCache.read_run(array[i], data + (*size), count, pending);
+                bytesToRead = count * disk->BLOCK_SIZE;
+                i += count - 1;
+            } else {
+                // skip remainder if there is, only first block will have remainder
+                blockCache.read(array[i], data + (*size), (*remainder), bytesToRead);
+            }
+        }
         (*size) += bytesToRead;
 
-        // mark that one data block has been read
+        // mark that data blocks have been read
         (*rlength) -= bytesToRead;
         
         if ((*remainder) != 0)
@@ -492,7 +2050,7 @@ size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
 }
 
 ssize_t FileSystem::writeArray(uint32_t array[], size_t arraySize, size_t *size, 
-size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
+size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data, Disk::Batch *pending) {
     // block for writing data
     Block block;
 
@@ -505,38 +2063,42 @@ size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
 
         // determine how long to write
         size_t bytesToWrite = std::min(disk->BLOCK_SIZE - (*remainder), (*rlength));
-        bool writingPartialBlock = bytesToWrite < disk->BLOCK_SIZE;
 
-        // invalid blocks, allocate one
         if (array[i] == 0) {
-            // only need to clean the new allocated block when we write 
-            // partial of the block
-            ssize_t blockNum = allocate_free_block();
-            
-            // no free block
-            if (blockNum == -1)
+            // blocks are reserved before writing, a missing one was left as
+            // a hole for a block of zeros or means the disk is full
+            if (bytesToWrite < disk->BLOCK_SIZE || !is_zero(data + (*size)))
                 return -1;
-            
-            array[i] = blockNum;
-
-            // clear the offset bits
-            if (writingPartialBlock)
-                memset(block.Data, 0, *remainder);
+        } else if (bytesToWrite < disk->BLOCK_SIZE) {
+            // should read in the block only when we write part of the block,
+            // new blocks were zeroed in the cache when they were reserved
+            blockCache.read(array[i], block.Data);
+
+            // skip remainder if there is, only first block will have remainder
+            memcpy(block.Data + (*remainder), data + (*size), bytesToWrite);
+            blockCache.write(array[i], block.Data);
+            note_read(Stats::DATA_BLOCK, array[i]);
+            note_write(Stats::DATA_BLOCK, array[i]);
+        } else {
+            // whole blocks that are adjacent on disk go out in one write
+            size_t count = 1;
+            while (i + count < arraySize && (*rlength) >= (count + 1) * disk->BLOCK_SIZE
+                && array[i + count] == array[i] + count)
+                count++;
+
+            // an asynchronous disk gets every whole block queued, even single ones
+            note_write(Stats::DATA_BLOCK, array[i], count);
+            if (count == 1 && disk->depth() == 1)
+                blockCache.write(array[i], data + (*size));
+            else
+                blockCache.write_run(array[i], data + (*size), count, pending);
+
+            bytesToWrite = count * disk->BLOCK_SIZE;
+            i += count - 1;
         }
-
-        // should read in the block only when we write part of the block
-        // otherwise, we don't care what was in the block
-        if (writingPartialBlock) {
-            disk->read(array[i], block.Data);
-        }
-        
-        // skip remainder if there is, only first block will have remainder
-        memcpy(block.Data + (*remainder), data + (*size), bytesToWrite);
         (*size) += bytesToWrite;
 
-        disk->write(array[i], block.Data);
-
-        // mark that one data block has been written
+        // mark that data blocks have been written
         (*rlength) -= bytesToWrite;
         
         if ((*remainder) != 0)
@@ -549,4 +2111,4 @@ size_t *skipBlocks, size_t *remainder, size_t *rlength, char *data) {
 
     // means that still needs further writing
     return 1;
-}
\ No newline at end of file
+}
\ No newline at end of file
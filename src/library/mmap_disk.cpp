@@ -0,0 +1,92 @@
+// mmap_disk.cpp: Disk emulator backed by a memory mapping
+
+#include "sfs/mmap_disk.h"
+
+#include <stdexcept>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+void MmapDisk::open(const char *path, size_t nblocks) {
+    Disk::open(path, nblocks);
+
+    Syscalls++;
+    void *mapping = mmap(NULL, nblocks*BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to map %s: %s", path, strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    Mapping = (char *)mapping;
+}
+
+MmapDisk::~MmapDisk() {
+    if (Mapping != NULL) {
+    	munmap(Mapping, Blocks*BLOCK_SIZE);
+    	Mapping = NULL;
+    }
+}
+
+void MmapDisk::read(int blocknum, char *data) {
+    sanity_check(blocknum, data);
+
+    memcpy(data, Mapping + (size_t)blocknum*BLOCK_SIZE, BLOCK_SIZE);
+    Reads++;
+    trace(Tracer::DISK_READ, blocknum);
+}
+
+void MmapDisk::write(int blocknum, char *data) {
+    sanity_check(blocknum, data);
+
+    memcpy(Mapping + (size_t)blocknum*BLOCK_SIZE, data, BLOCK_SIZE);
+    Writes++;
+    trace(Tracer::DISK_WRITE, blocknum);
+}
+
+void MmapDisk::readv(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count  = sanity_check(blocknum, iov, iovcnt);
+    char  *source = Mapping + (size_t)blocknum*BLOCK_SIZE;
+
+    for (int i = 0; i < iovcnt; i++) {
+    	memcpy(iov[i].iov_base, source, iov[i].iov_len);
+    	source += iov[i].iov_len;
+    }
+
+    Reads += count;
+    trace(Tracer::DISK_READ, blocknum, count);
+}
+
+void MmapDisk::writev(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count  = sanity_check(blocknum, iov, iovcnt);
+    char  *target = Mapping + (size_t)blocknum*BLOCK_SIZE;
+
+    for (int i = 0; i < iovcnt; i++) {
+    	memcpy(target, iov[i].iov_base, iov[i].iov_len);
+    	target += iov[i].iov_len;
+    }
+
+    Writes += count;
+    trace(Tracer::DISK_WRITE, blocknum, count);
+}
+
+const char *MmapDisk::view(int blocknum) {
+    sanity_check(blocknum, Mapping);
+
+    Reads++;
+    trace(Tracer::DISK_READ, blocknum);
+    return Mapping + (size_t)blocknum*BLOCK_SIZE;
+}
+
+void MmapDisk::sync() {
+    Syscalls++;
+    if (msync(Mapping, Blocks*BLOCK_SIZE, MS_SYNC) < 0) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to sync: %s", strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    trace(Tracer::DISK_SYNC, 0, 0);
+}
@@ -0,0 +1,123 @@
+// stats.cpp: File system statistics
+
+#include "sfs/stats.h"
+
+#include <algorithm>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+// Histogram -------------------------------------------------------------------
+
+void Histogram::record(uint64_t nanoseconds) {
+    size_t i = nanoseconds < 2 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    Buckets[i < BUCKETS ? i : BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+    Count.fetch_add(1, std::memory_order_relaxed);
+    Total.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t max = Max.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !Max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+    	;
+}
+
+void Histogram::reset() {
+    for (auto &bucket : Buckets)
+    	bucket = 0;
+    Count = 0;
+    Total = 0;
+    Max   = 0;
+}
+
+uint64_t Histogram::percentile(double fraction) const {
+    uint64_t count = this->count();
+    if (count == 0)
+    	return 0;
+
+    // smallest bucket bound with at least the wanted share below it
+    uint64_t wanted = fraction * count + 0.5;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+    	seen += bucket(i);
+    	if (seen >= wanted && seen > 0)
+    	    return std::min(bound(i), max());
+    }
+    return max();
+}
+
+// Stats -----------------------------------------------------------------------
+
+void Stats::reset() {
+    for (auto &reads : Reads)
+    	reads = 0;
+    for (auto &writes : Writes)
+    	writes = 0;
+    for (auto &counter : Counters)
+    	counter = 0;
+    for (auto &latency : Latency)
+    	latency.reset();
+}
+
+const char *Stats::name(BlockType type) {
+    static const char *names[BLOCK_TYPES] = {
+    	"super", "bitmap", "journal", "inode", "indirect", "data",
+    };
+    return names[type];
+}
+
+const char *Stats::name(Operation operation) {
+    static const char *names[OPERATIONS] = {
+    	"create", "remove", "read", "write", "mount",
+    };
+    return names[operation];
+}
+
+const char *Stats::name(Counter counter) {
+    static const char *names[COUNTERS] = {
+    	"bytes_read", "bytes_written", "blocks_allocated", "blocks_freed", "allocation_runs",
+    	"inodes_allocated", "inodes_freed",
+    };
+    return names[counter];
+}
+
+std::string Stats::json() const {
+    std::string json;
+    char buffer[BUFSIZ];
+
+    snprintf(buffer, sizeof(buffer), "{\"enabled\": %s, \"blocks\": {", enabled() ? "true" : "false");
+    json += buffer;
+    for (int t = 0; t < BLOCK_TYPES; t++) {
+    	snprintf(buffer, sizeof(buffer), "%s\"%s\": {\"reads\": %" PRIu64 ", \"writes\": %" PRIu64 "}",
+    	    t ? ", " : "", name((BlockType)t), reads((BlockType)t), writes((BlockType)t));
+    	json += buffer;
+    }
+
+    json += "}, \"counters\": {";
+    for (int c = 0; c < COUNTERS; c++) {
+    	snprintf(buffer, sizeof(buffer), "%s\"%s\": %" PRIu64, c ? ", " : "", name((Counter)c), counter((Counter)c));
+    	json += buffer;
+    }
+
+    // buckets are listed up to the last non-empty one
+    json += "}, \"latency\": {";
+    for (int o = 0; o < OPERATIONS; o++) {
+    	const Histogram &histogram = Latency[o];
+    	snprintf(buffer, sizeof(buffer),
+    	    "%s\"%s\": {\"count\": %" PRIu64 ", \"total_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64
+    	    ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"buckets\": [",
+    	    o ? ", " : "", name((Operation)o), histogram.count(), histogram.total(), histogram.max(),
+    	    histogram.percentile(0.5), histogram.percentile(0.9), histogram.percentile(0.99));
+    	json += buffer;
+
+    	size_t used = Histogram::BUCKETS;
+    	while (used > 0 && histogram.bucket(used - 1) == 0)
+    	    used--;
+    	for (size_t i = 0; i < used; i++) {
+    	    snprintf(buffer, sizeof(buffer), "%s%" PRIu64, i ? ", " : "", histogram.bucket(i));
+    	    json += buffer;
+    	}
+    	json += "]}";
+    }
+    json += "}}";
+
+    return json;
+}
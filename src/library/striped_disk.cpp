@@ -0,0 +1,310 @@
+// striped_disk.cpp: Disk emulator striped across several image files
+
+#include "sfs/striped_disk.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+StripedDisk::StripedDisk(size_t members, size_t stripe)
+    : Stripe(std::max<size_t>(stripe, 1)), Stopping(false) {
+    for (size_t i = 0; i < std::max<size_t>(members, 1); i++) {
+    	Members.push_back(std::unique_ptr<Member>(new Member()));
+    	Members.back()->FileDescriptor = -1;
+    }
+}
+
+StripedDisk::~StripedDisk() {
+    {
+    	std::lock_guard<std::mutex> guard(Lock);
+    	Stopping = true;
+    }
+    Ready.notify_all();
+
+    // the first member doubles as the base descriptor, which Disk closes
+    for (size_t i = 0; i < Members.size(); i++) {
+    	if (Members[i]->Worker.joinable())
+    	    Members[i]->Worker.join();
+    	if (i > 0 && Members[i]->FileDescriptor >= 0)
+    	    close(Members[i]->FileDescriptor);
+    }
+}
+
+void StripedDisk::open(const char *path, size_t nblocks) {
+    // every member holds the same number of whole stripe units
+    size_t units  = (nblocks + Stripe - 1) / Stripe;
+    size_t blocks = (units + Members.size() - 1) / Members.size() * Stripe;
+
+    for (size_t i = 0; i < Members.size(); i++) {
+    	std::string member = std::string(path) + "." + std::to_string(i);
+
+    	int fd = ::open(member.c_str(), O_RDWR|O_CREAT, 0600);
+    	if (fd < 0 || ftruncate(fd, blocks*BLOCK_SIZE) < 0) {
+    	    std::string what = "Unable to open " + member + ": " + strerror(errno);
+    	    if (fd >= 0)
+    	    	close(fd);
+    	    throw std::runtime_error(what);
+    	}
+    	Members[i]->FileDescriptor = fd;
+    }
+
+    FileDescriptor = Members[0]->FileDescriptor;
+    Blocks   = nblocks;
+    Reads    = 0;
+    Writes   = 0;
+    Punches  = 0;
+    Syscalls = 0;
+
+    // a single member never hands requests off
+    for (size_t i = 0; Members.size() > 1 && i < Members.size(); i++) {
+    	if (!Members[i]->Worker.joinable())
+    	    Members[i]->Worker = std::thread(&StripedDisk::work, this, Members[i].get());
+    }
+}
+
+void StripedDisk::work(Member *member) {
+    std::unique_lock<std::mutex> guard(Lock);
+    while (true) {
+    	Ready.wait(guard, [&]() { return Stopping || !member->Queue.empty(); });
+    	if (member->Queue.empty())
+    	    return;
+
+    	Request *request = member->Queue.front();
+    	member->Queue.pop_front();
+
+    	guard.unlock();
+    	perform(member, request);
+    	guard.lock();
+
+    	request->Finished = true;
+    	Done.notify_all();
+    }
+}
+
+size_t StripedDisk::locate(size_t blocknum, size_t *member) const {
+    size_t unit = blocknum / Stripe;
+    *member = unit % Members.size();
+    return unit / Members.size() * Stripe + blocknum % Stripe;
+}
+
+void StripedDisk::split(bool write, int blocknum, const struct iovec *iov, int iovcnt, std::vector<Request> *requests) const {
+    requests->resize(Members.size());
+    for (auto &request : *requests) {
+    	request.Write    = write;
+    	request.Offset   = 0;
+    	request.Finished = false;
+    }
+
+    // units of one member follow each other in its image, so each member
+    // gets one consecutive range however many units the request spans
+    size_t block = blocknum;
+    size_t used  = 0;
+    for (int i = 0; i < iovcnt; ) {
+    	size_t member;
+    	size_t target = locate(block, &member);
+    	size_t bytes  = std::min((Stripe - block % Stripe) * BLOCK_SIZE, iov[i].iov_len - used);
+
+    	Request &request = (*requests)[member];
+    	if (request.Iov.empty())
+    	    request.Offset = (off_t)target*BLOCK_SIZE;
+    	request.Iov.push_back({(char *)iov[i].iov_base + used, bytes});
+
+    	block += bytes / BLOCK_SIZE;
+    	used  += bytes;
+    	if (used == iov[i].iov_len) {
+    	    used = 0;
+    	    i++;
+    	}
+    }
+}
+
+void StripedDisk::perform(Member *member, Request *request) {
+    off_t offset = request->Offset;
+    int   iovcnt = request->Iov.size();
+
+    // the kernel caps the number of buffers per call
+    for (int done = 0; done < iovcnt; ) {
+    	int     batch = std::min(iovcnt - done, IOV_MAX);
+    	ssize_t bytes = 0;
+    	for (int i = done; i < done + batch; i++)
+    	    bytes += request->Iov[i].iov_len;
+
+    	Syscalls++;
+    	ssize_t result = request->Write ?
+    	    pwritev(member->FileDescriptor, request->Iov.data() + done, batch, offset) :
+    	    preadv(member->FileDescriptor, request->Iov.data() + done, batch, offset);
+
+    	if (result != bytes) {
+    	    char what[BUFSIZ];
+    	    snprintf(what, BUFSIZ, "Unable to %s member %lu at %ld+%lu: %s", request->Write ? "write" : "read",
+    	    	(size_t)(member - Members[0].get()), (long)(offset / BLOCK_SIZE), bytes / BLOCK_SIZE,
+    	    	result < 0 ? strerror(errno) : "short transfer");
+    	    request->Error = what;
+    	    return;
+    	}
+
+    	offset += bytes;
+    	done   += batch;
+    }
+}
+
+void StripedDisk::dispatch(std::vector<Request> &requests, int blocknum, size_t count) {
+    std::vector<size_t> busy;
+    for (size_t i = 0; i < requests.size(); i++) {
+    	if (!requests[i].Iov.empty())
+    	    busy.push_back(i);
+    }
+
+    // the caller performs the last request itself while workers do the rest
+    if (busy.size() > 1) {
+    	{
+    	    std::lock_guard<std::mutex> guard(Lock);
+    	    for (size_t i = 0; i + 1 < busy.size(); i++)
+    	    	Members[busy[i]]->Queue.push_back(&requests[busy[i]]);
+    	}
+    	Ready.notify_all();
+    }
+
+    perform(Members[busy.back()].get(), &requests[busy.back()]);
+
+    if (busy.size() > 1) {
+    	std::unique_lock<std::mutex> guard(Lock);
+    	Done.wait(guard, [&]() {
+    	    for (size_t i = 0; i + 1 < busy.size(); i++) {
+    	    	if (!requests[busy[i]].Finished)
+    	    	    return false;
+    	    }
+    	    return true;
+    	});
+    }
+
+    for (auto i : busy) {
+    	if (!requests[i].Error.empty())
+    	    throw std::runtime_error(requests[i].Error);
+    }
+
+    bool write = requests[busy.back()].Write;
+    if (write)
+    	Writes += count;
+    else
+    	Reads += count;
+    trace(write ? Tracer::DISK_WRITE : Tracer::DISK_READ, blocknum, count);
+}
+
+void StripedDisk::read(int blocknum, char *data) {
+    sanity_check(blocknum, data);
+
+    size_t member;
+    off_t  offset = (off_t)locate(blocknum, &member)*BLOCK_SIZE;
+
+    Syscalls++;
+    if (pread(Members[member]->FileDescriptor, data, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to read %d: %s", blocknum, strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    Reads++;
+    trace(Tracer::DISK_READ, blocknum);
+}
+
+void StripedDisk::write(int blocknum, char *data) {
+    sanity_check(blocknum, data);
+
+    size_t member;
+    off_t  offset = (off_t)locate(blocknum, &member)*BLOCK_SIZE;
+
+    Syscalls++;
+    if (pwrite(Members[member]->FileDescriptor, data, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to write %d: %s", blocknum, strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    Writes++;
+    trace(Tracer::DISK_WRITE, blocknum);
+}
+
+void StripedDisk::readv(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count = sanity_check(blocknum, iov, iovcnt);
+
+    std::vector<Request> requests;
+    split(false, blocknum, iov, iovcnt, &requests);
+    dispatch(requests, blocknum, count);
+}
+
+void StripedDisk::writev(int blocknum, const struct iovec *iov, int iovcnt) {
+    size_t count = sanity_check(blocknum, iov, iovcnt);
+
+    std::vector<Request> requests;
+    split(true, blocknum, iov, iovcnt, &requests);
+    dispatch(requests, blocknum, count);
+}
+
+void StripedDisk::zero(int blocknum, size_t count, bool release) {
+    static char empty[BLOCK_SIZE];
+
+    if (count == 0)
+    	return;
+    sanity_check(blocknum, empty);
+    sanity_check(blocknum + (int)count - 1, empty);
+
+    if (!release) {
+    	Disk::zero(blocknum, count, false);
+    	return;
+    }
+
+    // range each member holds, in blocks of its image
+    std::vector<std::pair<size_t, size_t>> ranges(Members.size(), std::make_pair(0, 0));
+    for (size_t block = blocknum; block < blocknum + count; ) {
+    	size_t member;
+    	size_t target = locate(block, &member);
+    	size_t length = std::min(Stripe - block % Stripe, blocknum + count - block);
+
+    	if (ranges[member].second == 0)
+    	    ranges[member].first = target;
+    	ranges[member].second = target + length - ranges[member].first;
+    	block += length;
+    }
+
+    for (size_t i = 0; i < Members.size(); i++) {
+    	if (ranges[i].second == 0)
+    	    continue;
+
+    	Syscalls++;
+    	if (fallocate(Members[i]->FileDescriptor, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+    	    (off_t)ranges[i].first*BLOCK_SIZE, (off_t)ranges[i].second*BLOCK_SIZE) == 0)
+    	    continue;
+
+    	if (errno == EOPNOTSUPP || errno == ENOSYS) {
+    	    Disk::zero(blocknum, count, false);
+    	    return;
+    	}
+
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to zero %d+%lu: %s", blocknum, count, strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    Punches += count;
+    trace(Tracer::DISK_ZERO, blocknum, count);
+}
+
+void StripedDisk::sync() {
+    for (auto &member : Members) {
+    	Syscalls++;
+    	if (fsync(member->FileDescriptor) < 0) {
+    	    char what[BUFSIZ];
+    	    snprintf(what, BUFSIZ, "Unable to sync: %s", strerror(errno));
+    	    throw std::runtime_error(what);
+    	}
+    }
+
+    trace(Tracer::DISK_SYNC, 0, 0);
+}
@@ -0,0 +1,103 @@
+// tracer.cpp: Block access trace recorder
+
+#include "sfs/tracer.h"
+#include "sfs/disk.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void Tracer::open(const char *path) {
+    close();
+
+    int fd = ::open(path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    Header header = {MAGIC, VERSION, sizeof(Record), Disk::BLOCK_SIZE};
+    if (fd < 0 || ::write(fd, &header, sizeof(header)) != sizeof(header)) {
+    	char what[BUFSIZ];
+    	snprintf(what, BUFSIZ, "Unable to open %s: %s", path, strerror(errno));
+    	if (fd >= 0)
+    	    ::close(fd);
+    	throw std::runtime_error(what);
+    }
+
+    std::lock_guard<std::mutex> guard(Lock);
+    FileDescriptor = fd;
+    Records = 0;
+    Buffer.clear();
+    Buffer.reserve(BUFFER_RECORDS);
+    Start = std::chrono::steady_clock::now();
+}
+
+void Tracer::close() {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (FileDescriptor < 0)
+    	return;
+
+    flush_locked();
+    ::close(FileDescriptor);
+    FileDescriptor = -1;
+}
+
+void Tracer::record(Op op, size_t block, size_t count, uint8_t type) {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (FileDescriptor < 0)
+    	return;
+
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    	std::chrono::steady_clock::now() - Start).count();
+
+    do {
+    	uint16_t part = std::min(count, (size_t)UINT16_MAX);
+    	Buffer.push_back({time, (uint32_t)block, part, (uint8_t)op, type});
+    	block += part;
+    	count -= part;
+    	Records++;
+
+    	if (Buffer.size() >= BUFFER_RECORDS)
+    	    flush_locked();
+    } while (count > 0);
+}
+
+void Tracer::flush_locked() {
+    // a trace is a diagnostic, losing its tail must not fail the I/O
+    size_t bytes = Buffer.size() * sizeof(Record);
+    if (bytes > 0 && ::write(FileDescriptor, Buffer.data(), bytes) != (ssize_t)bytes)
+    	fprintf(stderr, "Unable to write trace: %s\n", strerror(errno));
+    Buffer.clear();
+}
+
+void Tracer::load(const char *path, std::vector<Record> *records) {
+    char what[BUFSIZ];
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL) {
+    	snprintf(what, BUFSIZ, "Unable to open %s: %s", path, strerror(errno));
+    	throw std::runtime_error(what);
+    }
+
+    Header header;
+    if (fread(&header, sizeof(header), 1, stream) != 1 || header.Magic != MAGIC
+    || header.Version != VERSION || header.RecordSize != sizeof(Record)
+    || header.BlockSize != Disk::BLOCK_SIZE) {
+    	fclose(stream);
+    	snprintf(what, BUFSIZ, "Unable to load %s: not a trace", path);
+    	throw std::runtime_error(what);
+    }
+
+    records->clear();
+    Record record;
+    while (fread(&record, sizeof(record), 1, stream) == 1)
+    	records->push_back(record);
+    fclose(stream);
+}
+
+const char *Tracer::name(Op op) {
+    static const char *names[OPS] = {
+    	"read", "write", "disk read", "disk write", "disk zero", "disk sync",
+    };
+    return names[op];
+}
@@ -1,15 +1,30 @@
 // sfssh.cpp: Simple file system shell
 
+#include "sfs/async_disk.h"
+#include "sfs/directory.h"
 #include "sfs/disk.h"
+#include "sfs/file.h"
 #include "sfs/fs.h"
+#include "sfs/mmap_disk.h"
+#include "sfs/striped_disk.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 // Macros
 
@@ -20,37 +35,111 @@
 void do_debug(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_format(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_mount(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_unmount(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_check(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_sync(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_cache(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_readahead(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_sparse(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_journal(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_stats(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_trace(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_cat(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_copyout(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_create(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_remove(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_punch(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2, char *arg3);
+void do_fallocate(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2, char *arg3);
+void do_truncate(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_stat(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_copyin(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_mkdir(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_ls(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_lookup(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_put(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_get(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_rm(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_import(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
+void do_export(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 void do_help(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2);
 
 bool copyout(FileSystem &fs, size_t inumber, const char *path);
 bool copyin(FileSystem &fs, const char *path, size_t inumber);
 
+// File copied by a bulk import or export
+struct BulkJob {
+    std::string	Host;		// Path of the host file
+    size_t	Directory;	// Directory linked into on import
+    std::string	Name;		// Name linked on import
+    size_t	Inumber;	// Inode copied out on export
+};
+
+// Worker threads a bulk copy runs on, most of their time is spent waiting
+// on host or image I/O
+const static size_t BULK_WORKERS = 8;
+
+// Bytes each worker moves at a time
+const static size_t BULK_CHUNK = 1 << 20;
+
+bool import_tree(FileSystem &fs, const std::string &host, size_t directory, std::vector<BulkJob> *jobs);
+bool export_tree(FileSystem &fs, size_t directory, const std::string &host, std::vector<BulkJob> *jobs);
+bool import_file(FileSystem &fs, const BulkJob &job, char *buffer, size_t *bytes);
+bool export_file(FileSystem &fs, const BulkJob &job, char *buffer, size_t *bytes);
+size_t run_bulk(FileSystem &fs, const std::vector<BulkJob> &jobs,
+    std::function<bool(FileSystem &, const BulkJob &, char *, size_t *)> copy, size_t *bytes);
+
 // Main execution
 
 int main(int argc, char *argv[]) {
-    Disk	disk;
+    // -m maps the image into memory, -q queues block I/O asynchronously,
+    // -s stripes it across member images
+    bool   mapped  = false;
+    size_t depth   = 0;
+    size_t members = 0;
+    size_t stripe  = StripedDisk::DEFAULT_STRIPE;
+    int    option;
+
+    while ((option = getopt(argc, argv, "mq:s:")) != -1) {
+    	switch (option) {
+    	    case 'm':
+    	    	mapped = true;
+    	    	break;
+    	    case 'q':
+    	    	depth = atoi(optarg);
+    	    	break;
+    	    case 's':
+    	    	if (sscanf(optarg, "%lu:%lu", &members, &stripe) < 1 || members == 0 || stripe == 0)
+    	    	    argc = 0;
+    	    	break;
+    	    default:
+    	    	argc = 0;
+    	    	break;
+    	}
+    }
+
+    std::unique_ptr<Disk> image(mapped ? new MmapDisk() : depth ? new AsyncDisk(depth) :
+    	members ? new StripedDisk(members, stripe) : new Disk());
+    Disk	&disk = *image;
     FileSystem	fs;
 
-    if (argc != 3) {
-    	fprintf(stderr, "Usage: %s <diskfile> <nblocks>\n", argv[0]);
+    // interactive use can afford statistics
+    fs.stats().enable(true);
+
+    if (argc - optind != 2 || (mapped + (depth > 0) + (members > 0)) > 1) {
+    	fprintf(stderr, "Usage: %s [-m | -q depth | -s members[:stripe]] <diskfile> <nblocks>\n", argv[0]);
     	return EXIT_FAILURE;
     }
 
+    const char *path = argv[optind];
     try {
-    	disk.open(argv[1], atoi(argv[2]));
+    	disk.open(path, atoi(argv[optind + 1]));
     } catch (std::runtime_error &e) {
-    	fprintf(stderr, "Unable to open disk %s: %s\n", argv[1], e.what());
+    	fprintf(stderr, "Unable to open disk %s: %s\n", path, e.what());
     	return EXIT_FAILURE;
     }
 
     while (true) {
-	char line[BUFSIZ], cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ];
+	char line[BUFSIZ], cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ], arg3[BUFSIZ];
 
     	fprintf(stderr, "sfs> ");
     	fflush(stderr);
@@ -59,7 +148,7 @@ int main(int argc, char *argv[]) {
     	    break;
     	}
 
-    	int args = sscanf(line, "%s %s %s", cmd, arg1, arg2);
+    	int args = sscanf(line, "%s %s %s %s", cmd, arg1, arg2, arg3);
     	if (args == 0) {
     	    continue;
 	}
@@ -70,6 +159,24 @@ int main(int argc, char *argv[]) {
 	    do_format(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "mount")) {
 	    do_mount(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "unmount")) {
+	    do_unmount(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "check")) {
+	    do_check(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "sync")) {
+	    do_sync(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "cache")) {
+	    do_cache(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "readahead")) {
+	    do_readahead(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "sparse")) {
+	    do_sparse(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "journal")) {
+	    do_journal(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "stats")) {
+	    do_stats(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "trace")) {
+	    do_trace(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "cat")) {
 	    do_cat(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "copyout")) {
@@ -78,10 +185,32 @@ int main(int argc, char *argv[]) {
 	    do_create(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "remove")) {
 	    do_remove(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "punch")) {
+	    do_punch(disk, fs, args, arg1, arg2, arg3);
+	} else if (streq(cmd, "fallocate")) {
+	    do_fallocate(disk, fs, args, arg1, arg2, arg3);
+	} else if (streq(cmd, "truncate")) {
+	    do_truncate(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "stat")) {
 	    do_stat(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "copyin")) {
 	    do_copyin(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "mkdir")) {
+	    do_mkdir(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "ls")) {
+	    do_ls(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "lookup")) {
+	    do_lookup(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "put")) {
+	    do_put(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "get")) {
+	    do_get(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "rm")) {
+	    do_rm(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "import")) {
+	    do_import(disk, fs, args, arg1, arg2);
+	} else if (streq(cmd, "export")) {
+	    do_export(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "help")) {
 	    do_help(disk, fs, args, arg1, arg2);
 	} else if (streq(cmd, "exit") || streq(cmd, "quit")) {
@@ -103,16 +232,19 @@ void do_debug(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     	return;
     }
 
+    // debug reads the image directly, so write back cached blocks first
+    fs.sync();
     fs.debug(&disk);
 }
 
 void do_format(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
-    if (args != 1) {
-    	printf("Usage: format\n");
+    if (args > 2 || (args == 2 && !streq(arg1, "full"))) {
+    	printf("Usage: format [full]\n");
     	return;
     }
 
-    if (fs.format(&disk)) {
+    // full writes zeros over the image rather than leaving it sparse
+    if (fs.format(&disk, args == 2)) {
     	printf("disk formatted.\n");
     } else {
     	printf("format failed!\n");
@@ -125,13 +257,193 @@ void do_mount(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     	return;
     }
 
+    struct timespec start, end;
+    size_t reads = disk.reads();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     if (fs.mount(&disk)) {
+    	clock_gettime(CLOCK_MONOTONIC, &end);
+    	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    	reads = disk.reads() - reads;
+
+    	// timing goes to stderr so session output stays reproducible
     	printf("disk mounted.\n");
+    	fprintf(stderr, "mounted in %.3f ms, %lu blocks read (%.0f blocks/s)\n",
+    	    ms, reads, ms > 0 ? reads / (ms / 1e3) : 0.0);
     } else {
     	printf("mount failed!\n");
     }
 }
 
+void do_unmount(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+    	printf("Usage: unmount\n");
+    	return;
+    }
+
+    if (disk.mounted()) {
+    	fs.unmount();
+    	printf("disk unmounted.\n");
+    } else {
+    	printf("unmount failed!\n");
+    }
+}
+
+void do_check(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+    	printf("Usage: check\n");
+    	return;
+    }
+
+    if (!disk.mounted()) {
+    	printf("check failed!\n");
+    } else if (fs.check()) {
+    	printf("bitmaps consistent.\n");
+    } else {
+    	printf("bitmaps repaired.\n");
+    }
+}
+
+void do_sync(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+    	printf("Usage: sync\n");
+    	return;
+    }
+
+    fs.sync();
+    printf("disk synced.\n");
+}
+
+void do_cache(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+    	printf("Usage: cache [blocks]\n");
+    	return;
+    }
+
+    Cache &cache = fs.cache();
+    if (args == 2) {
+    	cache.resize(atoi(arg1));
+    }
+
+    printf("cache capacity: %lu blocks\n", cache.capacity());
+    printf("    %lu resident blocks\n", cache.resident());
+    printf("    %lu dirty blocks\n", cache.dirty());
+    printf("    %lu hits\n", cache.hits());
+    printf("    %lu misses\n", cache.misses());
+    printf("    %lu evictions\n", cache.evictions());
+    printf("    %lu read-ahead blocks\n", cache.prefetches());
+    printf("    %lu read-ahead hits\n", cache.prefetch_hits());
+    printf("    %lu read-ahead wasted\n", cache.prefetch_wasted());
+    printf("    %lu disk block reads\n", disk.reads());
+    printf("    %lu disk block writes\n", disk.writes());
+    printf("    %lu disk block punches\n", disk.punches());
+    printf("    %lu disk syscalls\n", disk.syscalls());
+    printf("    %lu disk queue depth\n", disk.depth());
+}
+
+void do_readahead(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+    	printf("Usage: readahead [blocks]\n");
+    	return;
+    }
+
+    if (args == 2) {
+    	fs.set_readahead(atoi(arg1));
+    }
+
+    printf("read-ahead window: %lu blocks\n", fs.readahead());
+}
+
+void do_journal(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+    	printf("Usage: journal [operations]\n");
+    	return;
+    }
+
+    if (args == 2) {
+    	fs.set_group_commit(atoi(arg1));
+    }
+
+    if (fs.group_commit() == 0) {
+    	printf("group commit: on sync\n");
+    } else {
+    	printf("group commit: %lu operations\n", fs.group_commit());
+    }
+    printf("    %lu commits\n", fs.commits());
+    printf("    %lu journal block writes\n", fs.journal_writes());
+    printf("    %lu checkpoints\n", fs.checkpoints());
+}
+
+void do_stats(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2 || (args == 2 && !streq(arg1, "on") && !streq(arg1, "off")
+    && !streq(arg1, "reset") && !streq(arg1, "json"))) {
+    	printf("Usage: stats [on | off | reset | json]\n");
+    	return;
+    }
+
+    Stats &stats = fs.stats();
+    if (args == 2 && streq(arg1, "json")) {
+    	printf("%s\n", fs.stats_json().c_str());
+    	return;
+    } else if (args == 2 && streq(arg1, "reset")) {
+    	stats.reset();
+    	printf("stats reset.\n");
+    	return;
+    } else if (args == 2) {
+    	stats.enable(streq(arg1, "on"));
+    }
+
+    printf("stats: %s\n", stats.enabled() ? "on" : "off");
+    printf("    %-10s %10s %10s\n", "block", "reads", "writes");
+    for (int t = 0; t < Stats::BLOCK_TYPES; t++) {
+    	Stats::BlockType type = (Stats::BlockType)t;
+    	printf("    %-10s %10lu %10lu\n", Stats::name(type),
+    	    (unsigned long)stats.reads(type), (unsigned long)stats.writes(type));
+    }
+
+    for (int c = 0; c < Stats::COUNTERS; c++) {
+    	std::string name = Stats::name((Stats::Counter)c);
+    	std::replace(name.begin(), name.end(), '_', ' ');
+    	printf("    %lu %s\n", (unsigned long)stats.counter((Stats::Counter)c), name.c_str());
+    }
+
+    printf("    %-10s %10s %10s %10s %10s %10s\n", "operation", "count", "mean us", "p50 us", "p99 us", "max us");
+    for (int o = 0; o < Stats::OPERATIONS; o++) {
+    	const Histogram &latency = stats.latency((Stats::Operation)o);
+    	printf("    %-10s %10lu %10.1f %10.1f %10.1f %10.1f\n", Stats::name((Stats::Operation)o),
+    	    (unsigned long)latency.count(), latency.count() ? latency.total() / 1e3 / latency.count() : 0.0,
+    	    latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.max() / 1e3);
+    }
+}
+
+void do_trace(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    // outlives the disk, which may still be written to on exit
+    static Tracer tracer;
+
+    if (args != 2) {
+    	printf("Usage: trace <file | off>\n");
+    	return;
+    }
+
+    if (tracer.is_open()) {
+    	disk.set_tracer(NULL);
+    	tracer.close();
+    	printf("trace stopped after %lu records.\n", tracer.records());
+    }
+
+    if (streq(arg1, "off"))
+    	return;
+
+    try {
+    	tracer.open(arg1);
+    } catch (std::runtime_error &e) {
+    	printf("trace failed: %s\n", e.what());
+    	return;
+    }
+    disk.set_tracer(&tracer);
+    printf("tracing to %s.\n", arg1);
+}
+
 void do_cat(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     if (args != 2) {
     	printf("Usage: cat <inode>\n");
@@ -182,6 +494,66 @@ void do_remove(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_sparse(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2 || (args == 2 && !streq(arg1, "on") && !streq(arg1, "off"))) {
+    	printf("Usage: sparse [on | off]\n");
+    	return;
+    }
+
+    if (args == 2) {
+    	fs.set_sparse_writes(streq(arg1, "on"));
+    }
+
+    printf("sparse writes: %s\n", fs.sparse_writes() ? "on" : "off");
+}
+
+void do_punch(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2, char *arg3) {
+    if (args != 4) {
+    	printf("Usage: punch <inode> <offset> <length>\n");
+    	return;
+    }
+
+    ssize_t inumber = atoi(arg1);
+    size_t  offset  = strtoul(arg2, NULL, 10);
+    size_t  length  = strtoul(arg3, NULL, 10);
+    if (fs.punch_hole(inumber, offset, length)) {
+    	printf("punched %lu bytes at %lu in inode %ld.\n", length, offset, inumber);
+    } else {
+    	printf("punch failed!\n");
+    }
+}
+
+void do_fallocate(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2, char *arg3) {
+    if (args != 4) {
+    	printf("Usage: fallocate <inode> <offset> <length>\n");
+    	return;
+    }
+
+    ssize_t inumber = atoi(arg1);
+    size_t  offset  = strtoul(arg2, NULL, 10);
+    size_t  length  = strtoul(arg3, NULL, 10);
+    if (fs.fallocate(inumber, offset, length)) {
+    	printf("preallocated %lu bytes at %lu in inode %ld.\n", length, offset, inumber);
+    } else {
+    	printf("fallocate failed!\n");
+    }
+}
+
+void do_truncate(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 3) {
+    	printf("Usage: truncate <inode> <size>\n");
+    	return;
+    }
+
+    ssize_t inumber = atoi(arg1);
+    size_t  size    = strtoul(arg2, NULL, 10);
+    if (fs.truncate(inumber, size)) {
+    	printf("truncated inode %ld to %lu bytes.\n", inumber, size);
+    } else {
+    	printf("truncate failed!\n");
+    }
+}
+
 void do_stat(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     if (args != 2) {
     	printf("Usage: stat <inode>\n");
@@ -208,17 +580,236 @@ void do_copyin(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_mkdir(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+    	printf("Usage: mkdir <path>\n");
+    	return;
+    }
+
+    std::string name;
+    ssize_t parent = Directory::parent(&fs, arg1, &name);
+    if (parent < 0) {
+    	printf("mkdir failed!\n");
+    	return;
+    }
+
+    ssize_t inumber = Directory::create(&fs);
+    if (inumber >= 0 && Directory(&fs, parent).link(name, inumber, Directory::DIRECTORY_ENTRY)) {
+    	printf("created directory %s as inode %ld.\n", arg1, inumber);
+    } else {
+    	if (inumber >= 0)
+    	    fs.remove(inumber);
+    	printf("mkdir failed!\n");
+    }
+}
+
+void do_ls(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+    	printf("Usage: ls [path]\n");
+    	return;
+    }
+
+    Directory::Type type;
+    ssize_t inumber = Directory::resolve(&fs, args == 2 ? arg1 : "/", &type);
+    std::vector<Directory::Entry> entries;
+    if (inumber < 0 || type != Directory::DIRECTORY_ENTRY || !Directory(&fs, inumber).readdir(&entries)) {
+    	printf("ls failed!\n");
+    	return;
+    }
+
+    // buckets come back in hash order
+    std::sort(entries.begin(), entries.end(), [](const Directory::Entry &a, const Directory::Entry &b) {
+    	return std::string(a.Name, a.Length) < std::string(b.Name, b.Length);
+    });
+
+    for (auto &entry : entries) {
+    	printf("%8u %s %.*s\n", entry.Inumber,
+    	    entry.Type == Directory::DIRECTORY_ENTRY ? "dir " : "file", entry.Length, entry.Name);
+    }
+    printf("%lu entries.\n", entries.size());
+}
+
+void do_lookup(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+    	printf("Usage: lookup <path>\n");
+    	return;
+    }
+
+    Directory::Type type;
+    ssize_t inumber = Directory::resolve(&fs, arg1, &type);
+    if (inumber >= 0) {
+    	printf("%s is %s inode %ld.\n", arg1, type == Directory::DIRECTORY_ENTRY ? "directory" : "file", inumber);
+    } else {
+    	printf("lookup failed!\n");
+    }
+}
+
+void do_put(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 3) {
+    	printf("Usage: put <file> <path>\n");
+    	return;
+    }
+
+    // an existing file is overwritten, a new one is linked in first
+    Directory::Type type;
+    ssize_t inumber = Directory::resolve(&fs, arg2, &type);
+    if (inumber >= 0) {
+    	if (type != Directory::FILE_ENTRY || !fs.truncate(inumber, 0)) {
+    	    printf("put failed!\n");
+    	    return;
+    	}
+    } else {
+    	std::string name;
+    	ssize_t parent = Directory::parent(&fs, arg2, &name);
+    	inumber = parent >= 0 ? fs.create() : -1;
+    	if (inumber < 0 || !Directory(&fs, parent).link(name, inumber, Directory::FILE_ENTRY)) {
+    	    if (inumber >= 0)
+    	    	fs.remove(inumber);
+    	    printf("put failed!\n");
+    	    return;
+    	}
+    }
+
+    if (!copyin(fs, arg1, inumber)) {
+    	printf("put failed!\n");
+    }
+}
+
+void do_get(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 3) {
+    	printf("Usage: get <path> <file>\n");
+    	return;
+    }
+
+    Directory::Type type;
+    ssize_t inumber = Directory::resolve(&fs, arg1, &type);
+    if (inumber < 0 || type != Directory::FILE_ENTRY || !copyout(fs, inumber, arg2)) {
+    	printf("get failed!\n");
+    }
+}
+
+void do_rm(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+    	printf("Usage: rm <path>\n");
+    	return;
+    }
+
+    // directories must be empty before they go
+    std::string name;
+    ssize_t parent = Directory::parent(&fs, arg1, &name);
+    Directory::Type type;
+    ssize_t inumber = parent >= 0 ? Directory(&fs, parent).lookup(name, &type) : -1;
+    if (inumber < 0 || (type == Directory::DIRECTORY_ENTRY && Directory(&fs, inumber).size() != 0) ||
+    	!Directory(&fs, parent).unlink(name) || !fs.remove(inumber)) {
+    	printf("rm failed!\n");
+    	return;
+    }
+    printf("removed %s.\n", arg1);
+}
+
+void do_import(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 3) {
+    	printf("Usage: import <hostdir> <path>\n");
+    	return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // directories are made up front, files are then copied in parallel
+    Directory::Type type;
+    ssize_t directory = Directory::resolve(&fs, arg2, &type);
+    std::vector<BulkJob> jobs;
+    if (directory < 0 || type != Directory::DIRECTORY_ENTRY || !import_tree(fs, arg1, directory, &jobs)) {
+    	printf("import failed!\n");
+    	return;
+    }
+
+    // inode and bitmap updates of the whole import go out in few commits
+    size_t groupCommit = fs.group_commit();
+    fs.set_group_commit(0);
+
+    size_t bytes = 0;
+    size_t failures = run_bulk(fs, jobs, import_file, &bytes);
+
+    fs.sync();
+    fs.set_group_commit(groupCommit);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (failures) {
+    	printf("import failed!\n");
+    	return;
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("imported %lu files.\n", jobs.size());
+    fprintf(stderr, "%lu bytes in %.3f s (%.0f files/s, %.2f MB/s)\n", bytes, seconds,
+    	seconds > 0 ? jobs.size() / seconds : 0.0, seconds > 0 ? bytes / seconds / (1 << 20) : 0.0);
+}
+
+void do_export(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
+    if (args != 3) {
+    	printf("Usage: export <path> <hostdir>\n");
+    	return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Directory::Type type;
+    ssize_t directory = Directory::resolve(&fs, arg1, &type);
+    std::vector<BulkJob> jobs;
+    if (directory < 0 || type != Directory::DIRECTORY_ENTRY || !export_tree(fs, directory, arg2, &jobs)) {
+    	printf("export failed!\n");
+    	return;
+    }
+
+    size_t bytes = 0;
+    size_t failures = run_bulk(fs, jobs, export_file, &bytes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (failures) {
+    	printf("export failed!\n");
+    	return;
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("exported %lu files.\n", jobs.size());
+    fprintf(stderr, "%lu bytes in %.3f s (%.0f files/s, %.2f MB/s)\n", bytes, seconds,
+    	seconds > 0 ? jobs.size() / seconds : 0.0, seconds > 0 ? bytes / seconds / (1 << 20) : 0.0);
+}
+
 void do_help(Disk &disk, FileSystem &fs, int args, char *arg1, char *arg2) {
     printf("Commands are:\n");
-    printf("    format\n");
+    printf("    format [full]\n");
     printf("    mount\n");
+    printf("    unmount\n");
+    printf("    check\n");
     printf("    debug\n");
     printf("    create\n");
     printf("    remove  <inode>\n");
+    printf("    punch   <inode> <offset> <length>\n");
+    printf("    fallocate <inode> <offset> <length>\n");
+    printf("    truncate <inode> <size>\n");
     printf("    cat     <inode>\n");
     printf("    stat    <inode>\n");
     printf("    copyin  <file> <inode>\n");
     printf("    copyout <inode> <file>\n");
+    printf("    mkdir   <path>\n");
+    printf("    ls      [path]\n");
+    printf("    lookup  <path>\n");
+    printf("    put     <file> <path>\n");
+    printf("    get     <path> <file>\n");
+    printf("    rm      <path>\n");
+    printf("    import  <hostdir> <path>\n");
+    printf("    export  <path> <hostdir>\n");
+    printf("    sync\n");
+    printf("    cache   [blocks]\n");
+    printf("    readahead [blocks]\n");
+    printf("    sparse  [on | off]\n");
+    printf("    journal [operations]\n");
+    printf("    stats   [on | off | reset | json]\n");
+    printf("    trace   <file | off>\n");
     printf("    help\n");
     printf("    quit\n");
     printf("    exit\n");
@@ -231,10 +822,18 @@ bool copyout(FileSystem &fs, size_t inumber, const char *path) {
     	return false;
     }
 
+    // handle keeps inode and block map resident for the whole copy
+    File file;
+    if (!fs.open(inumber, &file)) {
+    	fprintf(stderr, "Unable to open inode %lu\n", inumber);
+    	fclose(stream);
+    	return false;
+    }
+
     char buffer[4*BUFSIZ] = {0};
     size_t offset = 0;
     while (true) {
-    	ssize_t result = fs.read(inumber, buffer, sizeof(buffer), offset);
+    	ssize_t result = file.pread(buffer, sizeof(buffer), offset);
     	if (result <= 0) {
     	    break;
 	}
@@ -254,6 +853,14 @@ bool copyin(FileSystem &fs, const char *path, size_t inumber) {
     	return false;
     }
 
+    // handle keeps inode and block map resident for the whole copy
+    File file;
+    if (!fs.open(inumber, &file)) {
+    	fprintf(stderr, "Unable to open inode %lu\n", inumber);
+    	fclose(stream);
+    	return false;
+    }
+
     char buffer[4*BUFSIZ] = {0};
     size_t offset = 0;
     while (true) {
@@ -262,14 +869,14 @@ bool copyin(FileSystem &fs, const char *path, size_t inumber) {
     	    break;
 	}
 
-	ssize_t actual = fs.write(inumber, buffer, result, offset);
+	ssize_t actual = file.pwrite(buffer, result, offset);
 	if (actual < 0) {
-	    fprintf(stderr, "fs.write returned invalid result %ld\n", actual);
+	    fprintf(stderr, "file.pwrite returned invalid result %ld\n", actual);
 	    break;
 	}
 	offset += actual;
 	if (actual != result) {
-	    fprintf(stderr, "fs.write only wrote %ld bytes, not %ld bytes\n", actual, result);
+	    fprintf(stderr, "file.pwrite only wrote %ld bytes, not %ld bytes\n", actual, result);
 	    break;
 	}
     }
@@ -278,3 +885,145 @@ bool copyin(FileSystem &fs, const char *path, size_t inumber) {
     fclose(stream);
     return true;
 }
+
+bool import_tree(FileSystem &fs, const std::string &host, size_t directory, std::vector<BulkJob> *jobs) {
+    DIR *stream = opendir(host.c_str());
+    if (stream == nullptr) {
+    	fprintf(stderr, "Unable to open %s: %s\n", host.c_str(), strerror(errno));
+    	return false;
+    }
+
+    bool result = true;
+    struct dirent *entry;
+    while (result && (entry = readdir(stream)) != nullptr) {
+    	std::string name = entry->d_name;
+    	std::string path = host + "/" + name;
+    	struct stat info;
+    	if (name == "." || name == ".." || lstat(path.c_str(), &info) < 0)
+    	    continue;
+
+    	if (S_ISREG(info.st_mode)) {
+    	    jobs->push_back({path, directory, name, 0});
+    	} else if (S_ISDIR(info.st_mode)) {
+    	    // directories already there are merged into
+    	    Directory::Type type;
+    	    ssize_t inumber = Directory(&fs, directory).lookup(name, &type);
+    	    if (inumber < 0) {
+    	    	inumber = Directory::create(&fs);
+    	    	type = Directory::DIRECTORY_ENTRY;
+    	    	if (inumber >= 0 && !Directory(&fs, directory).link(name, inumber, type)) {
+    	    	    fs.remove(inumber);
+    	    	    inumber = -1;
+    	    	}
+    	    }
+    	    result = inumber >= 0 && type == Directory::DIRECTORY_ENTRY && import_tree(fs, path, inumber, jobs);
+    	}
+    }
+
+    closedir(stream);
+    return result;
+}
+
+bool export_tree(FileSystem &fs, size_t directory, const std::string &host, std::vector<BulkJob> *jobs) {
+    if (mkdir(host.c_str(), 0755) < 0 && errno != EEXIST) {
+    	fprintf(stderr, "Unable to make %s: %s\n", host.c_str(), strerror(errno));
+    	return false;
+    }
+
+    std::vector<Directory::Entry> entries;
+    if (!Directory(&fs, directory).readdir(&entries))
+    	return false;
+
+    for (auto &entry : entries) {
+    	std::string path = host + "/" + std::string(entry.Name, entry.Length);
+    	if (entry.Type == Directory::DIRECTORY_ENTRY) {
+    	    if (!export_tree(fs, entry.Inumber, path, jobs))
+    	    	return false;
+    	} else {
+    	    jobs->push_back({path, directory, std::string(), entry.Inumber});
+    	}
+    }
+    return true;
+}
+
+bool import_file(FileSystem &fs, const BulkJob &job, char *buffer, size_t *bytes) {
+    FILE *stream = fopen(job.Host.c_str(), "r");
+    if (stream == nullptr) {
+    	fprintf(stderr, "Unable to open %s: %s\n", job.Host.c_str(), strerror(errno));
+    	return false;
+    }
+
+    // large chunks let each write reserve its blocks as one run
+    ssize_t inumber = fs.create();
+    bool result = inumber >= 0;
+    size_t offset = 0;
+    while (result) {
+    	size_t length = fread(buffer, 1, BULK_CHUNK, stream);
+    	if (length == 0)
+    	    break;
+
+    	result = fs.write(inumber, buffer, length, offset) == (ssize_t)length;
+    	offset += length;
+    }
+    fclose(stream);
+
+    // linked last, so a name never refers to a partial file
+    if (result && !Directory(&fs, job.Directory).link(job.Name, inumber, Directory::FILE_ENTRY)) {
+    	fprintf(stderr, "Unable to link %s\n", job.Name.c_str());
+    	result = false;
+    }
+    if (!result && inumber >= 0)
+    	fs.remove(inumber);
+
+    *bytes = offset;
+    return result;
+}
+
+bool export_file(FileSystem &fs, const BulkJob &job, char *buffer, size_t *bytes) {
+    FILE *stream = fopen(job.Host.c_str(), "w");
+    if (stream == nullptr) {
+    	fprintf(stderr, "Unable to open %s: %s\n", job.Host.c_str(), strerror(errno));
+    	return false;
+    }
+
+    bool result = true;
+    size_t offset = 0;
+    while (result) {
+    	ssize_t length = fs.read(job.Inumber, buffer, BULK_CHUNK, offset);
+    	if (length <= 0) {
+    	    result = length == 0;
+    	    break;
+    	}
+
+    	result = fwrite(buffer, 1, length, stream) == (size_t)length;
+    	offset += length;
+    }
+
+    *bytes = offset;
+    return fclose(stream) == 0 && result;
+}
+
+size_t run_bulk(FileSystem &fs, const std::vector<BulkJob> &jobs,
+    std::function<bool(FileSystem &, const BulkJob &, char *, size_t *)> copy, size_t *bytes) {
+    std::atomic<size_t> next(0), failures(0), total(0);
+
+    // each worker takes the next file until none are left
+    auto worker = [&]() {
+    	std::vector<char> buffer(BULK_CHUNK);
+    	for (size_t i = next++; i < jobs.size(); i = next++) {
+    	    size_t copied = 0;
+    	    if (!copy(fs, jobs[i], buffer.data(), &copied))
+    	    	failures++;
+    	    total += copied;
+    	}
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::min(BULK_WORKERS, jobs.size()); t++)
+    	workers.push_back(std::thread(worker));
+    for (auto &thread : workers)
+    	thread.join();
+
+    *bytes = total;
+    return failures;
+}
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: data/image.20, queued I/O must behave like synchronous I/O
+
+async-input() {
+    cat <<EOF
+mount
+copyout 2 $SCRATCH/2.txt
+copyout 3 $SCRATCH/3.txt
+remove 3
+create
+copyin $SCRATCH/3.txt 0
+create
+copyin $SCRATCH/3.txt 1
+stat 0
+stat 1
+copyout 1 $SCRATCH/3.copy
+debug
+EOF
+}
+
+cp data/image.20 $SCRATCH/image.20
+cp data/image.20 $SCRATCH/image.20.async
+echo -n "Testing async on $SCRATCH/image.20 ... "
+async-input | ./bin/sfssh $SCRATCH/image.20 20 2> /dev/null | grep -v "disk block" > $SCRATCH/regular.log
+async-input | ./bin/sfssh -q 8 $SCRATCH/image.20.async 20 2> /dev/null | grep -v "disk block" > $SCRATCH/async.log
+if diff -u $SCRATCH/regular.log $SCRATCH/async.log > $SCRATCH/test.log &&
+   cmp -s $SCRATCH/image.20 $SCRATCH/image.20.async &&
+   cmp -s $SCRATCH/3.txt $SCRATCH/3.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: fresh image written through the queue
+
+async-format-input() {
+    cat <<EOF
+format
+mount
+create
+copyin README.md 0
+copyout 0 $SCRATCH/README.copy
+EOF
+}
+
+echo -n "Testing async on $SCRATCH/image.200 ... "
+async-format-input | ./bin/sfssh -q 8 $SCRATCH/image.200 200 > /dev/null 2>&1
+if cmp -s README.md $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+fi
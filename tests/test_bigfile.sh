@@ -0,0 +1,59 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: file past the indirect block is mapped through a double indirect
+# block, survives a remount and is freed completely on remove
+
+for i in $(seq 300); do cat README.md; done > $SCRATCH/README.300
+
+bigfile-input() {
+    cat <<EOF
+format
+mount
+create
+copyin $SCRATCH/README.300 0
+unmount
+mount
+copyout 0 $SCRATCH/README.copy
+check
+remove 0
+check
+EOF
+}
+
+bigfile-output() {
+    cat <<EOF
+disk formatted.
+disk mounted.
+created inode 0.
+$(stat -c %s $SCRATCH/README.300) bytes copied
+disk unmounted.
+disk mounted.
+$(stat -c %s $SCRATCH/README.300) bytes copied
+bitmaps consistent.
+removed inode 0.
+bitmaps consistent.
+EOF
+}
+
+echo -n "Testing double indirect file on $SCRATCH/image.2000 ... "
+if diff -u <(bigfile-input | ./bin/sfssh $SCRATCH/image.2000 2000 2> /dev/null | grep -v "disk block") <(bigfile-output) > $SCRATCH/test.log &&
+   cmp -s $SCRATCH/README.300 $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: blocks around every pointer tree boundary, up to the triple
+# indirect one past 4 GB, are written, read back and freed
+
+echo -n "Testing indirect tree boundaries on $SCRATCH/image.1000 ... "
+if ./bin/check_bigfile $SCRATCH/image.1000 > $SCRATCH/test.log 2>&1; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
@@ -0,0 +1,99 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: legacy data/image.20, bitmaps rebuilt by scanning
+
+check-legacy-input() {
+    cat <<EOF
+mount
+check
+EOF
+}
+
+check-legacy-output() {
+    cat <<EOF
+disk mounted.
+bitmaps consistent.
+4 disk block reads
+0 disk block writes
+EOF
+}
+
+cp data/image.20 $SCRATCH/image.20
+echo -n "Testing check on $SCRATCH/image.20 ... "
+if diff -u <(check-legacy-input | ./bin/sfssh $SCRATCH/image.20 20 2> /dev/null) <(check-legacy-output) > $SCRATCH/test.log; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: formatted image, bitmaps loaded from disk
+
+check-format-input() {
+    cat <<EOF
+format
+mount
+create
+copyin README.md 0
+create
+remove 1
+check
+EOF
+}
+
+check-format-output() {
+    cat <<EOF
+disk formatted.
+disk mounted.
+created inode 0.
+19261 bytes copied
+created inode 1.
+removed inode 1.
+bitmaps consistent.
+5 disk block reads
+20 disk block writes
+EOF
+}
+
+echo -n "Testing check on $SCRATCH/image.200 ... "
+if diff -u <(check-format-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null) <(check-format-output) > $SCRATCH/test.log; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: corrupted free block bitmap is repaired from a full scan
+
+check-corrupt-input() {
+    cat <<EOF
+mount
+check
+check
+copyout 0 $SCRATCH/README.copy
+EOF
+}
+
+check-corrupt-output() {
+    cat <<EOF
+disk mounted.
+bitmaps repaired.
+bitmaps consistent.
+19261 bytes copied
+11 disk block reads
+7 disk block writes
+EOF
+}
+
+dd if=/dev/zero of=$SCRATCH/image.200 bs=4096 seek=1 count=1 conv=notrunc 2> /dev/null
+echo -n "Testing check on corrupted $SCRATCH/image.200 ... "
+if diff -u <(check-corrupt-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null) <(check-corrupt-output) > $SCRATCH/test.log &&
+   cmp -s README.md $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: paths resolve through directories made with mkdir, files are put and
+# got back by path, and only empty directories can be removed
+
+directory-input() {
+    cat <<EOF
+format
+mount
+mkdir /docs
+mkdir docs/old
+put README.md /docs/readme
+put Makefile /docs/old/makefile
+put README.md /docs/old/makefile
+ls /docs
+lookup docs/old/makefile
+get /docs/old/makefile $SCRATCH/makefile.copy
+rm /docs/old
+rm /docs/old/makefile
+rm /docs/old
+rm /docs/missing
+ls docs
+unmount
+mount
+lookup /docs/readme
+check
+EOF
+}
+
+directory-output() {
+    cat <<EOF
+created directory /docs as inode 1.
+created directory docs/old as inode 2.
+       2 dir  old
+       3 file readme
+2 entries.
+docs/old/makefile is file inode 4.
+rm failed!
+removed /docs/old/makefile.
+removed /docs/old.
+rm failed!
+       3 file readme
+1 entries.
+/docs/readme is file inode 3.
+bitmaps consistent.
+EOF
+}
+
+echo -n "Testing directories on $SCRATCH/image.200 ... "
+if diff -u <(directory-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | sed 's/^\(sfs> \)*//' | grep -v "disk \|bytes copied\|^mounted in") <(directory-output) > $SCRATCH/test.log && \
+   cmp -s README.md $SCRATCH/makefile.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: thousands of names survive table splits, overflow chains, unlinks
+# and a remount
+
+echo -n "Testing hashed directory with 20000 names ... "
+if ./bin/check_directory > $SCRATCH/test.log 2>&1; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
@@ -5,11 +5,16 @@ image-5-output() {
 disk formatted.
 SuperBlock:
     magic number is valid
+    version 6
     5 blocks
+    1 bitmap blocks
+    1 inode bitmap blocks
+    0 journal blocks
     1 inode blocks
-    128 inodes
-2 disk block reads
-5 disk block writes
+    0 initialized inode blocks
+    64 inodes
+1 disk block reads
+3 disk block writes
 EOF
 }
 
@@ -18,11 +23,16 @@ image-20-output() {
 disk formatted.
 SuperBlock:
     magic number is valid
+    version 6
     20 blocks
+    1 bitmap blocks
+    1 inode bitmap blocks
+    0 journal blocks
     2 inode blocks
-    256 inodes
-3 disk block reads
-20 disk block writes
+    0 initialized inode blocks
+    128 inodes
+1 disk block reads
+3 disk block writes
 EOF
 }
 
@@ -31,11 +41,16 @@ image-200-output() {
 disk formatted.
 SuperBlock:
     magic number is valid
+    version 6
     200 blocks
+    1 bitmap blocks
+    1 inode bitmap blocks
+    12 journal blocks
     20 inode blocks
-    2560 inodes
-21 disk block reads
-200 disk block writes
+    0 initialized inode blocks
+    1280 inodes
+1 disk block reads
+4 disk block writes
 EOF
 }
 
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: a host tree imported by the worker pool exports back identical, with
+# directories made and merged along the way, inode numbers depend on which
+# worker gets to a file first
+
+mkdir -p $SCRATCH/tree/src/bench
+for i in $(seq 1 40); do
+    head -c $((i * 1000)) README.md > $SCRATCH/tree/part$i
+done
+cp Makefile $SCRATCH/tree/src
+cp README.md $SCRATCH/tree/src/bench
+: > $SCRATCH/tree/empty
+
+import-input() {
+    cat <<EOF
+format
+mount
+mkdir /tree
+mkdir /tree/src
+import $SCRATCH/tree /tree
+ls /tree/src
+export /tree $SCRATCH/copy
+check
+EOF
+}
+
+import-output() {
+    cat <<EOF
+imported 43 files.
+file Makefile
+dir  bench
+2 entries.
+exported 43 files.
+bitmaps consistent.
+EOF
+}
+
+echo -n "Testing import and export on $SCRATCH/image.1000 ... "
+if diff -u <(import-input | ./bin/sfssh $SCRATCH/image.1000 1000 2> /dev/null | sed 's/^\(sfs> \)*//' | grep "^ \|files.$\|entries.$\|bitmaps" | sed 's/^ \+[0-9]\+ //') <(import-output) > $SCRATCH/test.log && \
+   diff -r $SCRATCH/tree $SCRATCH/copy >> $SCRATCH/test.log; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
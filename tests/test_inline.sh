@@ -0,0 +1,61 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: a file that fits in the pointer area of its inode is stored there,
+# survives a remount and takes no data block
+
+echo "hello, inline world" > $SCRATCH/small
+
+inline-input() {
+    cat <<EOF
+format
+mount
+create
+copyin $SCRATCH/small 0
+unmount
+mount
+copyout 0 $SCRATCH/small.copy
+unmount
+debug
+EOF
+}
+
+inline-output() {
+    cat <<EOF
+Inode 0:
+    size: 20 bytes
+    inline data
+EOF
+}
+
+echo -n "Testing inline data on $SCRATCH/image.20 ... "
+if diff -u <(inline-input | ./bin/sfssh $SCRATCH/image.20 20 2> /dev/null | sed -n '/^Inode/,/^[0-9]* disk block/p' | grep -v "disk block") <(inline-output) > $SCRATCH/test.log && \
+   cmp -s $SCRATCH/small $SCRATCH/small.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: growing an inline file moves its data out to blocks, keeping what
+# was already there
+
+promote-input() {
+    cat <<EOF
+mount
+copyin README.md 0
+copyout 0 $SCRATCH/README.copy
+unmount
+debug
+EOF
+}
+
+echo -n "Testing inline data promotion on $SCRATCH/image.20 ... "
+if promote-input | ./bin/sfssh $SCRATCH/image.20 20 2> /dev/null | grep -q "^    direct blocks: [0-9 ]*$" && \
+   cmp -s README.md $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+fi
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: operations are committed in groups, and every commit is one
+# sequential journal write
+
+journal-input() {
+    cat <<EOF
+format
+mount
+journal 2
+create
+create
+create
+copyin README.md 0
+remove 1
+journal
+EOF
+}
+
+journal-output() {
+    cat <<EOF
+group commit: 2 operations
+    0 commits
+    0 journal block writes
+    0 checkpoints
+group commit: 2 operations
+    3 commits
+    14 journal block writes
+    1 checkpoints
+EOF
+}
+
+echo -n "Testing group commit on $SCRATCH/image.200 ... "
+if diff -u <(journal-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | grep -E "^(group|    [0-9]+ (commits|journal|checkpoints))") <(journal-output) > $SCRATCH/test.log; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: images copied at a commit, and with the last commit torn, are
+# repaired by replay on mount
+
+echo -n "Testing journal replay on $SCRATCH/image.2000 ... "
+if ./bin/check_journal $SCRATCH/image.2000 > $SCRATCH/test.log 2>&1; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
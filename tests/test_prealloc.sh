@@ -0,0 +1,76 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: preallocated blocks are handed out as one run and read as zeros
+# until written, the first write clears the flag of the blocks it touches
+
+echo "hello, preallocated" > $SCRATCH/small
+
+fallocate-input() {
+    cat <<EOF
+format
+mount
+create
+fallocate 0 0 28672
+copyin $SCRATCH/small 0
+copyout 0 $SCRATCH/small.copy
+unmount
+debug
+EOF
+}
+
+fallocate-output() {
+    cat <<EOF
+Inode 0:
+    size: 28672 bytes
+    direct blocks: 35 36u 37u 38u 39u
+    indirect block: 40
+    indirect data blocks: 41u 42u
+EOF
+}
+
+( cat $SCRATCH/small; head -c $((28672 - $(stat -c %s $SCRATCH/small))) /dev/zero ) > $SCRATCH/expected
+
+echo -n "Testing fallocate on $SCRATCH/image.200 ... "
+if diff -u <(fallocate-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | sed -n '/^Inode/,/^[0-9]* disk block/p' | grep -v "disk block") <(fallocate-output) > $SCRATCH/test.log && \
+   cmp -s $SCRATCH/expected $SCRATCH/small.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: truncating frees the blocks past the new end, and the indirect block
+# once nothing is left under it
+
+truncate-input() {
+    cat <<EOF
+mount
+truncate 0 10000
+check
+copyout 0 $SCRATCH/truncated.copy
+unmount
+debug
+EOF
+}
+
+truncate-output() {
+    cat <<EOF
+Inode 0:
+    size: 10000 bytes
+    direct blocks: 35 36u 37u
+EOF
+}
+
+echo -n "Testing truncate on $SCRATCH/image.200 ... "
+truncate-input | ./bin/sfssh $SCRATCH/image.200 200 > $SCRATCH/truncate.log 2> /dev/null
+if diff -u <(sed -n '/^Inode/,/^[0-9]* disk block/p' $SCRATCH/truncate.log | grep -v "disk block") <(truncate-output) > $SCRATCH/test.log && \
+   grep -q "^bitmaps consistent.$" $SCRATCH/truncate.log && \
+   cmp -s <(head -c 10000 $SCRATCH/expected) $SCRATCH/truncated.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
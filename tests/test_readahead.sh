@@ -0,0 +1,59 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: sequential copyout is read ahead, every prefetched block is used
+
+for i in 1 2 3 4 5 6 7 8; do cat README.md; done > $SCRATCH/README.8
+
+readahead-input() {
+    cat <<EOF
+format
+mount
+create
+copyin $SCRATCH/README.8 0
+unmount
+mount
+copyout 0 $SCRATCH/README.copy
+cache
+EOF
+}
+
+readahead-output() {
+    cat <<EOF
+    26 read-ahead blocks
+    26 read-ahead hits
+    0 read-ahead wasted
+EOF
+}
+
+cp data/image.200 $SCRATCH/image.200
+echo -n "Testing read-ahead on $SCRATCH/image.200 ... "
+if diff -u <(readahead-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | grep "read-ahead") <(readahead-output) > $SCRATCH/test.log &&
+   cmp -s $SCRATCH/README.8 $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: read-ahead disabled reads the same data without prefetching
+
+noreadahead-input() {
+    cat <<EOF
+mount
+readahead 0
+copyout 0 $SCRATCH/README.copy
+cache
+EOF
+}
+
+echo -n "Testing read-ahead disabled on $SCRATCH/image.200 ... "
+rm -f $SCRATCH/README.copy
+if noreadahead-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | grep -q "^    0 read-ahead blocks" &&
+   cmp -s $SCRATCH/README.8 $SCRATCH/README.copy; then
+    echo "Success"
+else
+    echo "Failure"
+fi
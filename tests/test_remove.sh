@@ -62,8 +62,8 @@ SuperBlock:
 Inode 2:
     size: 0 bytes
     direct blocks:
-25 disk block reads
-8 disk block writes
+8 disk block reads
+2 disk block writes
 EOF
 }
 
@@ -156,8 +156,8 @@ Inode 1:
 Inode 2:
     size: 965 bytes
     direct blocks: 4
-27 disk block reads
-10 disk block writes
+11 disk block reads
+6 disk block writes
 EOF
 }
 
@@ -222,16 +222,16 @@ SuperBlock:
     256 inodes
 Inode 0:
     size: 27160 bytes
-    direct blocks: 3 10 11 12 15
-    indirect block: 16
-    indirect data blocks: 17 18
+    direct blocks: 15 16 17 18 19
+    indirect block: 10
+    indirect data blocks: 11 12
 Inode 2:
     size: 27160 bytes
     direct blocks: 4 5 6 7 8
     indirect block: 9
     indirect data blocks: 13 14
-41 disk block reads
-18 disk block writes
+24 disk block reads
+10 disk block writes
 EOF
 }
 
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: with sparse writes, whole blocks of zeros are left as holes that
+# read back as zeros
+
+( head -c 8192 README.md; head -c 40960 /dev/zero; head -c 5000 README.md ) > $SCRATCH/sparse
+
+sparse-input() {
+    cat <<EOF
+format
+mount
+sparse on
+create
+copyin $SCRATCH/sparse 0
+copyout 0 $SCRATCH/sparse.copy
+unmount
+debug
+EOF
+}
+
+sparse-output() {
+    cat <<EOF
+Inode 0:
+    size: 54152 bytes
+    direct blocks: 35 36
+    indirect block: 37
+    indirect data blocks: 38 39
+EOF
+}
+
+echo -n "Testing sparse writes on $SCRATCH/image.200 ... "
+if diff -u <(sparse-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | sed -n '/^Inode/,/^[0-9]* disk block/p' | grep -v "disk block") <(sparse-output) > $SCRATCH/test.log && \
+   cmp -s $SCRATCH/sparse $SCRATCH/sparse.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: punching a hole frees the blocks wholly inside it and zeros the rest,
+# a pointer block left mapping nothing is freed too
+
+punch-input() {
+    cat <<EOF
+mount
+punch 0 100 12000
+copyout 0 $SCRATCH/punched.copy
+punch 0 40000 20000
+check
+unmount
+debug
+EOF
+}
+
+punch-output() {
+    cat <<EOF
+Inode 0:
+    size: 54152 bytes
+    direct blocks: 35
+EOF
+}
+
+( head -c 100 README.md; head -c 12000 /dev/zero; tail -c +12101 $SCRATCH/sparse ) > $SCRATCH/punched
+
+echo -n "Testing punch on $SCRATCH/image.200 ... "
+punch-input | ./bin/sfssh $SCRATCH/image.200 200 > $SCRATCH/punch.log 2> /dev/null
+if diff -u <(sed -n '/^Inode/,/^[0-9]* disk block/p' $SCRATCH/punch.log | grep -v "disk block") <(punch-output) > $SCRATCH/test.log && \
+   grep -q "^bitmaps consistent.$" $SCRATCH/punch.log && \
+   cmp -s $SCRATCH/punched $SCRATCH/punched.copy; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
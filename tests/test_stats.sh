@@ -0,0 +1,75 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: block I/O is counted by type, along with bytes moved and allocator
+# activity, and every operation gets a latency sample
+
+stats-input() {
+    cat <<EOF
+format
+mount
+create
+copyin README.md 0
+unmount
+mount
+copyout 0 $SCRATCH/README.copy
+remove 0
+stats
+EOF
+}
+
+stats-output() {
+    cat <<EOF
+stats: on
+    block           reads     writes
+    super               2          1
+    bitmap              4          2
+    journal             4          7
+    inode               1          1
+    indirect            0          0
+    data                6          6
+    $(stat -c %s README.md) bytes read
+    $(stat -c %s README.md) bytes written
+    5 blocks allocated
+    5 blocks freed
+    1 allocation runs
+    1 inodes allocated
+    1 inodes freed
+    operation       count
+    create              1
+    remove              1
+    read                2
+    write               1
+    mount               2
+EOF
+}
+
+echo -n "Testing stats on $SCRATCH/image.200 ... "
+if diff -u <(stats-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | sed -n '/^stats:/,$p' | grep -v "disk block" | awk '/operation/ { latency = 1 } latency { printf "    %-10s %10s\n", $1, $2; next } { print }') <(stats-output) > $SCRATCH/test.log; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
+
+# Test: reset zeroes everything, and the JSON dump covers the file
+# system, disk, cache and journal
+
+json-input() {
+    cat <<EOF
+mount
+stats reset
+stats json
+EOF
+}
+
+echo -n "Testing stats reset and json on $SCRATCH/image.200 ... "
+if json-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | grep '^{"fs"' | \
+   grep '"bytes_read": 0,' | grep '"mount": {"count": 0,' | grep '"disk": {"blocks": 200,' | \
+   grep '"cache": {' | grep -q '"journal": {"blocks": 12,'; then
+    echo "Success"
+else
+    echo "Failure"
+fi
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+# Test: concurrent writers, readers, creates, removes and syncs on every
+# disk backend, verified against shadow copies and after a remount, then
+# again on an asynchronous disk where one more thread only sees failures
+
+for backend in pread mmap async faulty; do
+    echo -n "Testing stress with $backend ... "
+    if ./bin/stress_fs 4 2000 $backend > /dev/null 2>&1; then
+        echo "Success"
+    else
+        echo "Failure"
+    fi
+done
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: a file system striped across three member images, two blocks per
+# stripe unit, lays out and reads back exactly as it does on one image
+
+striped-input() {
+    cat <<EOF
+format
+mount
+create
+create
+copyin README.md 0
+copyin Makefile 1
+copyout 0 $SCRATCH/readme.$1
+unmount
+mount
+copyout 1 $SCRATCH/makefile.$1
+check
+unmount
+debug
+EOF
+}
+
+echo -n "Testing striped disk on $SCRATCH/striped.200 ... "
+striped-input plain | ./bin/sfssh $SCRATCH/plain.200 200 > $SCRATCH/plain.log 2> /dev/null
+striped-input striped | ./bin/sfssh -s 3:2 $SCRATCH/striped.200 200 > $SCRATCH/striped.log 2> /dev/null
+if diff -u $SCRATCH/plain.log <(sed "s/striped/plain/g" $SCRATCH/striped.log) > $SCRATCH/test.log && \
+   [ $(ls $SCRATCH/striped.200.* | wc -l) -eq 3 ] && [ ! -e $SCRATCH/striped.200 ] && \
+   cmp -s README.md $SCRATCH/readme.striped && cmp -s Makefile $SCRATCH/makefile.striped; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/test.log
+fi
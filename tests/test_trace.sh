@@ -0,0 +1,57 @@
+#!/bin/bash
+
+SCRATCH=$(mktemp -d)
+trap "rm -fr $SCRATCH" INT QUIT TERM EXIT
+
+# Test: every block access between trace and trace off is recorded with
+# its block type, along with the disk operations underneath
+
+trace-input() {
+    cat <<EOF
+format
+mount
+trace $SCRATCH/trace
+create
+copyin README.md 0
+unmount
+mount
+copyout 0 $SCRATCH/README.copy
+trace off
+EOF
+}
+
+echo -n "Testing trace on $SCRATCH/image.200 ... "
+if trace-input | ./bin/sfssh $SCRATCH/image.200 200 2> /dev/null | grep -q "^trace stopped after [0-9]* records.$" && \
+   ./bin/sfstrace info $SCRATCH/trace > $SCRATCH/info && \
+   grep -Eq "^    write +data +[0-9]+ +[1-9][0-9]*$" $SCRATCH/info && \
+   grep -Eq "^    read +data +[0-9]+ +[1-9][0-9]*$" $SCRATCH/info && \
+   grep -Eq "^    read +inode +" $SCRATCH/info && \
+   grep -Eq "^    disk sync +- +" $SCRATCH/info; then
+    echo "Success"
+else
+    echo "Failure"
+fi
+
+# Test: cache simulation hits on every read once the cache holds the whole
+# working set, and read-ahead is reported separately
+
+echo -n "Testing sfstrace simulate on $SCRATCH/trace ... "
+if ./bin/sfstrace simulate -c 4096 -a 8 $SCRATCH/trace > $SCRATCH/simulate && \
+   [ $(grep -Ec "^ +4096 +(0|8) +" $SCRATCH/simulate) -eq 2 ] && \
+   grep -Eq "^ +4096 +0 +[0-9]+ +100.0% .* 0 +[0-9]+ +0 +0 +0$" $SCRATCH/simulate; then
+    echo "Success"
+else
+    echo "Failure"
+    cat $SCRATCH/simulate
+fi
+
+# Test: replay issues exactly the disk reads and writes that were recorded
+
+echo -n "Testing sfstrace replay on $SCRATCH/replay ... "
+READS=$(awk '$1 == "disk" && $2 == "read" { print $5 }' $SCRATCH/info)
+WRITES=$(awk '$1 == "disk" && $2 == "write" { print $5 }' $SCRATCH/info)
+if ./bin/sfstrace replay $SCRATCH/trace $SCRATCH/replay | grep -q "^    $READS blocks read, $WRITES blocks written, "; then
+    echo "Success"
+else
+    echo "Failure"
+fi